@@ -0,0 +1,106 @@
+/**
+ * decoder microbenchmark: decodes the executable sections of a guest
+ * ELF over and over and reports the insn_decode throughput.
+ *
+ *     make bench && bench/decode <guest> [rounds]
+*/
+#include <time.h>
+
+#include "rvemu.h"
+
+static u8 *read_file(char *path, u64 *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) fatal(strerror(errno));
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    u8 *buf = (u8 *)malloc(*size);
+    if (fread(buf, 1, *size, file) != *size) fatal("short read");
+    fclose(file);
+    return buf;
+}
+
+/* zero halfwords (padding) are skipped */
+static u64 collect_range(u8 *elf, u64 off, u64 end, u32 *words, u64 n, u64 cap) {
+    while (off + 2 <= end && n < cap) {
+        u16 half = *(u16 *)(elf + off);
+        if (half == 0) {
+            off += 2;
+            continue;
+        }
+
+        bool rvc = (half & 0x3) != 0x3;
+        if (!rvc && off + 4 > end) break;
+        u32 data = 0;
+        memcpy(&data, elf + off, rvc ? 2 : 4);
+        words[n++] = data;
+        off += rvc ? 2 : 4;
+    }
+    return n;
+}
+
+/**
+ * the executable sections; linkers put the elf header and .rodata in the
+ * executable segment too, so segments are only walked without sections.
+ */
+static u64 collect_text(u8 *elf, u64 size, u32 *words, u64 cap) {
+    elf64_ehdr_t *ehdr = (elf64_ehdr_t *)elf;
+    if (size < sizeof(elf64_ehdr_t) || memcmp(ehdr->e_ident, ELFMAG, 4) != 0)
+        fatal("bad elf file");
+    if (ehdr->e_machine != EM_RISCV || ehdr->e_ident[EI_CLASS] != ELFCLASS64)
+        fatal("only riscv64 elf file is supported");
+
+    u64 n = 0;
+    if (ehdr->e_shnum != 0) {
+        if (ehdr->e_shoff + ehdr->e_shnum * sizeof(elf64_shdr_t) > size) fatal("bad elf file");
+        for (u64 i = 0; i < ehdr->e_shnum; i++) {
+            elf64_shdr_t *shdr = (elf64_shdr_t *)(elf + ehdr->e_shoff + i * sizeof(elf64_shdr_t));
+            if (!(shdr->sh_flags & SHF_EXECINSTR)) continue;
+            if (shdr->sh_offset + shdr->sh_size > size) fatal("bad elf file");
+            n = collect_range(elf, shdr->sh_offset, shdr->sh_offset + shdr->sh_size, words, n, cap);
+        }
+        return n;
+    }
+
+    for (u64 i = 0; i < ehdr->e_phnum; i++) {
+        elf64_phdr_t *phdr = (elf64_phdr_t *)(elf + ehdr->e_phoff + ehdr->e_phentsize * i);
+        if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X)) continue;
+        if (phdr->p_offset + phdr->p_filesz > size) fatal("bad elf file");
+        n = collect_range(elf, phdr->p_offset, phdr->p_offset + phdr->p_filesz, words, n, cap);
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <guest> [rounds]\n", argv[0]);
+        return 1;
+    }
+    u64 rounds = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000;
+
+    u64 size = 0;
+    u8 *elf = read_file(argv[1], &size);
+    u32 *words = (u32 *)malloc(size / 2 * sizeof(u32) + sizeof(u32));
+    u64 n = collect_text(elf, size, words, size / 2 + 1);
+    if (n == 0) fatal("no executable text");
+
+    insn_t insn = {0};
+    u64 sum = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (u64 r = 0; r < rounds; r++) {
+        for (u64 i = 0; i < n; i++) {
+            insn_decode(&insn, words[i]);
+            sum += insn.type + insn.imm;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    f64 ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    f64 total = (f64)n * rounds;
+    printf("%lu insns x %lu rounds: %.2f ns/insn, %.1f Minsn/s (checksum %lx)\n",
+           n, rounds, ns / total, total / ns * 1e3, sum);
+    return 0;
+}
@@ -11,22 +11,34 @@ cache_t *new_cache() {
     cache_t *cache = (cache_t *)calloc(1, sizeof(cache_t));
     cache->jitcode = (u8 *)mmap(NULL, CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
                           MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    pthread_mutex_init(&cache->lock, NULL);
     return cache;
 }
 
-#define MAX_SEARCH_COUNT 32
-#define CACHE_HOT_COUNT  100000
+void cache_free(cache_t *cache) {
+    for (u64 i = 0; i < CACHE_ENTRY_SIZE; i++) free(cache->table[i].prof);
+    munmap(cache->jitcode, CACHE_SIZE);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
 
-#define CACHE_IS_HOT (cache->table[index].hot >= CACHE_HOT_COUNT)
+#define MAX_SEARCH_COUNT  32
+#define CACHE_HOT_COUNT   100000
+#define CACHE_DEOPT_LIMIT 16
 
+/**
+ * lookups run on every guest thread without taking the lock; an entry
+ * becomes visible only once cache_add has published its code.
+ */
 u8 *cache_lookup(cache_t *cache, u64 pc) {
     assert(pc != 0);
 
     u64 index = hash(pc);
 
-    while (cache->table[index].pc != 0) {
-        if (cache->table[index].pc == pc) {
-            if (CACHE_IS_HOT)
+    u64 item_pc;
+    while ((item_pc = __atomic_load_n(&cache->table[index].pc, __ATOMIC_ACQUIRE)) != 0) {
+        if (item_pc == pc) {
+            if (__atomic_load_n(&cache->table[index].compiled, __ATOMIC_ACQUIRE))
                 return cache->jitcode + cache->table[index].offset;
             break;
         }
@@ -43,10 +55,42 @@ static inline u64 align_to(u64 val, u64 align) {
   return (val + align - 1) & ~(align - 1);
 }
 
-u8 *cache_add(cache_t *cache, u64 pc, u8 *code, size_t sz, u64 align) {
+static u8 *cache_copy(cache_t *cache, u8 *code, size_t sz, u64 align) {
     cache->offset = align_to(cache->offset, align);
     assert(cache->offset + sz <= CACHE_SIZE);
 
+    u8 *dst = cache->jitcode + cache->offset;
+    memcpy(dst, code, sz);
+    cache->offset += sz;
+    sys_icache_invalidate(dst, sz);
+    return dst;
+}
+
+/**
+ * copies code or data (e.g. .rodata, with pc 0) into the code area without
+ * a table entry; nothing runs it until cache_add publishes it. code goes
+ * into the block table right away, so it stays in code order.
+ */
+u8 *cache_alloc(cache_t *cache, u64 pc, u8 *code, size_t sz, u64 align) {
+    pthread_mutex_lock(&cache->lock);
+    u8 *dst = cache_copy(cache, code, sz, align);
+    if (pc != 0 && cache->num_blocks < CACHE_ENTRY_SIZE) {
+        cache->blocks[cache->num_blocks] = (cache_block_t){ .offset = dst - cache->jitcode, .pc = pc };
+        __atomic_store_n(&cache->num_blocks, cache->num_blocks + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return dst;
+}
+
+/**
+ * publishes code from cache_alloc, relocated by now, as the block at pc.
+ * the release store of compiled comes last, so a thread that finds the
+ * block sees all of its code.
+ */
+void cache_add(cache_t *cache, u64 pc, u8 *code, size_t sz) {
+    sys_icache_invalidate(code, sz);
+    pthread_mutex_lock(&cache->lock);
+
     u64 index = hash(pc);
     u64 search_count = 0;
     while (cache->table[index].pc != 0) {
@@ -60,21 +104,66 @@ u8 *cache_add(cache_t *cache, u64 pc, u8 *code, size_t sz, u64 align) {
         assert(++search_count <= MAX_SEARCH_COUNT);
     }
 
-    memcpy(cache->jitcode + cache->offset, code, sz);
-    cache->table[index].pc = pc;
-    cache->table[index].offset = cache->offset;
-    cache->offset += sz;
-    sys_icache_invalidate(cache->jitcode + cache->table[index].offset, sz);
-    return cache->jitcode + cache->table[index].offset;
+    cache->table[index].offset = code - cache->jitcode;
+    __atomic_store_n(&cache->table[index].hot, CACHE_HOT_COUNT, __ATOMIC_RELAXED);
+    __atomic_store_n(&cache->table[index].pc, pc, __ATOMIC_RELEASE);
+    __atomic_store_n(&cache->table[index].compiled, true, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * the first sample is taken under the lock before the entry is published,
+ * so later ones only compare against it and can run concurrently.
+ */
+static void vprof_sample(vprof_t *prof, u64 *regs) {
+    if (__atomic_fetch_add(&prof->samples, 1, __ATOMIC_RELAXED) == 0) {
+        memcpy(prof->value, regs, sizeof(prof->value));
+        return;
+    }
+
+    u32 varying = 0;
+    for (int i = 1; i < num_gp_regs; i++) {
+        if (prof->value[i] != regs[i]) varying |= 1u << i;
+    }
+    if (varying & ~__atomic_load_n(&prof->varying, __ATOMIC_RELAXED))
+        __atomic_fetch_or(&prof->varying, varying, __ATOMIC_RELAXED);
 }
 
-bool cache_hot(cache_t *cache, u64 pc) {
+/* bumps a published entry, see cache_hot */
+static bool cache_bump(cache_item_t *item, u64 *regs) {
+    if (__atomic_load_n(&item->hot, __ATOMIC_RELAXED) >= CACHE_HOT_COUNT) return false;
+    vprof_sample(item->prof, regs);
+    return __atomic_add_fetch(&item->hot, 1, __ATOMIC_RELAXED) == CACHE_HOT_COUNT;
+}
+
+/**
+ * returns true exactly once per pc, to the thread that made it hot, so a
+ * block is never compiled twice; other threads keep interpreting it until
+ * the code is published. regs are sampled into the block's value profile
+ * on the way. this runs on every interpreted block entry, so known pcs are
+ * probed like cache_lookup, without the lock; it is taken only to insert.
+ */
+bool cache_hot(cache_t *cache, u64 pc, u64 *regs) {
     u64 index = hash(pc);
+
+    u64 item_pc;
+    while ((item_pc = __atomic_load_n(&cache->table[index].pc, __ATOMIC_ACQUIRE)) != 0) {
+        if (item_pc == pc) return cache_bump(&cache->table[index], regs);
+
+        index++;
+        index = hash(index);
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    index = hash(pc);
     u64 search_count = 0;
     while (cache->table[index].pc != 0) {
         if (cache->table[index].pc == pc) {
-            cache->table[index].hot = MIN(++cache->table[index].hot, CACHE_HOT_COUNT);
-            return CACHE_IS_HOT;
+            /* another thread inserted it since the probe */
+            pthread_mutex_unlock(&cache->lock);
+            return cache_bump(&cache->table[index], regs);
         }
 
         index++;
@@ -83,7 +172,66 @@ bool cache_hot(cache_t *cache, u64 pc) {
         assert(++search_count <= MAX_SEARCH_COUNT);
     }
 
-    cache->table[index].pc = pc;
     cache->table[index].hot = 1;
+    cache->table[index].prof = (vprof_t *)calloc(1, sizeof(vprof_t));
+    vprof_sample(cache->table[index].prof, regs);
+    __atomic_store_n(&cache->table[index].pc, pc, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&cache->lock);
     return false;
 }
+
+static cache_item_t *cache_find(cache_t *cache, u64 pc) {
+    u64 index = hash(pc);
+    while (cache->table[index].pc != 0) {
+        if (cache->table[index].pc == pc) return &cache->table[index];
+
+        index++;
+        index = hash(index);
+    }
+    return NULL;
+}
+
+/* the profile to specialize pc on, NULL once it went generic */
+vprof_t *cache_profile(cache_t *cache, u64 pc) {
+    pthread_mutex_lock(&cache->lock);
+    cache_item_t *item = cache_find(cache, pc);
+    vprof_t *prof = item && !item->generic ? item->prof : NULL;
+    pthread_mutex_unlock(&cache->lock);
+    return prof;
+}
+
+/**
+ * counts a failed entry guard of a specialized block. returns true exactly
+ * once, when the block has failed often enough that the caller should
+ * recompile it without specialization.
+ */
+bool cache_deopt(cache_t *cache, u64 pc) {
+    pthread_mutex_lock(&cache->lock);
+    cache_item_t *item = cache_find(cache, pc);
+    assert(item != NULL);
+    bool ret = !item->generic && ++item->deopts == CACHE_DEOPT_LIMIT;
+    if (ret) item->generic = true;
+    pthread_mutex_unlock(&cache->lock);
+    return ret;
+}
+
+/**
+ * the guest entry pc of the translation holding host code address code,
+ * or 0. lock-free, since the fault handler may run inside cache_alloc.
+ */
+u64 cache_block_pc(cache_t *cache, u8 *code) {
+    u64 n = __atomic_load_n(&cache->num_blocks, __ATOMIC_ACQUIRE);
+    if (n == 0 || code < cache->jitcode + cache->blocks[0].offset ||
+        code >= cache->jitcode + CACHE_SIZE)
+        return 0;
+
+    u64 off = code - cache->jitcode;
+    u64 lo = 0, hi = n;
+    while (hi - lo > 1) {
+        u64 mid = (lo + hi) / 2;
+        if (cache->blocks[mid].offset <= off) lo = mid;
+        else hi = mid;
+    }
+    return cache->blocks[lo].pc;
+}
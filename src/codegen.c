@@ -1,8 +1,62 @@
 #include "rvemu.h"
 
+/**
+ * a region is every instruction reachable from the block entry through
+ * direct control flow, sorted by pc. it is found and analysed before any
+ * code is emitted.
+*/
+typedef struct {
+    u64 pc;
+    insn_t insn;
+    i64 sp_off;  /* sp minus sp at region entry */
+    bool sp_known;
+    u64 target;  /* predicted jalr target, 0 if unknown */
+} region_insn_t;
+
+typedef struct {
+    region_insn_t *insns;
+    u64 len;
+    u64 cap;
+} region_t;
+
+/**
+ * what an fp register holds across a region. fields accessed through the
+ * fp_reg_t union are recorded during the dry run and decide the type; a
+ * typed register converts only where raw bits are read or written.
+*/
+enum fp_type_t { fp_raw, fp_single, fp_double };
+
+#define FP_FIELD_V   (1 << 0)
+#define FP_FIELD_W   (1 << 1)
+#define FP_FIELD_D   (1 << 2)
+#define FP_FIELD_F   (1 << 3)
+#define FP_FIELD_H   (1 << 4)
+#define FP_FIELD_RAW (1 << 5) /* used as a whole union, e.g. by vector ops */
+
+#define MAX_STACK_SLOTS 16
+#define MAX_SPEC_REGS   4
+#define VPROF_MIN_SAMPLES 64
+
 typedef struct {
     bool gp_reg[num_gp_regs];
     bool fp_reg[num_fp_regs];
+    u8 fp_fields[num_fp_regs];
+    enum fp_type_t fp_type[num_fp_regs];
+    bool vector;
+    bool crypto;
+    bool f16;
+    bool fenv;   /* static rounding modes switch the host's */
+    region_t *region;
+    /* sp-relative slots kept in locals, by offset from sp at region entry */
+    i32 num_slots;
+    i64 slot_off[MAX_STACK_SLOTS];
+    bool slot_dirty[MAX_STACK_SLOTS];
+    i64 slot_lo, slot_hi;
+    /* registers guarded to their profiled value on entry */
+    u64 entry;
+    i32 num_spec;
+    i32 spec_reg[MAX_SPEC_REGS];
+    u64 spec_val[MAX_SPEC_REGS];
 } tracer_t;
 
 static void tracer_reset(tracer_t *t) {
@@ -22,44 +76,170 @@ static void tracer_reset(tracer_t *t) {
 DEFINE_TRACE_USAGE(gp_reg);
 DEFINE_TRACE_USAGE(fp_reg);
 
+const i32 hot_regs[NUM_HOT_REGS] = { sp, ra, a0, a1, a2 };
+
+static i32 hot_index(i32 reg) {
+    for (i32 i = 0; i < NUM_HOT_REGS; i++) {
+        if (hot_regs[i] == reg) return i;
+    }
+    return -1;
+}
+
+static str_t stack_flush(str_t s, tracer_t *t, const char *indent) {
+    char buf[128] = {0};
+    for (i32 i = 0; i < t->num_slots; i++) {
+        if (!t->slot_dirty[i]) continue;
+        sprintf(buf, "%s*(uint64_t *)TO_HOST(sp0 + (int64_t)%ldLL) = slot%d;\n",
+                indent, t->slot_off[i], i);
+        s = str_append(s, buf);
+    }
+    return s;
+}
+
+static str_t stack_reload(str_t s, tracer_t *t, const char *indent) {
+    char buf[128] = {0};
+    for (i32 i = 0; i < t->num_slots; i++) {
+        sprintf(buf, "%sslot%d = *(uint64_t *)TO_HOST(sp0 + (int64_t)%ldLL);\n",
+                indent, i, t->slot_off[i]);
+        s = str_append(s, buf);
+    }
+    return s;
+}
+
 static str_t tracer_append_prologue(tracer_t *t, str_t s) {
-    static char buf[128] = {0};
+    char buf[128] = {0};
+
+    s = str_append(s, "block_exit_t start(state_t *restrict state");
+    for (int i = 0; i < NUM_HOT_REGS; i++) {
+        sprintf(buf, ", uint64_t h%d", i);
+        s = str_append(s, buf);
+    }
+    s = str_append(s, ") {\n");
+    s = str_append(s, "    block_exit_t exit;\n");
+    /* the guest base, loaded once so it can live in a register */
+    s = str_append(s, "    const uint64_t mem = state->mem;\n");
 
     for (int i = 1; i < num_gp_regs; i++) {
-        if (!t->gp_reg[i]) continue;
-        sprintf(buf, "    uint64_t x%d = state->gp_regs[%d];\n", i, i);
+        int h = hot_index(i);
+        if (h >= 0) {
+            sprintf(buf, "    uint64_t x%d = h%d;\n", i, h);
+        } else if (t->gp_reg[i]) {
+            sprintf(buf, "    uint64_t x%d = state->gp_regs[%d];\n", i, i);
+        } else {
+            continue;
+        }
         s = str_append(s, buf);
     }
 
     for (int i = 0; i < num_fp_regs; i++) {
         if (!t->fp_reg[i]) continue;
-        sprintf(buf, "    fp_reg_t f%d = state->fp_regs[%d];\n", i, i);
+        switch (t->fp_type[i]) {
+        case fp_raw:
+            sprintf(buf, "    fp_reg_t f%d = state->fp_regs[%d];\n", i, i);
+            break;
+        case fp_single:
+            sprintf(buf, "    float f%d = state->fp_regs[%d].f;\n"
+                         "    uint32_t f%d_hi = state->fp_regs[%d].v >> 32;\n", i, i, i, i);
+            break;
+        case fp_double:
+            sprintf(buf, "    double f%d = state->fp_regs[%d].d;\n", i, i);
+            break;
+        }
+        s = str_append(s, buf);
+    }
+
+    if (t->num_slots > 0) {
+        s = str_append(s, "    uint64_t sp0 = x2;\n");
+        for (i32 i = 0; i < t->num_slots; i++) {
+            sprintf(buf, "    uint64_t slot%d;\n", i);
+            s = str_append(s, buf);
+        }
+        s = stack_reload(s, t, "    ");
+    }
+
+    if (t->vector) {
+        s = str_append(s, "    uint64_t vl = state->vl;\n");
+        s = str_append(s, "    uint64_t vtype = state->vtype;\n");
+        s = str_append(s, "    uint8_t *vregs = (uint8_t *)state->v_regs;\n");
+    }
+
+    if (t->num_spec > 0) {
+        s = str_append(s, "    if (");
+        for (i32 i = 0; i < t->num_spec; i++) {
+            sprintf(buf, "%sx%d != %luULL", i ? " || " : "", t->spec_reg[i], t->spec_val[i]);
+            s = str_append(s, buf);
+        }
+        s = str_append(s, ") {\n");
+        sprintf(buf, "        exit.reason = deopt;\n        exit.pc = %luULL;\n", t->entry);
         s = str_append(s, buf);
+        s = str_append(s, "        goto end;\n");
+        s = str_append(s, "    }\n");
+        for (i32 i = 0; i < t->num_spec; i++) {
+            sprintf(buf, "    x%d = %luULL;\n", t->spec_reg[i], t->spec_val[i]);
+            s = str_append(s, buf);
+        }
     }
 
     return s;
 }
 
+/**
+ * branch exits tail-call the successor when it is already compiled, with
+ * the hot registers as arguments; everything else goes back to state.
+*/
 static str_t tracer_append_epilogue(tracer_t *t, str_t s) {
-    static char buf[128] = {0};
+    char buf[128] = {0};
 
     for (int i = 1; i < num_gp_regs; i++) {
-        if (!t->gp_reg[i]) continue;
+        if (!t->gp_reg[i] || hot_index(i) >= 0) continue;
         sprintf(buf, "    state->gp_regs[%d] = x%d;\n", i, i);
         s = str_append(s, buf);
     }
 
     for (int i = 0; i < num_fp_regs; i++) {
         if (!t->fp_reg[i]) continue;
-        sprintf(buf, "    state->fp_regs[%d] = f%d;\n", i, i);
+        switch (t->fp_type[i]) {
+        case fp_raw:
+            sprintf(buf, "    state->fp_regs[%d] = f%d;\n", i, i);
+            break;
+        case fp_single:
+            sprintf(buf, "    state->fp_regs[%d].v = (uint64_t)f%d_hi << 32 | F32_BITS(f%d);\n", i, i, i);
+            break;
+        case fp_double:
+            sprintf(buf, "    state->fp_regs[%d].d = f%d;\n", i, i);
+            break;
+        }
+        s = str_append(s, buf);
+    }
+
+    if (t->vector) {
+        s = str_append(s, "    state->vl = vl;\n");
+        s = str_append(s, "    state->vtype = vtype;\n");
+    }
+
+    s = stack_flush(s, t, "    ");
+
+    s = str_append(s, "    if (exit.reason == direct_branch || exit.reason == indirect_branch) {\n");
+    s = str_append(s, "        block_t next = (block_t)state->lookup(state->cache, exit.pc);\n");
+    s = str_append(s, "        if (next != 0) MUSTTAIL return next(state");
+    for (int i = 0; i < NUM_HOT_REGS; i++) {
+        sprintf(buf, ", x%d", hot_regs[i]);
+        s = str_append(s, buf);
+    }
+    s = str_append(s, ");\n");
+    s = str_append(s, "    }\n");
+
+    for (int i = 0; i < NUM_HOT_REGS; i++) {
+        sprintf(buf, "    state->gp_regs[%d] = x%d;\n", hot_regs[i], hot_regs[i]);
         s = str_append(s, buf);
     }
 
     return s;
 }
 
-static char funcbuf[128] = {0};
-static char funcbuf2[128] = {0};
+/* scratch for the emitters, per thread since guest threads compile concurrently. */
+static __thread char funcbuf[128] = {0};
+static __thread char funcbuf2[128] = {0};
 
 #define REG_SET_VAL(reg, val)                                 \
     if ((reg) != 0) {                                         \
@@ -81,13 +261,69 @@ static char funcbuf2[128] = {0};
         s = str_append(s, funcbuf);                                 \
     }                                                               \
 
-#define FREG_SET_EXPR(reg, expr, field)                            \
-    sprintf(funcbuf, "    f%d." #field " = %s;\n", (reg), (expr)); \
-    s = str_append(s, funcbuf);                                    \
+static u8 fp_field_bit(const char *field) {
+    switch (field[0]) {
+    case 'v': return FP_FIELD_V;
+    case 'w': return FP_FIELD_W;
+    case 'd': return FP_FIELD_D;
+    case 'f': return FP_FIELD_F;
+    case 'h': return FP_FIELD_H;
+    default: unreachable();
+    }
+}
+
+static enum fp_type_t fp_classify(u8 fields) {
+    if (fields & (FP_FIELD_H | FP_FIELD_RAW)) return fp_raw;
+    if ((fields & FP_FIELD_D) && !(fields & (FP_FIELD_F | FP_FIELD_W))) return fp_double;
+    if ((fields & FP_FIELD_F) && !(fields & FP_FIELD_D)) return fp_single;
+    return fp_raw;
+}
+
+static str_t freg_set(str_t s, tracer_t *t, i32 reg, const char *expr, const char *field) {
+    char buf[256] = {0};
+    u8 bit = fp_field_bit(field);
+    t->fp_fields[reg] |= bit;
+
+    if (t->fp_type[reg] == fp_raw) {
+        sprintf(buf, "    f%d.%s = %s;\n", reg, field, expr);
+    } else if (bit == FP_FIELD_D || bit == FP_FIELD_F) {
+        sprintf(buf, "    f%d = %s;\n", reg, expr);
+    } else if (t->fp_type[reg] == fp_double) {
+        sprintf(buf, "    f%d = BITS_F64(%s);\n", reg, expr);
+    } else if (bit == FP_FIELD_W) {
+        sprintf(buf, "    f%d = BITS_F32(%s);\n", reg, expr);
+    } else {
+        sprintf(buf, "    { uint64_t t_ = %s; f%d_hi = t_ >> 32; f%d = BITS_F32((uint32_t)t_); }\n",
+                expr, reg, reg);
+    }
+    return str_append(s, buf);
+}
+
+static str_t freg_get(str_t s, tracer_t *t, i32 reg, const char *name,
+                      const char *typ, const char *field) {
+    char buf[256] = {0};
+    u8 bit = fp_field_bit(field);
+    t->fp_fields[reg] |= bit;
+
+    if (t->fp_type[reg] == fp_raw) {
+        sprintf(buf, "    %s %s = f%d.%s;\n", typ, name, reg, field);
+    } else if (bit == FP_FIELD_D || bit == FP_FIELD_F) {
+        sprintf(buf, "    %s %s = f%d;\n", typ, name, reg);
+    } else if (t->fp_type[reg] == fp_double) {
+        sprintf(buf, "    %s %s = F64_BITS(f%d);\n", typ, name, reg);
+    } else if (bit == FP_FIELD_W) {
+        sprintf(buf, "    %s %s = F32_BITS(f%d);\n", typ, name, reg);
+    } else {
+        sprintf(buf, "    %s %s = (uint64_t)f%d_hi << 32 | F32_BITS(f%d);\n", typ, name, reg, reg);
+    }
+    return str_append(s, buf);
+}
+
+#define FREG_SET_EXPR(reg, expr, field)                 \
+    s = freg_set(s, tracer, (reg), (expr), #field);     \
 
-#define FREG_GET(reg, name, typ, field)                                    \
-    sprintf(funcbuf, "    " #typ " " #name " = f%d." #field ";\n", (reg)); \
-    s = str_append(s, funcbuf);                                            \
+#define FREG_GET(reg, name, typ, field)                 \
+    s = freg_get(s, tracer, (reg), #name, #typ, #field); \
 
 #define MEM_LOAD(addr, typ, name)                                                       \
     sprintf(funcbuf, "    %s " #name " = *(%s *)TO_HOST(%s);\n", (typ), (typ), (addr)); \
@@ -97,17 +333,75 @@ static char funcbuf2[128] = {0};
     sprintf(funcbuf, "    *(%s *)TO_HOST(%s) = (%s)" #data ";\n", (typ), (addr), (typ)); \
     s = str_append(s, funcbuf);                                                   \
 
+static region_insn_t *region_find(region_t *r, u64 pc);
+
+/* index of the promoted slot an sp-relative ld/sd refers to, or -1 */
+static i32 stack_slot(tracer_t *t, insn_t *insn, u64 pc) {
+    if (t->num_slots == 0 || insn->rs1 != sp) return -1;
+
+    i64 off = region_find(t->region, pc)->sp_off + insn->imm;
+    for (i32 i = 0; i < t->num_slots; i++) {
+        if (t->slot_off[i] == off) return i;
+    }
+    return -1;
+}
+
+static i32 mem_access_size(enum insn_type_t type);
+
+/**
+ * any other access may still overlap the promoted slots through a pointer:
+ * before it, the dirty slots it overlaps go back to memory, and after a
+ * store the slots it overlaps are read back, so bytes it did not write keep
+ * their latest value. sp-relative accesses were already kept apart from
+ * them at translation time.
+*/
+static str_t stack_guard(str_t s, tracer_t *t, insn_t *insn, bool reload) {
+    if (t->num_slots == 0 || insn->rs1 == sp) return s;
+
+    bool any = reload;
+    for (i32 i = 0; i < t->num_slots; i++) any |= t->slot_dirty[i];
+    if (!any) return s;
+
+    i64 size = mem_access_size(insn->type);
+    sprintf(funcbuf, "    if (rs1 + (int64_t)%ldLL - (sp0 + (int64_t)%ldLL) < %luULL) {\n",
+            (i64)insn->imm, t->slot_lo - (size - 1), (u64)(t->slot_hi - t->slot_lo + size - 1));
+    s = str_append(s, funcbuf);
+    for (i32 i = 0; i < t->num_slots; i++) {
+        if (!reload && !t->slot_dirty[i]) continue;
+        sprintf(funcbuf, "        if (rs1 + (int64_t)%ldLL - (sp0 + (int64_t)%ldLL) < %luULL) ",
+                (i64)insn->imm, t->slot_off[i] - (size - 1), (u64)(8 + size - 1));
+        s = str_append(s, funcbuf);
+        if (reload) {
+            sprintf(funcbuf, "slot%d = *(uint64_t *)TO_HOST(sp0 + (int64_t)%ldLL);\n",
+                    i, t->slot_off[i]);
+        } else {
+            sprintf(funcbuf, "*(uint64_t *)TO_HOST(sp0 + (int64_t)%ldLL) = slot%d;\n",
+                    t->slot_off[i], i);
+        }
+        s = str_append(s, funcbuf);
+    }
+    s = str_append(s, "    }\n");
+    return s;
+}
+
 static str_t func_empty(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
     return s;
 }
 
-#define FUNC(typ)                                              \
-    REG_GET(insn->rs1, rs1);                                   \
-    sprintf(funcbuf2, "rs1 + (int64_t)%ldLL", (i64)insn->imm); \
-    MEM_LOAD(funcbuf2, typ, rd);                               \
-    REG_SET_EXPR(insn->rd, "rd");                              \
-    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rd, -1);  \
-    return s;                                                  \
+#define FUNC(typ)                                                  \
+    REG_GET(insn->rs1, rs1);                                       \
+    i32 slot = stack_slot(tracer, insn, pc);                       \
+    if (slot >= 0) {                                               \
+        sprintf(funcbuf2, "slot%d", slot);                         \
+        REG_SET_EXPR(insn->rd, funcbuf2);                          \
+    } else {                                                       \
+        s = stack_guard(s, tracer, insn, false);                   \
+        sprintf(funcbuf2, "rs1 + (int64_t)%ldLL", (i64)insn->imm); \
+        MEM_LOAD(funcbuf2, typ, rd);                               \
+        REG_SET_EXPR(insn->rd, "rd");                              \
+    }                                                              \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rd, -1);      \
+    return s;                                                      \
 
 static str_t func_lb(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
     FUNC("int8_t");
@@ -208,13 +502,21 @@ static str_t func_auipc(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack,
     return s;
 }
 
-#define FUNC(typ)                                              \
-    REG_GET(insn->rs1, rs1);                                   \
-    REG_GET(insn->rs2, rs2);                                   \
-    sprintf(funcbuf2, "rs1 + (int64_t)%ldLL", (i64)insn->imm); \
-    MEM_STORE(funcbuf2, typ, rs2);                             \
-    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, -1); \
-    return s;                                                  \
+#define FUNC(typ)                                                  \
+    REG_GET(insn->rs1, rs1);                                       \
+    REG_GET(insn->rs2, rs2);                                       \
+    i32 slot = stack_slot(tracer, insn, pc);                       \
+    if (slot >= 0) {                                               \
+        sprintf(funcbuf, "    slot%d = rs2;\n", slot);             \
+        s = str_append(s, funcbuf);                                \
+    } else {                                                       \
+        s = stack_guard(s, tracer, insn, false);                   \
+        sprintf(funcbuf2, "rs1 + (int64_t)%ldLL", (i64)insn->imm); \
+        MEM_STORE(funcbuf2, typ, rs2);                             \
+        s = stack_guard(s, tracer, insn, true);                    \
+    }                                                              \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, -1);     \
+    return s;                                                      \
 
 static str_t func_sb(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
     FUNC("uint8_t");
@@ -420,15 +722,24 @@ static str_t func_bgeu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack,
 
 #undef FUNC
 
+/**
+ * a predicted target stays in the region behind a compare, which folds
+ * away whenever the host compiler sees the same constant.
+*/
 static str_t func_jalr(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
     u64 return_addr = pc + (insn->rvc ? 2 : 4);
     REG_GET(insn->rs1, rs1);
     REG_SET_VAL(insn->rd, return_addr);
 
-    s = str_append(s, "    state->exit_reason = indirect_branch;\n");
-    sprintf(funcbuf, "    state->reenter_pc = (rs1 + (int64_t)%ldLL) & ~(uint64_t)1;\n",
+    sprintf(funcbuf, "    exit.pc = (rs1 + (int64_t)%ldLL) & ~(uint64_t)1;\n",
             (i64)insn->imm);
     s = str_append(s, funcbuf);
+    u64 target = tracer->region ? region_find(tracer->region, pc)->target : 0;
+    if (target != 0) {
+        sprintf(funcbuf, "    if (exit.pc == %luULL) goto insn_%lx;\n", target, target);
+        s = str_append(s, funcbuf);
+    }
+    s = str_append(s, "    exit.reason = indirect_branch;\n");
     s = str_append(s, "    goto end;\n");
     s = str_append(s, "}\n");
     tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rd, -1);
@@ -450,25 +761,47 @@ static str_t func_jal(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u
 }
 
 static str_t func_ecall(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    s = str_append(s, "    state->exit_reason = ecall;\n");
-    sprintf(funcbuf, "    state->reenter_pc = %luULL;\n", pc + 4);
+    s = str_append(s, "    exit.reason = ecall;\n");
+    sprintf(funcbuf, "    exit.pc = %luULL;\n", pc + 4);
+    s = str_append(s, funcbuf);
+    s = str_append(s, "    goto end;\n");
+    s = str_append(s, "}\n");
+    return s;
+}
+
+/* instructions only the interpreter handles end the region there */
+static str_t func_exit_interp(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    s = str_append(s, "    exit.reason = interp;\n");
+    sprintf(funcbuf, "    exit.pc = %luULL;\n", pc);
     s = str_append(s, funcbuf);
     s = str_append(s, "    goto end;\n");
     s = str_append(s, "}\n");
+    insn->cont = true;
     return s;
 }
 
+/* fcsr is kept in sync with the host fenv by the interpreter */
 #define FUNC()                                         \
+    const char *val = "0";                             \
     switch (insn->csr) {                               \
     case fflags:                                       \
     case frm:                                          \
     case fcsr:                                         \
+        return func_exit_interp(s, insn, tracer, stack, pc); \
+    case vstart:                                       \
+    case vxsat:                                        \
+    case vxrm:                                         \
+    case vcsr:                                         \
         break;                                         \
+    case vl:    val = "vl";    break;                  \
+    case vtype: val = "vtype"; break;                  \
+    case vlenb: val = "16";    break;                  \
     default: fatal("unsupported csr");                 \
     }                                                  \
     if (insn->rd) {                                    \
-        sprintf(funcbuf, "    x%d = 0;\n", insn->rd);  \
+        sprintf(funcbuf, "    x%d = %s;\n", insn->rd, val); \
         tracer_add_gp_reg_usage(tracer, insn->rd, -1); \
+        tracer->vector = true;                         \
         s = str_append(s, funcbuf);                    \
     }                                                  \
     return s;                                          \
@@ -501,6 +834,7 @@ static str_t func_csrrci(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack
 
 #define FUNC(typ, expr)                                        \
     REG_GET(insn->rs1, rs1);                                   \
+    s = stack_guard(s, tracer, insn, false);                   \
     sprintf(funcbuf2, "rs1 + (int64_t)%ldLL", (i64)insn->imm); \
     MEM_LOAD(funcbuf2, typ, rd);                               \
     FREG_SET_EXPR(insn->rd, expr, v);                          \
@@ -521,8 +855,10 @@ static str_t func_fld(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u
 #define FUNC(typ)                                              \
     REG_GET(insn->rs1, rs1);                                   \
     FREG_GET(insn->rs2, rs2, uint64_t, v);                     \
+    s = stack_guard(s, tracer, insn, false);                   \
     sprintf(funcbuf2, "rs1 + (int64_t)%ldLL", (i64)insn->imm); \
     MEM_STORE(funcbuf2, typ, rs2);                             \
+    s = stack_guard(s, tracer, insn, true);                    \
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);            \
     tracer_add_fp_reg_usage(tracer, insn->rs2, -1);            \
     return s;                                                  \
@@ -811,8 +1147,8 @@ static str_t func_fcvt_d_lu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *st
 }
 
 #define FUNC() \
-    s = str_append(s, "    state->exit_reason = interp;\n");   \
-    sprintf(funcbuf, "    state->reenter_pc = %luULL;\n", pc); \
+    s = str_append(s, "    exit.reason = interp;\n");          \
+    sprintf(funcbuf, "    exit.pc = %luULL;\n", pc);           \
     s = str_append(s, funcbuf);                                \
     s = str_append(s, "    goto end;\n");                      \
     s = str_append(s, "}\n");                                  \
@@ -905,215 +1241,2098 @@ static str_t func_fsqrt_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stac
 
 #undef FUNC
 
-typedef str_t (func_t)(str_t, insn_t *, tracer_t *, stack_t *, u64);
-
-static func_t *funcs[] = {
-    func_lb,
-    func_lh,
-    func_lw,
-    func_ld,
-    func_lbu,
-    func_lhu,
-    func_lwu,
-    func_empty, // fence
-    func_empty, // fence_i
-    func_addi,
-    func_slli,
-    func_slti,
-    func_sltiu,
-    func_xori,
-    func_srli,
-    func_srai,
-    func_ori,
-    func_andi,
-    func_auipc,
-    func_addiw,
-    func_slliw,
-    func_srliw,
-    func_sraiw,
-    func_sb,
-    func_sh,
-    func_sw,
-    func_sd,
-    func_add,
-    func_sll,
-    func_slt,
-    func_sltu,
-    func_xor,
-    func_srl,
-    func_or,
-    func_and,
-    func_mul,
-    func_mulh,
-    func_mulhsu,
-    func_mulhu,
-    func_div,
-    func_divu,
-    func_rem,
-    func_remu,
-    func_sub,
-    func_sra,
-    func_lui,
-    func_addw,
-    func_sllw,
-    func_srlw,
-    func_mulw,
-    func_divw,
-    func_divuw,
-    func_remw,
-    func_remuw,
-    func_subw,
-    func_sraw,
-    func_beq,
-    func_bne,
-    func_blt,
-    func_bge,
-    func_bltu,
-    func_bgeu,
-    func_jalr,
-    func_jal,
-    func_ecall,
-    func_csrrw,
-    func_csrrs,
-    func_csrrc,
-    func_csrrwi,
-    func_csrrsi,
-    func_csrrci,
-    func_flw,
-    func_fsw,
-    func_fmadd_s,
-    func_fmsub_s,
-    func_fnmsub_s,
-    func_fnmadd_s,
-    func_fadd_s,
-    func_fsub_s,
-    func_fmul_s,
-    func_fdiv_s,
-    func_fsqrt_s,
-    func_fsgnj_s,
-    func_fsgnjn_s,
-    func_fsgnjx_s,
-    func_fmin_s,
-    func_fmax_s,
-    func_fcvt_w_s,
-    func_fcvt_wu_s,
-    func_fmv_x_w,
-    func_feq_s,
-    func_flt_s,
-    func_fle_s,
-    func_fclass_s,
-    func_fcvt_s_w,
-    func_fcvt_s_wu,
-    func_fmv_w_x,
-    func_fcvt_l_s,
-    func_fcvt_lu_s,
-    func_fcvt_s_l,
-    func_fcvt_s_lu,
-    func_fld,
-    func_fsd,
-    func_fmadd_d,
-    func_fmsub_d,
-    func_fnmsub_d,
-    func_fnmadd_d,
-    func_fadd_d,
-    func_fsub_d,
-    func_fmul_d,
-    func_fdiv_d,
-    func_fsqrt_d,
-    func_fsgnj_d,
-    func_fsgnjn_d,
-    func_fsgnjx_d,
-    func_fmin_d,
-    func_fmax_d,
-    func_fcvt_s_d,
-    func_fcvt_d_s,
-    func_feq_d,
-    func_flt_d,
-    func_fle_d,
-    func_fclass_d,
-    func_fcvt_w_d,
-    func_fcvt_wu_d,
-    func_fcvt_d_w,
-    func_fcvt_d_wu,
-    func_fcvt_l_d,
-    func_fcvt_lu_d,
-    func_fmv_x_d,
-    func_fcvt_d_l,
-    func_fcvt_d_lu,
-    func_fmv_d_x,
-};
+#define EXIT_INTERP()                                          \
+    s = str_append(s, "    exit.reason = interp;\n");          \
+    sprintf(funcbuf, "    exit.pc = %luULL;\n", pc);           \
+    s = str_append(s, funcbuf);                                \
+    s = str_append(s, "    goto end;\n");                      \
+    s = str_append(s, "}\n");                                  \
+    insn->cont = true;                                         \
+    return s;                                                  \
 
-#define CODEGEN_PROLOGUE                                \
-    "#define OFFSET 0x088800000000ULL               \n" \
-    "#define TO_HOST(addr) (addr + OFFSET)          \n" \
-    "enum exit_reason_t {                           \n" \
-    "   none,                                       \n" \
-    "   direct_branch,                              \n" \
-    "   indirect_branch,                            \n" \
-    "   interp,                                     \n" \
-    "   ecall,                                      \n" \
-    "};                                             \n" \
-    "typedef union {                                \n" \
-    "    uint64_t v;                                \n" \
-    "    uint32_t w;                                \n" \
-    "    double d;                                  \n" \
-    "    float f;                                   \n" \
-    "} fp_reg_t;                                    \n" \
-    "typedef struct {                               \n" \
-    "    enum exit_reason_t exit_reason;            \n" \
-    "    uint64_t reenter_pc;                       \n" \
-    "    uint64_t gp_regs[32];                      \n" \
-    "    fp_reg_t fp_regs[32];                      \n" \
-    "    uint64_t pc;                               \n" \
-    "    uint32_t fcsr;                             \n" \
-    "} state_t;                                     \n" \
-    "void start(volatile state_t *restrict state) { \n" \
+static __thread char vbuf[256] = {0};
+static __thread char vbuf2[256] = {0};
+
+/*
+ * emit one case per sew, the element loops are left for clang to
+ * vectorize onto host simd.
+ */
+static str_t vector_emit(str_t s, const char *op, const char *args, u64 pc) {
+    char buf[512] = {0};
+    s = str_append(s, "    switch (VSEW) {\n");
+    for (int sew = 8; sew <= 64; sew *= 2) {
+        sprintf(buf, "    case %d: %s(uint%d_t, int%d_t, %s); break;\n",
+                sew, op, sew, sew, args);
+        s = str_append(s, buf);
+    }
+    s = str_append(s, "    }\n");
+    return s;
+}
 
-#define CODEGEN_EPILOGUE "}"
+static str_t vector_emit_fp(str_t s, const char *op, const char *args, u64 pc) {
+    char buf[512] = {0};
+    s = str_append(s, "    switch (VSEW) {\n");
+    sprintf(buf, "    case 32: %s(uint32_t, float, %s); break;\n", op, args);
+    s = str_append(s, buf);
+    sprintf(buf, "    case 64: %s(uint64_t, double, %s); break;\n", op, args);
+    s = str_append(s, buf);
+    sprintf(buf, "    default: exit.reason = interp; "
+            "exit.pc = %luULL; goto end;\n", pc);
+    s = str_append(s, buf);
+    s = str_append(s, "    }\n");
+    return s;
+}
 
-str_t machine_genblock(machine_t *m) {
-    DECLEAR_STATIC_STR(body);
+#define VV (sprintf(vbuf2, "VREG(T_, %d)[i]", insn->rs1), vbuf2)
+#define VX (tracer_add_gp_reg_usage(tracer, insn->rs1, -1), \
+            insn->rs1 == zero ? "0" : (sprintf(vbuf2, "x%d", insn->rs1), vbuf2))
+#define VI (sprintf(vbuf2, "%ldLL", (i64)insn->imm), vbuf2)
+#define VF (tracer_add_fp_reg_usage(tracer, insn->rs1, -1),  \
+            tracer->fp_fields[insn->rs1] |= FP_FIELD_RAW,    \
+            sprintf(vbuf2, "f%d.v", insn->rs1), vbuf2)
 
-    static stack_t stack = {0};
-    stack_reset(&stack);
+static str_t func_vsetvli(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    tracer->vector = true;
+    REG_GET(insn->rs1, rs1);
+    const char *avl = insn->rs1 != zero ? "rs1" : insn->rd != zero ? "UINT64_MAX" : "vl";
+    sprintf(vbuf, "    uint64_t rd = vsetvl(&vl, &vtype, %s, %luULL);\n", avl, (u64)insn->imm);
+    s = str_append(s, vbuf);
+    REG_SET_EXPR(insn->rd, "rd");
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rd, -1);
+    return s;
+}
 
-    static set_t set;
-    set_reset(&set);
+static str_t func_vsetivli(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    tracer->vector = true;
+    sprintf(vbuf, "    uint64_t rd = vsetvl(&vl, &vtype, %d, %luULL);\n", insn->rs1, (u64)insn->imm);
+    s = str_append(s, vbuf);
+    REG_SET_EXPR(insn->rd, "rd");
+    tracer_add_gp_reg_usage(tracer, insn->rd, -1);
+    return s;
+}
+
+static str_t func_vsetvl(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    tracer->vector = true;
+    REG_GET(insn->rs1, rs1);
+    REG_GET(insn->rs2, rs2);
+    const char *avl = insn->rs1 != zero ? "rs1" : insn->rd != zero ? "UINT64_MAX" : "vl";
+    sprintf(vbuf, "    uint64_t rd = vsetvl(&vl, &vtype, %s, rs2);\n", avl);
+    s = str_append(s, vbuf);
+    REG_SET_EXPR(insn->rd, "rd");
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1);
+    return s;
+}
+
+#define FUNC(op, typ, stride)                                             \
+    if (!insn->vm) { EXIT_INTERP(); }                                     \
+    tracer->vector = true;                                                \
+    REG_GET(insn->rs1, rs1);                                              \
+    sprintf(vbuf, "    " op "(%s, %d, rs1, %s);\n", typ, insn->rd, stride); \
+    s = str_append(s, vbuf);                                              \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, -1);                       \
+    return s;                                                             \
+
+#define STRIDE (tracer_add_gp_reg_usage(tracer, insn->rs2, -1), \
+                insn->rs2 == zero ? "0" : (sprintf(vbuf2, "x%d", insn->rs2), vbuf2))
+
+static str_t func_vle8_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VLOAD", "uint8_t", "1");
+}
+
+static str_t func_vle16_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VLOAD", "uint16_t", "2");
+}
+
+static str_t func_vle32_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VLOAD", "uint32_t", "4");
+}
+
+static str_t func_vle64_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VLOAD", "uint64_t", "8");
+}
+
+static str_t func_vse8_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VSTORE", "uint8_t", "1");
+}
+
+static str_t func_vse16_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VSTORE", "uint16_t", "2");
+}
+
+static str_t func_vse32_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VSTORE", "uint32_t", "4");
+}
+
+static str_t func_vse64_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VSTORE", "uint64_t", "8");
+}
+
+static str_t func_vlse8_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VLOAD", "uint8_t", STRIDE);
+}
+
+static str_t func_vlse16_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VLOAD", "uint16_t", STRIDE);
+}
+
+static str_t func_vlse32_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VLOAD", "uint32_t", STRIDE);
+}
+
+static str_t func_vlse64_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VLOAD", "uint64_t", STRIDE);
+}
+
+static str_t func_vsse8_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VSTORE", "uint8_t", STRIDE);
+}
+
+static str_t func_vsse16_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VSTORE", "uint16_t", STRIDE);
+}
+
+static str_t func_vsse32_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VSTORE", "uint32_t", STRIDE);
+}
+
+static str_t func_vsse64_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("VSTORE", "uint64_t", STRIDE);
+}
+
+#undef STRIDE
+#undef FUNC
+
+#define FUNC(fmt, len)                                             \
+    tracer->vector = true;                                         \
+    REG_GET(insn->rs1, rs1);                                       \
+    sprintf(vbuf, fmt, insn->rd, len);                             \
+    s = str_append(s, vbuf);                                       \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, -1);                \
+    return s;                                                      \
+
+#define VLOADR  "    __builtin_memcpy(VREG(uint8_t, %d), (void *)TO_HOST(rs1), %s);\n"
+#define VSTORER "    __builtin_memcpy((void *)TO_HOST(rs1), VREG(uint8_t, %d), %s);\n"
+
+/**
+ * masks are (vl + 7) / 8 bytes, never more than VLENB. a memcpy of that
+ * would be a call clang emits to the host's memcpy, which compiled blocks
+ * cannot link; conditional byte copies become no call.
+ */
+#define VLOADM  "    for (int i = 0; i < %d; i++)\n"                                \
+                "        if (i < (vl + 7) / 8) VREG(uint8_t, %d)[i] = ((uint8_t *)TO_HOST(rs1))[i];\n"
+#define VSTOREM "    for (int i = 0; i < %d; i++)\n"                                \
+                "        if (i < (vl + 7) / 8) ((uint8_t *)TO_HOST(rs1))[i] = VREG(uint8_t, %d)[i];\n"
+
+static str_t func_vlm_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    tracer->vector = true;
+    REG_GET(insn->rs1, rs1);
+    sprintf(vbuf, VLOADM, VLENB, insn->rd);
+    s = str_append(s, vbuf);
+    tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
+    return s;
+}
+
+static str_t func_vsm_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    tracer->vector = true;
+    REG_GET(insn->rs1, rs1);
+    sprintf(vbuf, VSTOREM, VLENB, insn->rd);
+    s = str_append(s, vbuf);
+    tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
+    return s;
+}
+
+#undef VLOADM
+#undef VSTOREM
+
+static str_t func_vlr_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    sprintf(vbuf2, "%d", insn->imm * VLENB);
+    FUNC(VLOADR, vbuf2);
+}
+
+static str_t func_vsr_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    sprintf(vbuf2, "%d", insn->imm * VLENB);
+    FUNC(VSTORER, vbuf2);
+}
+
+#undef VLOADR
+#undef VSTORER
+#undef FUNC
+
+#define FUNC(operand, expr)                                               \
+    if (!insn->vm) { EXIT_INTERP(); }                                     \
+    tracer->vector = true;                                                \
+    const char *b = operand;                                              \
+    sprintf(vbuf, "%d, %d, %s, %s", insn->rd, insn->rs2, b, expr);        \
+    return vector_emit(s, "VBINOP", vbuf, pc);                            \
+
+static str_t func_vadd_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a + b");
+}
+
+static str_t func_vadd_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a + b");
+}
+
+static str_t func_vadd_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "a + b");
+}
+
+static str_t func_vsub_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a - b");
+}
+
+static str_t func_vsub_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a - b");
+}
+
+static str_t func_vrsub_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "b - a");
+}
+
+static str_t func_vrsub_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "b - a");
+}
+
+static str_t func_vminu_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a < b ? a : b");
+}
+
+static str_t func_vminu_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a < b ? a : b");
+}
+
+static str_t func_vmin_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "sa < sb ? a : b");
+}
+
+static str_t func_vmin_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "sa < sb ? a : b");
+}
+
+static str_t func_vmaxu_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a > b ? a : b");
+}
+
+static str_t func_vmaxu_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a > b ? a : b");
+}
+
+static str_t func_vmax_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "sa > sb ? a : b");
+}
+
+static str_t func_vmax_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "sa > sb ? a : b");
+}
+
+static str_t func_vand_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a & b");
+}
+
+static str_t func_vand_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a & b");
+}
+
+static str_t func_vand_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "a & b");
+}
+
+static str_t func_vor_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a | b");
+}
+
+static str_t func_vor_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a | b");
+}
+
+static str_t func_vor_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "a | b");
+}
+
+static str_t func_vxor_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a ^ b");
+}
+
+static str_t func_vxor_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a ^ b");
+}
+
+static str_t func_vxor_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "a ^ b");
+}
+
+static str_t func_vsll_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a << (b & (sizeof(T_) * 8 - 1))");
+}
+
+static str_t func_vsll_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a << (b & (sizeof(T_) * 8 - 1))");
+}
+
+static str_t func_vsll_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "a << (b & (sizeof(T_) * 8 - 1))");
+}
+
+static str_t func_vsrl_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a >> (b & (sizeof(T_) * 8 - 1))");
+}
+
+static str_t func_vsrl_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a >> (b & (sizeof(T_) * 8 - 1))");
+}
+
+static str_t func_vsrl_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "a >> (b & (sizeof(T_) * 8 - 1))");
+}
+
+static str_t func_vsra_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "sa >> (b & (sizeof(T_) * 8 - 1))");
+}
+
+static str_t func_vsra_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "sa >> (b & (sizeof(T_) * 8 - 1))");
+}
+
+static str_t func_vsra_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "sa >> (b & (sizeof(T_) * 8 - 1))");
+}
+
+static str_t func_vmul_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a * b");
+}
+
+static str_t func_vmul_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a * b");
+}
+
+#undef FUNC
+
+#define FUNC(operand)                                                     \
+    tracer->vector = true;                                                \
+    const char *b = operand;                                              \
+    sprintf(vbuf, "%d, %d, %s, %d", insn->rd, insn->rs2, b, insn->vm);    \
+    return vector_emit(s, "VMERGE", vbuf, pc);                            \
+
+static str_t func_vmerge_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV);
+}
+
+static str_t func_vmerge_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX);
+}
+
+static str_t func_vmerge_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI);
+}
+
+#undef FUNC
+
+#define FUNC(operand, expr)                                               \
+    if (!insn->vm) { EXIT_INTERP(); }                                     \
+    tracer->vector = true;                                                \
+    const char *b = operand;                                              \
+    sprintf(vbuf, "%d, %d, %s, %s", insn->rd, insn->rs2, b, expr);        \
+    return vector_emit(s, "VCMP", vbuf, pc);                              \
+
+static str_t func_vmseq_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a == b");
+}
+
+static str_t func_vmseq_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a == b");
+}
+
+static str_t func_vmseq_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "a == b");
+}
+
+static str_t func_vmsne_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a != b");
+}
+
+static str_t func_vmsne_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a != b");
+}
+
+static str_t func_vmsne_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "a != b");
+}
+
+static str_t func_vmsltu_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a < b");
+}
+
+static str_t func_vmsltu_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a < b");
+}
+
+static str_t func_vmslt_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "sa < sb");
+}
+
+static str_t func_vmslt_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "sa < sb");
+}
+
+static str_t func_vmsleu_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "a <= b");
+}
+
+static str_t func_vmsleu_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a <= b");
+}
+
+static str_t func_vmsleu_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "a <= b");
+}
+
+static str_t func_vmsle_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "sa <= sb");
+}
+
+static str_t func_vmsle_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "sa <= sb");
+}
+
+static str_t func_vmsle_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "sa <= sb");
+}
+
+static str_t func_vmsgtu_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "a > b");
+}
+
+static str_t func_vmsgtu_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "a > b");
+}
+
+static str_t func_vmsgt_vx(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VX, "sa > sb");
+}
+
+static str_t func_vmsgt_vi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VI, "sa > sb");
+}
+
+#undef FUNC
+
+static str_t func_vredsum_vs(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    if (!insn->vm) { EXIT_INTERP(); }
+    tracer->vector = true;
+    sprintf(vbuf, "%d, %d, %d", insn->rd, insn->rs2, insn->rs1);
+    return vector_emit(s, "VREDSUM", vbuf, pc);
+}
+
+static str_t func_vmv_x_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    if (insn->rd == zero) return s;
+    tracer->vector = true;
+    sprintf(vbuf, "x%d, %d", insn->rd, insn->rs2);
+    tracer_add_gp_reg_usage(tracer, insn->rd, -1);
+    return vector_emit(s, "VMV_X_S", vbuf, pc);
+}
+
+static str_t func_vmv_s_x(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    tracer->vector = true;
+    const char *b = VX;
+    sprintf(vbuf, "%d, %s", insn->rd, b);
+    return vector_emit(s, "VMV_S_X", vbuf, pc);
+}
+
+static str_t func_vid_v(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    if (!insn->vm) { EXIT_INTERP(); }
+    tracer->vector = true;
+    sprintf(vbuf, "%d", insn->rd);
+    return vector_emit(s, "VID", vbuf, pc);
+}
+
+#define FUNC(operand, expr)                                               \
+    if (!insn->vm) { EXIT_INTERP(); }                                     \
+    tracer->vector = true;                                                \
+    const char *b = operand;                                              \
+    sprintf(vbuf, "%d, %d, %s, %s", insn->rd, insn->rs2, b, expr);        \
+    return vector_emit_fp(s, "VFBINOP", vbuf, pc);                        \
+
+static str_t func_vfadd_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "x + y");
+}
+
+static str_t func_vfadd_vf(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VF, "x + y");
+}
+
+static str_t func_vfsub_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "x - y");
+}
+
+static str_t func_vfsub_vf(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VF, "x - y");
+}
+
+static str_t func_vfmul_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "x * y");
+}
+
+static str_t func_vfmul_vf(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VF, "x * y");
+}
+
+static str_t func_vfdiv_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "x / y");
+}
+
+static str_t func_vfdiv_vf(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VF, "x / y");
+}
+
+static str_t func_vfmacc_vv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VV, "y * x + z");
+}
+
+static str_t func_vfmacc_vf(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC(VF, "y * x + z");
+}
+
+#undef FUNC
+
+static str_t func_vfmerge_vf(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    tracer->vector = true;
+    const char *b = VF;
+    sprintf(vbuf, "%d, %d, %s, %d", insn->rd, insn->rs2, b, insn->vm);
+    return vector_emit_fp(s, "VMERGE", vbuf, pc);
+}
+
+static str_t func_vfmv_f_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    tracer->vector = true;
+    sprintf(vbuf, "f%d, %d", insn->rd, insn->rs2);
+    tracer_add_fp_reg_usage(tracer, insn->rd, -1);
+    tracer->fp_fields[insn->rd] |= FP_FIELD_RAW;
+    return vector_emit_fp(s, "VFMV_F_S", vbuf, pc);
+}
+
+static str_t func_vfmv_s_f(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    tracer->vector = true;
+    const char *b = VF;
+    sprintf(vbuf, "%d, %s", insn->rd, b);
+    return vector_emit_fp(s, "VMV_S_X", vbuf, pc);
+}
+
+#undef VV
+#undef VX
+#undef VI
+#undef VF
+
+#define FUNC(expr)                                                       \
+    REG_GET(insn->rs1, rs1);                                             \
+    REG_GET(insn->rs2, rs2);                                             \
+    REG_SET_EXPR(insn->rd, expr);                                        \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1); \
+    return s;                                                            \
+
+static str_t func_add_uw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(uint64_t)(uint32_t)rs1 + rs2");
+}
+
+static str_t func_sh1add(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(rs1 << 1) + rs2");
+}
+
+static str_t func_sh2add(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(rs1 << 2) + rs2");
+}
+
+static str_t func_sh3add(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(rs1 << 3) + rs2");
+}
+
+static str_t func_sh1add_uw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("((uint64_t)(uint32_t)rs1 << 1) + rs2");
+}
+
+static str_t func_sh2add_uw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("((uint64_t)(uint32_t)rs1 << 2) + rs2");
+}
+
+static str_t func_sh3add_uw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("((uint64_t)(uint32_t)rs1 << 3) + rs2");
+}
+
+static str_t func_andn(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 & ~rs2");
+}
+
+static str_t func_orn(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 | ~rs2");
+}
+
+static str_t func_xnor(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("~(rs1 ^ rs2)");
+}
+
+static str_t func_max(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(int64_t)rs1 > (int64_t)rs2 ? rs1 : rs2");
+}
+
+static str_t func_maxu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 > rs2 ? rs1 : rs2");
+}
+
+static str_t func_min(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(int64_t)rs1 < (int64_t)rs2 ? rs1 : rs2");
+}
+
+static str_t func_minu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 < rs2 ? rs1 : rs2");
+}
+
+static str_t func_rol(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(rs1 << (rs2 & 0x3f)) | (rs1 >> (-rs2 & 0x3f))");
+}
+
+static str_t func_rolw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(int64_t)(int32_t)(((uint32_t)rs1 << (rs2 & 0x1f)) | ((uint32_t)rs1 >> (-rs2 & 0x1f)))");
+}
+
+static str_t func_ror(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(rs1 >> (rs2 & 0x3f)) | (rs1 << (-rs2 & 0x3f))");
+}
+
+static str_t func_rorw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(int64_t)(int32_t)(((uint32_t)rs1 >> (rs2 & 0x1f)) | ((uint32_t)rs1 << (-rs2 & 0x1f)))");
+}
+
+static str_t func_bclr(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 & ~(1ULL << (rs2 & 0x3f))");
+}
+
+static str_t func_bext(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(rs1 >> (rs2 & 0x3f)) & 1");
+}
+
+static str_t func_binv(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 ^ (1ULL << (rs2 & 0x3f))");
+}
+
+static str_t func_bset(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 | (1ULL << (rs2 & 0x3f))");
+}
+
+#undef FUNC
+
+#define FUNC(stmt)                                            \
+    REG_GET(insn->rs1, rs1);                                  \
+    stmt;                                                     \
+    REG_SET_EXPR(insn->rd, funcbuf2);                         \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rd, -1); \
+    return s;                                                 \
+
+static str_t func_slli_uw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(uint64_t)(uint32_t)rs1 << %d", insn->imm & 0x3f)));
+}
+
+static str_t func_clz(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "rs1 == 0 ? 64 : __builtin_clzll(rs1)")));
+}
+
+static str_t func_clzw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(uint32_t)rs1 == 0 ? 32 : __builtin_clz((uint32_t)rs1)")));
+}
+
+static str_t func_ctz(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "rs1 == 0 ? 64 : __builtin_ctzll(rs1)")));
+}
+
+static str_t func_ctzw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(uint32_t)rs1 == 0 ? 32 : __builtin_ctz((uint32_t)rs1)")));
+}
+
+static str_t func_cpop(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "__builtin_popcountll(rs1)")));
+}
+
+static str_t func_cpopw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "__builtin_popcount((uint32_t)rs1)")));
+}
+
+static str_t func_sext_b(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(int64_t)(int8_t)rs1")));
+}
+
+static str_t func_sext_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(int64_t)(int16_t)rs1")));
+}
+
+static str_t func_zext_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(uint16_t)rs1")));
+}
+
+static str_t func_rori(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(rs1 >> %d) | (rs1 << %d)",
+                  insn->imm & 0x3f, -insn->imm & 0x3f)));
+}
+
+static str_t func_roriw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(int64_t)(int32_t)(((uint32_t)rs1 >> %d) | ((uint32_t)rs1 << %d))",
+                  insn->imm & 0x1f, -insn->imm & 0x1f)));
+}
+
+static str_t func_orc_b(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(((((rs1 & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | rs1)"
+                            " & 0x8080808080808080ULL) >> 7) * 0xff")));
+}
+
+static str_t func_rev8(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "__builtin_bswap64(rs1)")));
+}
+
+static str_t func_bclri(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "rs1 & ~(1ULL << %d)", insn->imm & 0x3f)));
+}
+
+static str_t func_bexti(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(rs1 >> %d) & 1", insn->imm & 0x3f)));
+}
+
+static str_t func_binvi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "rs1 ^ (1ULL << %d)", insn->imm & 0x3f)));
+}
+
+static str_t func_bseti(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "rs1 | (1ULL << %d)", insn->imm & 0x3f)));
+}
+
+#undef FUNC
+
+#if defined(__x86_64__)
+#define HOST_SUPPORTS(feature) __builtin_cpu_supports(feature)
+#else
+#define HOST_SUPPORTS(feature) false
+#endif
+
+#define FUNC(expr)                                                       \
+    REG_GET(insn->rs1, rs1);                                             \
+    REG_GET(insn->rs2, rs2);                                             \
+    REG_SET_EXPR(insn->rd, expr);                                        \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1); \
+    return s;                                                            \
+
+static str_t func_pack(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(uint64_t)(uint32_t)rs1 | (rs2 << 32)");
+}
+
+static str_t func_packh(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(uint64_t)(uint8_t)rs1 | ((uint64_t)(uint8_t)rs2 << 8)");
+}
+
+static str_t func_packw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(int64_t)(int32_t)((uint32_t)(uint16_t)rs1 | ((uint32_t)rs2 << 16))");
+}
+
+static str_t func_aes64ks2(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(((rs1 >> 32) ^ rs2) & 0xffffffff) | (((rs1 >> 32) ^ rs2 ^ (rs2 >> 32)) << 32)");
+}
+
+#undef FUNC
+
+#define FUNC(feature, expr)                                              \
+    if (!HOST_SUPPORTS(feature)) {                                       \
+        s = str_append(s, "    exit.reason = interp;\n");                \
+        sprintf(funcbuf, "    exit.pc = %luULL;\n", pc);                 \
+        s = str_append(s, funcbuf);                                      \
+        s = str_append(s, "    goto end;\n");                            \
+        s = str_append(s, "}\n");                                        \
+        insn->cont = true;                                               \
+        return s;                                                        \
+    }                                                                    \
+    tracer->crypto = true;                                               \
+    REG_GET(insn->rs1, rs1);                                             \
+    REG_GET(insn->rs2, rs2);                                             \
+    s = str_append(s, "    __m128i a = _mm_set_epi64x(rs2, rs1);\n");    \
+    REG_SET_EXPR(insn->rd, expr);                                        \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1); \
+    return s;                                                            \
+
+static str_t func_clmul(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("pclmul", "_mm_cvtsi128_si64(_mm_clmulepi64_si128(a, a, 0x10))");
+}
+
+static str_t func_clmulh(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("pclmul", "_mm_extract_epi64(_mm_clmulepi64_si128(a, a, 0x10), 1)");
+}
+
+static str_t func_aes64es(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("aes", "_mm_cvtsi128_si64(_mm_aesenclast_si128(a, _mm_setzero_si128()))");
+}
+
+static str_t func_aes64esm(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("aes", "_mm_cvtsi128_si64(_mm_aesenc_si128(a, _mm_setzero_si128()))");
+}
+
+static str_t func_aes64ds(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("aes", "_mm_cvtsi128_si64(_mm_aesdeclast_si128(a, _mm_setzero_si128()))");
+}
+
+static str_t func_aes64dsm(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("aes", "_mm_cvtsi128_si64(_mm_aesdec_si128(a, _mm_setzero_si128()))");
+}
+
+static str_t func_aes64im(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("aes", "_mm_cvtsi128_si64(_mm_aesimc_si128(a))");
+}
+
+static str_t func_aes64ks1i(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    static const u8 rcon[] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36, 0x00};
+    sprintf(vbuf, "(uint32_t)(_mm_cvtsi128_si64(_mm_aeskeygenassist_si128(a, 0x%02x)) >> %d) "
+            "* 0x100000001ULL", rcon[insn->imm], insn->imm == 0xa ? 0 : 32);
+    FUNC("aes", vbuf);
+}
+
+#undef FUNC
+
+#define FUNC(stmt)                                            \
+    REG_GET(insn->rs1, rs1);                                  \
+    stmt;                                                     \
+    REG_SET_EXPR(insn->rd, funcbuf2);                         \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rd, -1); \
+    return s;                                                 \
+
+static str_t func_brev8(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "BREV8(rs1)")));
+}
+
+static str_t func_sha256sig0(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(int64_t)(int32_t)(ROR32(rs1, 7) ^ ROR32(rs1, 18) ^ ((uint32_t)rs1 >> 3))")));
+}
+
+static str_t func_sha256sig1(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(int64_t)(int32_t)(ROR32(rs1, 17) ^ ROR32(rs1, 19) ^ ((uint32_t)rs1 >> 10))")));
+}
+
+static str_t func_sha256sum0(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(int64_t)(int32_t)(ROR32(rs1, 2) ^ ROR32(rs1, 13) ^ ROR32(rs1, 22))")));
+}
+
+static str_t func_sha256sum1(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "(int64_t)(int32_t)(ROR32(rs1, 6) ^ ROR32(rs1, 11) ^ ROR32(rs1, 25))")));
+}
+
+static str_t func_sha512sig0(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "ROR64(rs1, 1) ^ ROR64(rs1, 8) ^ (rs1 >> 7)")));
+}
+
+static str_t func_sha512sig1(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "ROR64(rs1, 19) ^ ROR64(rs1, 61) ^ (rs1 >> 6)")));
+}
+
+static str_t func_sha512sum0(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "ROR64(rs1, 28) ^ ROR64(rs1, 34) ^ ROR64(rs1, 39)")));
+}
+
+static str_t func_sha512sum1(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC((sprintf(funcbuf2, "ROR64(rs1, 14) ^ ROR64(rs1, 18) ^ ROR64(rs1, 41)")));
+}
+
+#undef FUNC
+
+static str_t func_flh(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    REG_GET(insn->rs1, rs1);
+    s = stack_guard(s, tracer, insn, false);
+    sprintf(funcbuf2, "rs1 + (int64_t)%ldLL", (i64)insn->imm);
+    MEM_LOAD(funcbuf2, "uint16_t", rd);
+    FREG_SET_EXPR(insn->rd, "HBOX(rd)", v);
+    tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
+    tracer_add_fp_reg_usage(tracer, insn->rd, -1);
+    return s;
+}
+
+static str_t func_fsh(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    REG_GET(insn->rs1, rs1);
+    FREG_GET(insn->rs2, rs2, uint16_t, h);
+    s = stack_guard(s, tracer, insn, false);
+    sprintf(funcbuf2, "rs1 + (int64_t)%ldLL", (i64)insn->imm);
+    MEM_STORE(funcbuf2, "uint16_t", rs2);
+    s = stack_guard(s, tracer, insn, true);
+    tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
+    tracer_add_fp_reg_usage(tracer, insn->rs2, -1);
+    return s;
+}
+
+static str_t func_fmv_x_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FREG_GET(insn->rs1, rs1, uint16_t, h);
+    REG_SET_EXPR(insn->rd, "(int64_t)(int16_t)rs1");
+    tracer_add_gp_reg_usage(tracer, insn->rd, -1);
+    tracer_add_fp_reg_usage(tracer, insn->rs1, -1);
+    return s;
+}
+
+static str_t func_fmv_h_x(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    REG_GET(insn->rs1, rs1);
+    FREG_SET_EXPR(insn->rd, "HBOX(rs1)", v);
+    tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
+    tracer_add_fp_reg_usage(tracer, insn->rd, -1);
+    return s;
+}
+
+/* half arithmetic is widened to float with F16C; f32 has enough
+   precision that rounding the result back to f16 is exact. */
+#define FUNC(expr)                                                       \
+    if (!HOST_SUPPORTS("f16c")) { EXIT_INTERP(); }                       \
+    tracer->f16 = true;                                                  \
+    FREG_GET(insn->rs1, h1, uint16_t, h);                                \
+    FREG_GET(insn->rs2, h2, uint16_t, h);                                \
+    s = str_append(s, "    float rs1 = H2F(h1), rs2 = H2F(h2);\n");      \
+    FREG_SET_EXPR(insn->rd, "HBOX(F2H(" expr "))", v);                   \
+    tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1); \
+    return s;                                                            \
+
+static str_t func_fadd_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 + rs2");
+}
+
+static str_t func_fsub_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 - rs2");
+}
+
+static str_t func_fmul_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 * rs2");
+}
+
+static str_t func_fdiv_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 / rs2");
+}
+
+static str_t func_fmin_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 < rs2 ? rs1 : rs2");
+}
+
+static str_t func_fmax_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 > rs2 ? rs1 : rs2");
+}
+
+#undef FUNC
+
+#define FUNC(expr)                                                  \
+    if (!HOST_SUPPORTS("f16c")) { EXIT_INTERP(); }                  \
+    tracer->f16 = true;                                             \
+    FREG_GET(insn->rs1, h1, uint16_t, h);                           \
+    FREG_GET(insn->rs2, h2, uint16_t, h);                           \
+    s = str_append(s, "    float rs1 = H2F(h1), rs2 = H2F(h2);\n"); \
+    REG_SET_EXPR(insn->rd, expr);                                   \
+    tracer_add_gp_reg_usage(tracer, insn->rd, -1);                  \
+    tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rs2, -1);      \
+    return s;                                                       \
+
+static str_t func_feq_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 == rs2");
+}
+
+static str_t func_flt_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 < rs2");
+}
+
+static str_t func_fle_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("rs1 <= rs2");
+}
+
+#undef FUNC
+
+static str_t func_fcvt_s_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    if (!HOST_SUPPORTS("f16c")) { EXIT_INTERP(); }
+    tracer->f16 = true;
+    FREG_GET(insn->rs1, rs1, uint16_t, h);
+    FREG_SET_EXPR(insn->rd, "H2F(rs1)", f);
+    tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rd, -1);
+    return s;
+}
+
+static str_t func_fcvt_d_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    if (!HOST_SUPPORTS("f16c")) { EXIT_INTERP(); }
+    tracer->f16 = true;
+    FREG_GET(insn->rs1, rs1, uint16_t, h);
+    FREG_SET_EXPR(insn->rd, "(double)H2F(rs1)", d);
+    tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rd, -1);
+    return s;
+}
+
+static str_t func_fcvt_h_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    if (!HOST_SUPPORTS("f16c")) { EXIT_INTERP(); }
+    tracer->f16 = true;
+    FREG_GET(insn->rs1, rs1, float, f);
+    FREG_SET_EXPR(insn->rd, "HBOX(F2H(rs1))", v);
+    tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rd, -1);
+    return s;
+}
+
+/* ints too wide for an exact float overflow f16 to inf either way. */
+#define FUNC(expr)                                     \
+    if (!HOST_SUPPORTS("f16c")) { EXIT_INTERP(); }     \
+    tracer->f16 = true;                                \
+    REG_GET(insn->rs1, rs1);                           \
+    FREG_SET_EXPR(insn->rd, "HBOX(F2H(" expr "))", v); \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, -1);    \
+    tracer_add_fp_reg_usage(tracer, insn->rd, -1);     \
+    return s;                                          \
+
+static str_t func_fcvt_h_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(float)(int32_t)rs1");
+}
+
+static str_t func_fcvt_h_wu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(float)(uint32_t)rs1");
+}
+
+static str_t func_fcvt_h_l(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(float)(int64_t)rs1");
+}
+
+static str_t func_fcvt_h_lu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("(float)(uint64_t)rs1");
+}
+
+#undef FUNC
+
+static str_t func_fmadd_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fmsub_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fnmsub_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fnmadd_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fsqrt_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fsgnj_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fsgnjn_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fsgnjx_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fcvt_h_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fclass_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fcvt_w_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fcvt_wu_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fcvt_l_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static str_t func_fcvt_lu_h(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    EXIT_INTERP();
+}
+
+static const char *amo_order_str(insn_t *insn, bool load) {
+    if (insn->aq && insn->rl) return "__ATOMIC_SEQ_CST";
+    if (insn->rl) return load ? "__ATOMIC_SEQ_CST" : "__ATOMIC_RELEASE";
+    return insn->aq ? "__ATOMIC_ACQUIRE" : "__ATOMIC_RELAXED";
+}
+
+#define FUNC(typ)                                                                    \
+    REG_GET(insn->rs1, rs1);                                                         \
+    sprintf(vbuf, "    " typ " v = __atomic_load_n((" typ " *)TO_HOST(rs1), %s);\n", \
+            amo_order_str(insn, true));                                              \
+    s = str_append(s, vbuf);                                                         \
+    s = str_append(s, "    state->reserve_addr = rs1;\n");                           \
+    s = str_append(s, "    state->reserve_val = v;\n");                              \
+    REG_SET_EXPR(insn->rd, "(int64_t)v");                                            \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rd, -1);                        \
+    return s;                                                                        \
+
+static str_t func_lr_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t");
+}
+
+static str_t func_lr_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t");
+}
+
+#undef FUNC
+
+#define FUNC(typ)                                                                     \
+    REG_GET(insn->rs1, rs1);                                                          \
+    REG_GET(insn->rs2, rs2);                                                          \
+    s = str_append(s, "    " typ " expected = state->reserve_val;\n");                \
+    sprintf(vbuf, "    _Bool ok = state->reserve_addr == rs1 && "                     \
+            "__atomic_compare_exchange_n((" typ " *)TO_HOST(rs1), &expected, "        \
+            "(" typ ")rs2, 0, %s, __ATOMIC_RELAXED);\n", amo_order_str(insn, false)); \
+    s = str_append(s, vbuf);                                                          \
+    s = str_append(s, "    state->reserve_addr = -1ULL;\n");                          \
+    REG_SET_EXPR(insn->rd, "!ok");                                                    \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1);              \
+    return s;                                                                         \
+
+static str_t func_sc_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t");
+}
+
+static str_t func_sc_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t");
+}
+
+#undef FUNC
+
+/* the rmw is emitted as a statement so it survives rd == x0. */
+#define FUNC(typ, fmt)                                                                \
+    REG_GET(insn->rs1, rs1);                                                          \
+    REG_GET(insn->rs2, rs2);                                                          \
+    sprintf(vbuf, "    int64_t v = (" typ ")" fmt ";\n", amo_order_str(insn, false)); \
+    s = str_append(s, vbuf);                                                          \
+    REG_SET_EXPR(insn->rd, "v");                                                      \
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1);              \
+    return s;                                                                         \
+
+static str_t func_amoswap_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t", "__atomic_exchange_n((int32_t *)TO_HOST(rs1), (int32_t)rs2, %s)");
+}
+
+static str_t func_amoadd_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t", "__atomic_fetch_add((int32_t *)TO_HOST(rs1), (int32_t)rs2, %s)");
+}
+
+static str_t func_amoxor_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t", "__atomic_fetch_xor((int32_t *)TO_HOST(rs1), (int32_t)rs2, %s)");
+}
+
+static str_t func_amoand_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t", "__atomic_fetch_and((int32_t *)TO_HOST(rs1), (int32_t)rs2, %s)");
+}
 
-    static tracer_t tracer;
-    tracer_reset(&tracer);
+static str_t func_amoor_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t", "__atomic_fetch_or((int32_t *)TO_HOST(rs1), (int32_t)rs2, %s)");
+}
+
+static str_t func_amomin_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t", "AMO_CAS(int32_t, TO_HOST(rs1), rs2, AMO_MIN, %s)");
+}
+
+static str_t func_amomax_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t", "AMO_CAS(int32_t, TO_HOST(rs1), rs2, AMO_MAX, %s)");
+}
+
+static str_t func_amominu_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t", "AMO_CAS(uint32_t, TO_HOST(rs1), rs2, AMO_MIN, %s)");
+}
+
+static str_t func_amomaxu_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int32_t", "AMO_CAS(uint32_t, TO_HOST(rs1), rs2, AMO_MAX, %s)");
+}
+
+static str_t func_amoswap_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t", "__atomic_exchange_n((int64_t *)TO_HOST(rs1), (int64_t)rs2, %s)");
+}
+
+static str_t func_amoadd_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t", "__atomic_fetch_add((int64_t *)TO_HOST(rs1), (int64_t)rs2, %s)");
+}
+
+static str_t func_amoxor_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t", "__atomic_fetch_xor((int64_t *)TO_HOST(rs1), (int64_t)rs2, %s)");
+}
+
+static str_t func_amoand_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t", "__atomic_fetch_and((int64_t *)TO_HOST(rs1), (int64_t)rs2, %s)");
+}
+
+static str_t func_amoor_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t", "__atomic_fetch_or((int64_t *)TO_HOST(rs1), (int64_t)rs2, %s)");
+}
+
+static str_t func_amomin_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t", "AMO_CAS(int64_t, TO_HOST(rs1), rs2, AMO_MIN, %s)");
+}
+
+static str_t func_amomax_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t", "AMO_CAS(int64_t, TO_HOST(rs1), rs2, AMO_MAX, %s)");
+}
+
+static str_t func_amominu_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t", "AMO_CAS(uint64_t, TO_HOST(rs1), rs2, AMO_MIN, %s)");
+}
+
+static str_t func_amomaxu_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    FUNC("int64_t", "AMO_CAS(uint64_t, TO_HOST(rs1), rs2, AMO_MAX, %s)");
+}
+
+#undef FUNC
+
+#undef EXIT_INTERP
+
+typedef str_t (func_t)(str_t, insn_t *, tracer_t *, stack_t *, u64);
+
+static func_t *funcs[] = {
+    func_lb,
+    func_lh,
+    func_lw,
+    func_ld,
+    func_lbu,
+    func_lhu,
+    func_lwu,
+    func_empty, // fence
+    func_exit_interp, // fence_i
+    func_addi,
+    func_slli,
+    func_slti,
+    func_sltiu,
+    func_xori,
+    func_srli,
+    func_srai,
+    func_ori,
+    func_andi,
+    func_auipc,
+    func_addiw,
+    func_slliw,
+    func_srliw,
+    func_sraiw,
+    func_sb,
+    func_sh,
+    func_sw,
+    func_sd,
+    func_add,
+    func_sll,
+    func_slt,
+    func_sltu,
+    func_xor,
+    func_srl,
+    func_or,
+    func_and,
+    func_mul,
+    func_mulh,
+    func_mulhsu,
+    func_mulhu,
+    func_div,
+    func_divu,
+    func_rem,
+    func_remu,
+    func_sub,
+    func_sra,
+    func_lui,
+    func_addw,
+    func_sllw,
+    func_srlw,
+    func_mulw,
+    func_divw,
+    func_divuw,
+    func_remw,
+    func_remuw,
+    func_subw,
+    func_sraw,
+    func_beq,
+    func_bne,
+    func_blt,
+    func_bge,
+    func_bltu,
+    func_bgeu,
+    func_jalr,
+    func_jal,
+    func_ecall,
+    func_csrrw,
+    func_csrrs,
+    func_csrrc,
+    func_csrrwi,
+    func_csrrsi,
+    func_csrrci,
+    func_flw,
+    func_fsw,
+    func_fmadd_s,
+    func_fmsub_s,
+    func_fnmsub_s,
+    func_fnmadd_s,
+    func_fadd_s,
+    func_fsub_s,
+    func_fmul_s,
+    func_fdiv_s,
+    func_fsqrt_s,
+    func_fsgnj_s,
+    func_fsgnjn_s,
+    func_fsgnjx_s,
+    func_fmin_s,
+    func_fmax_s,
+    func_fcvt_w_s,
+    func_fcvt_wu_s,
+    func_fmv_x_w,
+    func_feq_s,
+    func_flt_s,
+    func_fle_s,
+    func_fclass_s,
+    func_fcvt_s_w,
+    func_fcvt_s_wu,
+    func_fmv_w_x,
+    func_fcvt_l_s,
+    func_fcvt_lu_s,
+    func_fcvt_s_l,
+    func_fcvt_s_lu,
+    func_fld,
+    func_fsd,
+    func_fmadd_d,
+    func_fmsub_d,
+    func_fnmsub_d,
+    func_fnmadd_d,
+    func_fadd_d,
+    func_fsub_d,
+    func_fmul_d,
+    func_fdiv_d,
+    func_fsqrt_d,
+    func_fsgnj_d,
+    func_fsgnjn_d,
+    func_fsgnjx_d,
+    func_fmin_d,
+    func_fmax_d,
+    func_fcvt_s_d,
+    func_fcvt_d_s,
+    func_feq_d,
+    func_flt_d,
+    func_fle_d,
+    func_fclass_d,
+    func_fcvt_w_d,
+    func_fcvt_wu_d,
+    func_fcvt_d_w,
+    func_fcvt_d_wu,
+    func_fcvt_l_d,
+    func_fcvt_lu_d,
+    func_fmv_x_d,
+    func_fcvt_d_l,
+    func_fcvt_d_lu,
+    func_fmv_d_x,
+    func_vsetvli,
+    func_vsetivli,
+    func_vsetvl,
+    func_vle8_v,
+    func_vle16_v,
+    func_vle32_v,
+    func_vle64_v,
+    func_vse8_v,
+    func_vse16_v,
+    func_vse32_v,
+    func_vse64_v,
+    func_vlse8_v,
+    func_vlse16_v,
+    func_vlse32_v,
+    func_vlse64_v,
+    func_vsse8_v,
+    func_vsse16_v,
+    func_vsse32_v,
+    func_vsse64_v,
+    func_vlm_v,
+    func_vsm_v,
+    func_vlr_v,
+    func_vsr_v,
+    func_vadd_vv,
+    func_vadd_vx,
+    func_vadd_vi,
+    func_vsub_vv,
+    func_vsub_vx,
+    func_vrsub_vx,
+    func_vrsub_vi,
+    func_vminu_vv,
+    func_vminu_vx,
+    func_vmin_vv,
+    func_vmin_vx,
+    func_vmaxu_vv,
+    func_vmaxu_vx,
+    func_vmax_vv,
+    func_vmax_vx,
+    func_vand_vv,
+    func_vand_vx,
+    func_vand_vi,
+    func_vor_vv,
+    func_vor_vx,
+    func_vor_vi,
+    func_vxor_vv,
+    func_vxor_vx,
+    func_vxor_vi,
+    func_vsll_vv,
+    func_vsll_vx,
+    func_vsll_vi,
+    func_vsrl_vv,
+    func_vsrl_vx,
+    func_vsrl_vi,
+    func_vsra_vv,
+    func_vsra_vx,
+    func_vsra_vi,
+    func_vmerge_vv,
+    func_vmerge_vx,
+    func_vmerge_vi,
+    func_vmseq_vv,
+    func_vmseq_vx,
+    func_vmseq_vi,
+    func_vmsne_vv,
+    func_vmsne_vx,
+    func_vmsne_vi,
+    func_vmsltu_vv,
+    func_vmsltu_vx,
+    func_vmslt_vv,
+    func_vmslt_vx,
+    func_vmsleu_vv,
+    func_vmsleu_vx,
+    func_vmsleu_vi,
+    func_vmsle_vv,
+    func_vmsle_vx,
+    func_vmsle_vi,
+    func_vmsgtu_vx,
+    func_vmsgtu_vi,
+    func_vmsgt_vx,
+    func_vmsgt_vi,
+    func_vmul_vv,
+    func_vmul_vx,
+    func_vredsum_vs,
+    func_vmv_x_s,
+    func_vmv_s_x,
+    func_vid_v,
+    func_vfadd_vv,
+    func_vfadd_vf,
+    func_vfsub_vv,
+    func_vfsub_vf,
+    func_vfmul_vv,
+    func_vfmul_vf,
+    func_vfdiv_vv,
+    func_vfdiv_vf,
+    func_vfmacc_vv,
+    func_vfmacc_vf,
+    func_vfmerge_vf,
+    func_vfmv_f_s,
+    func_vfmv_s_f,
+    func_add_uw,
+    func_sh1add,
+    func_sh2add,
+    func_sh3add,
+    func_sh1add_uw,
+    func_sh2add_uw,
+    func_sh3add_uw,
+    func_slli_uw,
+    func_andn,
+    func_orn,
+    func_xnor,
+    func_clz,
+    func_clzw,
+    func_ctz,
+    func_ctzw,
+    func_cpop,
+    func_cpopw,
+    func_max,
+    func_maxu,
+    func_min,
+    func_minu,
+    func_sext_b,
+    func_sext_h,
+    func_zext_h,
+    func_rol,
+    func_rolw,
+    func_ror,
+    func_rori,
+    func_roriw,
+    func_rorw,
+    func_orc_b,
+    func_rev8,
+    func_bclr,
+    func_bclri,
+    func_bext,
+    func_bexti,
+    func_binv,
+    func_binvi,
+    func_bset,
+    func_bseti,
+    func_pack,
+    func_packh,
+    func_packw,
+    func_brev8,
+    func_clmul,
+    func_clmulh,
+    func_aes64es,
+    func_aes64esm,
+    func_aes64ds,
+    func_aes64dsm,
+    func_aes64im,
+    func_aes64ks1i,
+    func_aes64ks2,
+    func_sha256sig0,
+    func_sha256sig1,
+    func_sha256sum0,
+    func_sha256sum1,
+    func_sha512sig0,
+    func_sha512sig1,
+    func_sha512sum0,
+    func_sha512sum1,
+    func_flh,
+    func_fsh,
+    func_fmadd_h,
+    func_fmsub_h,
+    func_fnmsub_h,
+    func_fnmadd_h,
+    func_fadd_h,
+    func_fsub_h,
+    func_fmul_h,
+    func_fdiv_h,
+    func_fsqrt_h,
+    func_fsgnj_h,
+    func_fsgnjn_h,
+    func_fsgnjx_h,
+    func_fmin_h,
+    func_fmax_h,
+    func_fcvt_s_h,
+    func_fcvt_h_s,
+    func_fcvt_d_h,
+    func_fcvt_h_d,
+    func_feq_h,
+    func_flt_h,
+    func_fle_h,
+    func_fclass_h,
+    func_fmv_x_h,
+    func_fmv_h_x,
+    func_fcvt_w_h,
+    func_fcvt_wu_h,
+    func_fcvt_l_h,
+    func_fcvt_lu_h,
+    func_fcvt_h_w,
+    func_fcvt_h_wu,
+    func_fcvt_h_l,
+    func_fcvt_h_lu,
+    func_lr_w,
+    func_sc_w,
+    func_amoswap_w,
+    func_amoadd_w,
+    func_amoxor_w,
+    func_amoand_w,
+    func_amoor_w,
+    func_amomin_w,
+    func_amomax_w,
+    func_amominu_w,
+    func_amomaxu_w,
+    func_lr_d,
+    func_sc_d,
+    func_amoswap_d,
+    func_amoadd_d,
+    func_amoxor_d,
+    func_amoand_d,
+    func_amoor_d,
+    func_amomin_d,
+    func_amomax_d,
+    func_amominu_d,
+    func_amomaxu_d,
+};
+
+/**
+ * fp ops with a static rounding mode. conversions to integers that round
+ * toward zero are what C casts compile to, and are casts here too. other
+ * ops run under their mode, unless frm already is it, and frm is put back
+ * after them; ops the interpreter handles leave for it as they are.
+ */
+static str_t func_static_rm(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+    const char *rtz = NULL, *typ = "double", *field = "d";
+    switch (insn->rm == RM_RTZ ? insn->type : num_insns) {
+    case insn_fcvt_w_s:  typ = "float"; field = "f"; /* fall through */
+    case insn_fcvt_w_d:  rtz = "(int64_t)(int32_t)(int64_t)rs1"; break;
+    case insn_fcvt_wu_s: typ = "float"; field = "f"; /* fall through */
+    case insn_fcvt_wu_d: rtz = "(int64_t)(int32_t)(uint32_t)(int64_t)rs1"; break;
+    case insn_fcvt_l_s:  typ = "float"; field = "f"; /* fall through */
+    case insn_fcvt_l_d:  rtz = "(int64_t)rs1"; break;
+    case insn_fcvt_lu_s: typ = "float"; field = "f"; /* fall through */
+    case insn_fcvt_lu_d: rtz = "(uint64_t)(int64_t)rs1"; break;
+    default: break;
+    }
+    if (rtz != NULL) {
+        s = freg_get(s, tracer, insn->rs1, "rs1", typ, field);
+        REG_SET_EXPR(insn->rd, rtz);
+        tracer_add_gp_reg_usage(tracer, insn->rd, -1);
+        tracer_add_fp_reg_usage(tracer, insn->rs1, -1);
+        return s;
+    }
+
+    str_t op = funcs[insn->type](str_new(), insn, tracer, stack, pc);
+    if (insn->cont) {
+        s = str_append(s, op);
+        str_free(op);
+        return s;
+    }
+
+    tracer->fenv = true;
+    sprintf(funcbuf, "    const bool rm_switch = ((state->fcsr >> 5) & 0x7) != %d;\n", insn->rm);
+    s = str_append(s, funcbuf);
+    sprintf(funcbuf, "    if (rm_switch) state->round(state, %d);\n", insn->rm);
+    s = str_append(s, funcbuf);
+    s = str_append(s, op);
+    sprintf(funcbuf, "    if (rm_switch) state->round(state, %d);\n", RM_DYN);
+    s = str_append(s, funcbuf);
+    str_free(op);
+    return s;
+}
+
+/* the guest window mask, spelled out for the generated TO_HOST */
+#define STRINGIFY(x) #x
+#define EXPAND_STR(x) STRINGIFY(x)
+#define GUEST_MASK EXPAND_STR(GUEST_MEMORY_SIZE - 1)
+
+#define CODEGEN_PROLOGUE                                \
+    "#define TO_HOST(addr) (((addr) & (" GUEST_MASK ")) + mem) \n" \
+    "enum exit_reason_t {                           \n" \
+    "   none,                                       \n" \
+    "   direct_branch,                              \n" \
+    "   indirect_branch,                            \n" \
+    "   interp,                                     \n" \
+    "   ecall,                                      \n" \
+    "   deopt,                                      \n" \
+    "};                                             \n" \
+    "typedef struct {                               \n" \
+    "    uint64_t pc;                               \n" \
+    "    enum exit_reason_t reason;                 \n" \
+    "} block_exit_t;                                \n" \
+    "typedef union {                                \n" \
+    "    uint64_t v;                                \n" \
+    "    uint32_t w;                                \n" \
+    "    double d;                                  \n" \
+    "    float f;                                   \n" \
+    "    uint16_t h;                                \n" \
+    "} fp_reg_t;                                    \n" \
+    "typedef struct {                               \n" \
+    "    enum exit_reason_t exit_reason;            \n" \
+    "    uint64_t reenter_pc;                       \n" \
+    "    uint64_t gp_regs[33];                      \n" \
+    "    fp_reg_t fp_regs[32];                      \n" \
+    "    uint64_t pc;                               \n" \
+    "    uint64_t vl;                               \n" \
+    "    uint64_t vtype;                            \n" \
+    "    uint64_t vstart;                           \n" \
+    "    uint8_t v_regs[32 * 16];                   \n" \
+    "    uint64_t reserve_addr;                     \n" \
+    "    uint64_t reserve_val;                      \n" \
+    "    void *icache;                              \n" \
+    "    void *cache;                               \n" \
+    "    void *(*lookup)(void *, uint64_t);         \n" \
+    "    uint32_t fcsr;                             \n" \
+    "    bool fenv_used;                            \n" \
+    "    uint64_t mem;                              \n" \
+    "    void *decoded;                             \n" \
+    "    void (*round)(void *, uint32_t);           \n" \
+    "} state_t;                                     \n" \
+    "typedef block_exit_t (*block_t)(state_t *, uint64_t, uint64_t, \n" \
+    "                                uint64_t, uint64_t, uint64_t); \n" \
+    "#if defined(__clang__)                         \n" \
+    "#define MUSTTAIL __attribute__((musttail))     \n" \
+    "#else                                          \n" \
+    "#define MUSTTAIL                               \n" \
+    "#endif                                         \n" \
+    "static inline uint64_t F64_BITS(double d) { uint64_t v; __builtin_memcpy(&v, &d, 8); return v; } \n" \
+    "static inline double BITS_F64(uint64_t v) { double d; __builtin_memcpy(&d, &v, 8); return d; } \n" \
+    "static inline uint32_t F32_BITS(float f) { uint32_t v; __builtin_memcpy(&v, &f, 4); return v; } \n" \
+    "static inline float BITS_F32(uint32_t v) { float f; __builtin_memcpy(&f, &v, 4); return f; } \n" \
+    "#define H2F(h) _cvtsh_ss(h)                    \n" \
+    "#define F2H(f) _cvtss_sh(f, 0)                 \n" \
+    "#define HBOX(h) ((uint64_t)(uint16_t)(h) | ((uint64_t)-1 << 16)) \n" \
+    "#define AMO_MIN(a, b) ((a) < (b) ? (a) : (b))  \n" \
+    "#define AMO_MAX(a, b) ((a) > (b) ? (a) : (b))  \n" \
+    "#define AMO_CAS(T, ptr, val, op, order) ({ T *p_ = (T *)(ptr); \\\n" \
+    "    T o_ = __atomic_load_n(p_, __ATOMIC_RELAXED); \\\n" \
+    "    while (!__atomic_compare_exchange_n(p_, &o_, op(o_, (T)(val)), 1, \\\n" \
+    "                                        order, __ATOMIC_RELAXED)); \\\n" \
+    "    o_; })                                     \n" \
+    "#define ROR32(x, n) (((uint32_t)(x) >> (n)) | ((uint32_t)(x) << (32 - (n)))) \n" \
+    "#define ROR64(x, n) (((uint64_t)(x) >> (n)) | ((uint64_t)(x) << (64 - (n)))) \n" \
+    "#define BREV8(x) ({ uint64_t b_ = (x);          \\\n" \
+    "    b_ = ((b_ & 0x5555555555555555ULL) << 1) | ((b_ >> 1) & 0x5555555555555555ULL); \\\n" \
+    "    b_ = ((b_ & 0x3333333333333333ULL) << 2) | ((b_ >> 2) & 0x3333333333333333ULL); \\\n" \
+    "    ((b_ & 0x0f0f0f0f0f0f0f0fULL) << 4) | ((b_ >> 4) & 0x0f0f0f0f0f0f0f0fULL); }) \n" \
+    "#define VSEW (8u << ((vtype >> 3) & 0x7))      \n" \
+    "#define VREG(U, r) ((U *)(vregs + (r) * 16))   \n" \
+    "#define VMASK(i) ((vregs[(i) / 8] >> ((i) % 8)) & 1) \n" \
+    "#define VLOAD(U, vd, addr, stride) {           \\\n" \
+    "    U *d_ = VREG(U, vd);                       \\\n" \
+    "    for (uint64_t i = 0; i < vl; i++)          \\\n" \
+    "        d_[i] = *(U *)TO_HOST((addr) + i * (stride)); }\n" \
+    "#define VSTORE(U, vs, addr, stride) {          \\\n" \
+    "    U *s_ = VREG(U, vs);                       \\\n" \
+    "    for (uint64_t i = 0; i < vl; i++)          \\\n" \
+    "        *(U *)TO_HOST((addr) + i * (stride)) = s_[i]; }\n" \
+    "#define VBINOP(U, S, vd, vs2, B, expr) {       \\\n" \
+    "    typedef U T_;                              \\\n" \
+    "    U *d_ = VREG(U, vd), *a_ = VREG(U, vs2);   \\\n" \
+    "    for (uint64_t i = 0; i < vl; i++) {        \\\n" \
+    "        U a = a_[i], b = (U)(B);               \\\n" \
+    "        S sa = (S)a, sb = (S)b; (void)sa; (void)sb; \\\n" \
+    "        d_[i] = (U)(expr); } }                 \n" \
+    "#define VCMP(U, S, vd, vs2, B, expr) {         \\\n" \
+    "    typedef U T_;                              \\\n" \
+    "    U *a_ = VREG(U, vs2); uint8_t m_[16];      \\\n" \
+    "    __builtin_memcpy(m_, VREG(uint8_t, vd), 16); \\\n" \
+    "    for (uint64_t i = 0; i < vl; i++) {        \\\n" \
+    "        U a = a_[i], b = (U)(B);               \\\n" \
+    "        S sa = (S)a, sb = (S)b; (void)sa; (void)sb; \\\n" \
+    "        uint8_t bit = 1 << (i % 8);            \\\n" \
+    "        m_[i / 8] = (expr) ? (m_[i / 8] | bit) : (m_[i / 8] & ~bit); } \\\n" \
+    "    __builtin_memcpy(VREG(uint8_t, vd), m_, 16); }\n" \
+    "#define VMERGE(U, S, vd, vs2, B, vm) {         \\\n" \
+    "    typedef U T_;                              \\\n" \
+    "    U *d_ = VREG(U, vd), *a_ = VREG(U, vs2);   \\\n" \
+    "    for (uint64_t i = 0; i < vl; i++)          \\\n" \
+    "        d_[i] = (vm) || VMASK(i) ? (U)(B) : a_[i]; }\n" \
+    "#define VREDSUM(U, S, vd, vs2, vs1) {          \\\n" \
+    "    U sum_ = VREG(U, vs1)[0], *a_ = VREG(U, vs2); \\\n" \
+    "    for (uint64_t i = 0; i < vl; i++) sum_ += a_[i]; \\\n" \
+    "    if (vl) VREG(U, vd)[0] = sum_; }           \n" \
+    "#define VMV_X_S(U, S, dst, vs2) dst = (uint64_t)(int64_t)(S)VREG(U, vs2)[0] \n" \
+    "#define VMV_S_X(U, S, vd, B) if (vl) VREG(U, vd)[0] = (U)(B) \n" \
+    "#define VID(U, S, vd) {                        \\\n" \
+    "    U *d_ = VREG(U, vd);                       \\\n" \
+    "    for (uint64_t i = 0; i < vl; i++) d_[i] = (U)i; }\n" \
+    "#define VFBINOP(U, F, vd, vs2, B, expr) {      \\\n" \
+    "    typedef U T_;                              \\\n" \
+    "    U *d_ = VREG(U, vd), *a_ = VREG(U, vs2);   \\\n" \
+    "    for (uint64_t i = 0; i < vl; i++) {        \\\n" \
+    "        U b_ = (U)(B); F x, y, z, r;           \\\n" \
+    "        __builtin_memcpy(&x, &a_[i], sizeof(F)); \\\n" \
+    "        __builtin_memcpy(&y, &b_, sizeof(F));  \\\n" \
+    "        __builtin_memcpy(&z, &d_[i], sizeof(F)); \\\n" \
+    "        r = (expr);                            \\\n" \
+    "        __builtin_memcpy(&d_[i], &r, sizeof(F)); } }\n" \
+    "#define VFMV_F_S(U, F, dst, vs2)               \\\n" \
+    "    dst.v = sizeof(U) == 4 ? VREG(U, vs2)[0] | ~0xffffffffULL : VREG(U, vs2)[0] \n" \
+    "static inline uint64_t vsetvl(uint64_t *vl, uint64_t *vtype, \n" \
+    "                              uint64_t avl, uint64_t t) { \n" \
+    "    uint64_t sew = 8ULL << ((t >> 3) & 0x7), lmul = t & 0x7, vlmax; \n" \
+    "    if ((t >> 8) != 0 || sew > 64 || lmul == 4) vlmax = 0; \n" \
+    "    else if (lmul < 4) vlmax = (128 << lmul) / sew; \n" \
+    "    else vlmax = (128 >> (8 - lmul)) / sew;     \n" \
+    "    if (vlmax == 0) { *vtype = 1ULL << 63; *vl = 0; } \n" \
+    "    else { *vtype = t; *vl = avl < vlmax ? avl : vlmax; } \n" \
+    "    return *vl;                                \n" \
+    "}                                              \n" \
+
+#define CODEGEN_EPILOGUE "    return exit;\n}"
+
+static region_insn_t *region_add(region_t *r, u64 pc) {
+    if (r->len == r->cap) {
+        r->cap = r->cap ? r->cap * 2 : 64;
+        r->insns = realloc(r->insns, r->cap * sizeof(region_insn_t));
+    }
+    region_insn_t *ri = &r->insns[r->len++];
+    memset(ri, 0, sizeof(region_insn_t));
+    ri->pc = pc;
+    return ri;
+}
+
+static int region_cmp(const void *a, const void *b) {
+    u64 x = ((const region_insn_t *)a)->pc, y = ((const region_insn_t *)b)->pc;
+    return x < y ? -1 : x > y;
+}
+
+static region_insn_t *region_find(region_t *r, u64 pc) {
+    region_insn_t key = { .pc = pc };
+    return bsearch(&key, r->insns, r->len, sizeof(region_insn_t), region_cmp);
+}
+
+/* control flow successors within the region */
+static i32 region_succ(region_insn_t *ri, u64 succ[2]) {
+    insn_t *insn = &ri->insn;
+    i32 n = 0;
+
+    switch (insn->type) {
+    case insn_beq: case insn_bne: case insn_blt:
+    case insn_bge: case insn_bltu: case insn_bgeu:
+    case insn_jal:
+        succ[n++] = ri->pc + (i64)insn->imm;
+        break;
+    case insn_jalr:
+        if (ri->target != 0) succ[n++] = ri->target;
+        break;
+    default:
+        break;
+    }
+
+    if (!insn->cont) succ[n++] = ri->pc + (insn->rvc ? 2 : 4);
+    return n;
+}
 
-    stack_push(&stack, m->state.pc);
+/**
+ * constants along a straight run of instructions, enough to see through
+ * auipc/lui (+ addi) feeding a jalr.
+*/
+typedef struct {
+    u64 val[num_gp_regs];
+    bool known[num_gp_regs];
+} consts_t;
+
+static void consts_update(consts_t *c, insn_t *insn, u64 pc) {
+    if (insn->rd == zero || !rd_is_gp(insn->type)) return;
+
+    bool known = true;
+    u64 val = 0;
+    switch (insn->type) {
+    case insn_auipc: val = pc + (i64)insn->imm; break;
+    case insn_lui:   val = (i64)insn->imm; break;
+    case insn_addi:
+        known = c->known[insn->rs1];
+        val = c->val[insn->rs1] + (i64)insn->imm;
+        break;
+    case insn_add:
+        known = c->known[insn->rs1] && c->known[insn->rs2];
+        val = c->val[insn->rs1] + c->val[insn->rs2];
+        break;
+    case insn_jal:
+    case insn_jalr:
+        val = pc + (insn->rvc ? 2 : 4);
+        break;
+    default:
+        known = false;
+    }
+
+    c->known[insn->rd] = known;
+    c->val[insn->rd] = val;
+}
+
+/**
+ * emitters may end the region early (an exit to the interpreter, say), so
+ * it is found with a dry run of them, which also records in dry how each
+ * fp register is accessed. a fallthrough is popped right after its
+ * predecessor, which is what keeps the constants valid along a run.
+*/
+static void region_scan(region_t *r, u64 mem, u64 entry, tracer_t *dry) {
+    stack_t stack = {0};
+    stack_reset(&stack);
+
+    set_t *set = (set_t *)malloc(sizeof(set_t));
+    set_reset(set);
+
+    tracer_reset(dry);
 
-    u64 pc = -1;
+    consts_t consts;
+    u64 next_pc = 0;
 
+    stack_push(&stack, entry);
+
+    u64 pc;
     while (stack_pop(&stack, &pc)) {
-        if (!set_add(&set, pc)) {
-            continue;
+        if (!set_add(set, pc)) continue;
+
+        if (pc != next_pc) {
+            memset(&consts, 0, sizeof(consts_t));
+            consts.known[zero] = true;
+        }
+
+        region_insn_t *ri = region_add(r, pc);
+        insn_decode(&ri->insn, *(u32 *)TO_HOST(mem, pc));
+        func_t *func = ri->insn.rm == RM_DYN ? funcs[ri->insn.type] : func_static_rm;
+        str_free(func(str_new(), &ri->insn, dry, &stack, pc));
+
+        next_pc = pc + (ri->insn.rvc ? 2 : 4);
+        if (ri->insn.type == insn_jal) next_pc = pc + (i64)ri->insn.imm;
+
+        if (ri->insn.type == insn_jalr && consts.known[ri->insn.rs1]) {
+            ri->target = (consts.val[ri->insn.rs1] + (i64)ri->insn.imm) & ~(u64)1;
+            if (ri->target != 0) stack_push(&stack, ri->target);
+            next_pc = ri->target;
+        }
+        consts_update(&consts, &ri->insn, pc);
+
+        if (!ri->insn.cont) stack_push(&stack, next_pc);
+    }
+
+    free(set);
+    qsort(r->insns, r->len, sizeof(region_insn_t), region_cmp);
+}
+
+/* bytes accessed by a plain load or store, 0 for none, -1 if it cannot be tracked */
+static i32 mem_access_size(enum insn_type_t type) {
+    switch (type) {
+    case insn_lb: case insn_lbu: case insn_sb:
+        return 1;
+    case insn_lh: case insn_lhu: case insn_sh: case insn_flh: case insn_fsh:
+        return 2;
+    case insn_lw: case insn_lwu: case insn_sw: case insn_flw: case insn_fsw:
+        return 4;
+    case insn_ld: case insn_sd: case insn_fld: case insn_fsd:
+        return 8;
+    case insn_fence: case insn_fence_i:
+        return -1;
+    default:
+        if (type >= insn_vle8_v && type <= insn_vsr_v) return -1;
+        if (type >= insn_lr_w && type <= insn_amomaxu_d) return -1;
+        return 0;
+    }
+}
+
+/**
+ * promote 8-byte sp-relative ld/sd slots to host locals. sp must only move
+ * by addi and reach every instruction at a single offset from its value at
+ * entry. slots that other sp-relative accesses overlap stay in memory, and
+ * regions with atomics, fences or vector memory ops are left alone.
+*/
+static void region_promote_stack(region_t *r, u64 entry, tracer_t *t) {
+    for (u64 i = 0; i < r->len; i++) {
+        if (mem_access_size(r->insns[i].insn.type) < 0) return;
+    }
+
+    u64 *work = malloc(r->len * sizeof(u64));
+    u64 top = 0;
+
+    region_insn_t *ri = region_find(r, entry);
+    ri->sp_known = true;
+    work[top++] = ri - r->insns;
+
+    bool ok = true;
+    while (ok && top > 0) {
+        ri = &r->insns[work[--top]];
+        insn_t *insn = &ri->insn;
+
+        i64 off = ri->sp_off;
+        if (insn->rd == sp && rd_is_gp(insn->type)) {
+            if (insn->type == insn_addi && insn->rs1 == sp) off += insn->imm;
+            else ok = false;
+        }
+
+        u64 succ[2];
+        i32 n = region_succ(ri, succ);
+        for (i32 i = 0; i < n; i++) {
+            region_insn_t *next = region_find(r, succ[i]);
+            if (!next->sp_known) {
+                next->sp_known = true;
+                next->sp_off = off;
+                work[top++] = next - r->insns;
+            } else if (next->sp_off != off) {
+                ok = false;
+            }
+        }
+    }
+
+    free(work);
+    if (!ok) return;
+
+    for (u64 i = 0; i < r->len && t->num_slots < MAX_STACK_SLOTS; i++) {
+        insn_t *insn = &r->insns[i].insn;
+        if (insn->rs1 != sp || (insn->type != insn_ld && insn->type != insn_sd)) continue;
+
+        i64 off = r->insns[i].sp_off + insn->imm;
+        if (off % 8 != 0) continue;
+
+        bool clash = false;
+        for (u64 k = 0; k < r->len && !clash; k++) {
+            insn_t *other = &r->insns[k].insn;
+            i32 size = mem_access_size(other->type);
+            if (other->rs1 != sp || size <= 0) continue;
+            i64 o = r->insns[k].sp_off + other->imm;
+            if ((other->type == insn_ld || other->type == insn_sd) && o % 8 == 0) continue;
+            clash = o < off + 8 && off < o + size;
+        }
+        if (clash) continue;
+
+        i32 slot = 0;
+        while (slot < t->num_slots && t->slot_off[slot] != off) slot++;
+        if (slot == t->num_slots) {
+            t->slot_off[t->num_slots++] = off;
+            if (t->num_slots == 1 || off < t->slot_lo) t->slot_lo = off;
+            if (t->num_slots == 1 || off + 8 > t->slot_hi) t->slot_hi = off + 8;
+        }
+        if (insn->type == insn_sd) t->slot_dirty[slot] = true;
+    }
+}
+
+/**
+ * registers that held one value on every cold entry, steer the region
+ * (branch operands, load/store bases, add operands) and are never written
+ * in it become constants behind an entry guard.
+*/
+static void region_specialize(region_t *r, machine_t *m, tracer_t *t) {
+    vprof_t *prof = cache_profile(m->cache, m->state.pc);
+    if (prof == NULL || __atomic_load_n(&prof->samples, __ATOMIC_RELAXED) < VPROF_MIN_SAMPLES) return;
+    /* late samples from threads still interpreting may land meanwhile */
+    u32 varying = __atomic_load_n(&prof->varying, __ATOMIC_RELAXED);
+
+    bool used[num_gp_regs] = {0}, written[num_gp_regs] = {0};
+    for (u64 i = 0; i < r->len; i++) {
+        insn_t *insn = &r->insns[i].insn;
+        if (rd_is_gp(insn->type)) written[insn->rd] = true;
+
+        switch (insn->type) {
+        case insn_beq: case insn_bne: case insn_blt:
+        case insn_bge: case insn_bltu: case insn_bgeu:
+        case insn_add: case insn_sub: case insn_mul:
+        case insn_sh1add: case insn_sh2add: case insn_sh3add:
+            used[insn->rs1] = used[insn->rs2] = true;
+            break;
+        default:
+            if (mem_access_size(insn->type) > 0) used[insn->rs1] = true;
         }
+    }
+
+    for (i32 i = 1; i < num_gp_regs && t->num_spec < MAX_SPEC_REGS; i++) {
+        if (i == sp || !used[i] || written[i] || (varying >> i) & 1) continue;
+        t->spec_reg[t->num_spec] = i;
+        t->spec_val[t->num_spec++] = prof->value[i];
+        tracer_add_gp_reg_usage(t, i, -1);
+    }
+}
 
-        static char buf[128] = {0};
-        static insn_t insn = {0};
+str_t machine_genblock(machine_t *m) {
+    str_t body = str_new();
+
+    region_t region = {0};
+    tracer_t dry;
+    region_scan(&region, m->state.mem, m->state.pc, &dry);
+
+    tracer_t tracer;
+    tracer_reset(&tracer);
+    tracer.region = &region;
+    for (int i = 0; i < num_fp_regs; i++) tracer.fp_type[i] = fp_classify(dry.fp_fields[i]);
+    region_promote_stack(&region, m->state.pc, &tracer);
+    tracer.entry = m->state.pc;
+    region_specialize(&region, m, &tracer);
+
+    /* labels are emitted in pc order, which need not start at the entry */
+    char entry[64] = {0};
+    sprintf(entry, "    goto insn_%lx;\n", m->state.pc);
+    body = str_append(body, entry);
+
+    for (u64 i = 0; i < region.len; i++) {
+        char buf[128] = {0};
+        insn_t insn = region.insns[i].insn;
+        u64 pc = region.insns[i].pc;
+
+        /* successors are already known, the emitters' pushes go nowhere */
+        stack_t stack;
+        stack_reset(&stack);
 
         sprintf(buf, "insn_%lx: {\n", pc);
         body = str_append(body, buf);
 
-        u32 data = *(u32 *)TO_HOST(pc);
-        insn_decode(&insn, data);
-        body = funcs[insn.type](body, &insn, &tracer, &stack, pc);
+        func_t *func = insn.rm == RM_DYN ? funcs[insn.type] : func_static_rm;
+        body = func(body, &insn, &tracer, &stack, pc);
 
         if (insn.cont) continue;
 
-        pc += (insn.rvc ? 2 : 4);
-        sprintf(buf, "    goto insn_%lx;\n", pc);
+        sprintf(buf, "    goto insn_%lx;\n", pc + (insn.rvc ? 2 : 4));
         body = str_append(body, buf);
         body = str_append(body, "}\n");
-        stack_push(&stack, pc);
     }
 
-    DECLEAR_STATIC_STR(source);
+    str_t source = str_new();
+    /* a non-default frm set by the guest, or static modes, must survive the compiler */
+    if (m->state.fenv_used || tracer.fenv)
+        source = str_append(source, "#pragma STDC FENV_ACCESS ON\n");
     source = str_append(source, "#include <stdint.h>\n");
     source = str_append(source, "#include <stdbool.h>\n");
+    if (tracer.crypto || tracer.f16) source = str_append(source, "#include <immintrin.h>\n");
     source = str_append(source, CODEGEN_PROLOGUE);
     source = tracer_append_prologue(&tracer, source);
     source = str_append(source, body);
@@ -1121,5 +3340,7 @@ str_t machine_genblock(machine_t *m) {
     source = tracer_append_epilogue(&tracer, source);
     source = str_append(source, CODEGEN_EPILOGUE);
 
+    str_free(body);
+    free(region.insns);
     return source;
 }
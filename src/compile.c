@@ -2,100 +2,142 @@
 
 #define BINBUF_CAP 64 * 1024
 
-static u8 elfbuf[BINBUF_CAP] = {0};
-
 u8 *machine_compile(machine_t *m, str_t source) {
-    int saved_stdout = dup(STDOUT_FILENO);
-    int outp[2];
+    u8 elfbuf[BINBUF_CAP];
 
+    /**
+     * guest threads may be writing to stdout concurrently, so instead of
+     * redirecting it, hand clang the write end of a private pipe.
+     */
+    int outp[2];
     if (pipe(outp) != 0) fatal("cannot make a pipe");
-    dup2(outp[1], STDOUT_FILENO);
-    close(outp[1]);
+    fcntl(outp[0], F_SETFD, FD_CLOEXEC);
+
+    char cmd[128];
+    sprintf(cmd, "clang -O3 -march=native -c -xc -o /dev/fd/%d -", outp[1]);
 
     FILE *f;
-    f = popen("clang -O3 -c -xc -o /dev/stdout -", "w");
+    f = popen(cmd, "w");
     if (f == NULL) fatal("cannot compile program");
     fwrite(source, 1, str_len(source), f);
+    close(outp[1]);
     pclose(f);
-    fflush(stdout);
 
     (void) read(outp[0], elfbuf, BINBUF_CAP);
     close(outp[0]);
-    dup2(saved_stdout, STDOUT_FILENO);
-    close(saved_stdout);
 
     elf64_ehdr_t *ehdr = (elf64_ehdr_t *)elfbuf;
 
     /**
-     * for some instructions, clang will generate a corresponding .rodata section.
-     * this means we need to write a mini-linker that puts the .rodata section into
+     * for some instructions, clang will generate corresponding .rodata sections
+     * (constant pools, jump tables, possibly several of them with -march=native).
+     * this means we need to write a mini-linker that puts each .rodata section into
      * memory, takes its actual address, and uses symbols and relocations to apply
-     * it back to the corresponding location in the .text section.
+     * it back to every loaded section: .text refers to the constants and to
+     * split-off .text.* code, and jump tables in .rodata refer back to .text
+     * through their own .rela.rodata.
      */
 
-    i64 text_idx = 0, symtab_idx = 0, rela_idx = 0, rodata_idx = 0;
-    {
-        u64 shstr_shoff = ehdr->e_shoff + ehdr->e_shstrndx * sizeof(elf64_shdr_t);
-        elf64_shdr_t *shstr_shdr = (elf64_shdr_t *)(elfbuf + shstr_shoff);
-        assert(ehdr->e_shnum != 0);
-
-        for (i64 idx = 0; idx < ehdr->e_shnum; idx++) {
-            u64 shoff = ehdr->e_shoff + idx * sizeof(elf64_shdr_t);
-            elf64_shdr_t *shdr = (elf64_shdr_t *)(elfbuf + shoff);
-            char *str = (char *)(elfbuf + shstr_shdr->sh_offset + shdr->sh_name);
-            if (strcmp(str, ".text") == 0) text_idx = idx;
-            if (strcmp(str, ".rela.text") == 0) rela_idx = idx;
-            if (strncmp(str, ".rodata.", strlen(".rodata.")) == 0) rodata_idx = idx;
-            if (strcmp(str, ".symtab") == 0) symtab_idx = idx;
-        }
+    u64 shstr_shoff = ehdr->e_shoff + ehdr->e_shstrndx * sizeof(elf64_shdr_t);
+    elf64_shdr_t *shstr_shdr = (elf64_shdr_t *)(elfbuf + shstr_shoff);
+    assert(ehdr->e_shnum != 0);
+
+    i64 text_idx = 0, symtab_idx = 0;
+    bool loaded[ehdr->e_shnum];
+    for (i64 idx = 0; idx < ehdr->e_shnum; idx++) {
+        u64 shoff = ehdr->e_shoff + idx * sizeof(elf64_shdr_t);
+        elf64_shdr_t *shdr = (elf64_shdr_t *)(elfbuf + shoff);
+        char *str = (char *)(elfbuf + shstr_shdr->sh_offset + shdr->sh_name);
+        if (strcmp(str, ".text") == 0) text_idx = idx;
+        if (strcmp(str, ".symtab") == 0) symtab_idx = idx;
+        loaded[idx] = strncmp(str, ".text", strlen(".text")) == 0 ||
+                      strncmp(str, ".rodata", strlen(".rodata")) == 0;
     }
 
     assert(text_idx != 0 && symtab_idx != 0);
 
+    // only relocations against loaded sections matter, .rela.eh_frame is dropped.
+    bool has_rela = false;
+    for (i64 idx = 0; idx < ehdr->e_shnum; idx++) {
+        elf64_shdr_t *shdr = (elf64_shdr_t *)(elfbuf + ehdr->e_shoff + idx * sizeof(elf64_shdr_t));
+        if (shdr->sh_type == SHT_RELA && shdr->sh_info < ehdr->e_shnum && loaded[shdr->sh_info])
+            has_rela = true;
+    }
+
     u64 text_shoff = ehdr->e_shoff + text_idx * sizeof(elf64_shdr_t);
     elf64_shdr_t *text_shdr = (elf64_shdr_t *)(elfbuf + text_shoff);
 
-    if (rela_idx == 0 || rodata_idx == 0) {
-        return cache_add(m->cache, m->state.pc, elfbuf + text_shdr->sh_offset,
-                         text_shdr->sh_size, text_shdr->sh_addralign);
+    /* guest threads share the cache: the block is published only once it is ready to run */
+    if (!has_rela) {
+        u8 *code = cache_alloc(m->cache, m->state.pc, elfbuf + text_shdr->sh_offset,
+                               text_shdr->sh_size, text_shdr->sh_addralign);
+        cache_add(m->cache, m->state.pc, code, text_shdr->sh_size);
+        return code;
     }
 
-    u64 text_addr = 0, rodata_addr = 0;
-    {
-        u64 shoff = ehdr->e_shoff + rodata_idx * sizeof(elf64_shdr_t);
-        elf64_shdr_t *shdr = (elf64_shdr_t *)(elfbuf + shoff);
-        rodata_addr = (u64)cache_add(m->cache, m->state.pc, elfbuf + shdr->sh_offset,
-                  shdr->sh_size, shdr->sh_addralign);
-        text_addr = (u64)cache_add(m->cache, m->state.pc, elfbuf + text_shdr->sh_offset,
-                                   text_shdr->sh_size, text_shdr->sh_addralign);
+    // host address of every loaded section, indexed like the section headers.
+    u64 sec_addr[ehdr->e_shnum];
+    memset(sec_addr, 0, sizeof(sec_addr));
+    for (i64 idx = 0; idx < ehdr->e_shnum; idx++) {
+        if (!loaded[idx] || idx == text_idx) continue;
+        elf64_shdr_t *shdr = (elf64_shdr_t *)(elfbuf + ehdr->e_shoff + idx * sizeof(elf64_shdr_t));
+        sec_addr[idx] = (u64)cache_alloc(m->cache, 0, elfbuf + shdr->sh_offset,
+                                         shdr->sh_size, shdr->sh_addralign);
     }
+    sec_addr[text_idx] = (u64)cache_alloc(m->cache, m->state.pc, elfbuf + text_shdr->sh_offset,
+                                          text_shdr->sh_size, text_shdr->sh_addralign);
+    u64 text_addr = sec_addr[text_idx];
 
-    // apply relocations to .text section.
-    {
-        u64 shoff = ehdr->e_shoff + rela_idx * sizeof(elf64_shdr_t);
-        elf64_shdr_t *shdr = (elf64_shdr_t *)(elfbuf + shoff);
-        i64 rels = shdr->sh_size / sizeof(elf64_rela_t);
+    u64 symtab_shoff = ehdr->e_shoff + symtab_idx * sizeof(elf64_shdr_t);
+    elf64_shdr_t *symtab_shdr = (elf64_shdr_t *)(elfbuf + symtab_shoff);
 
-        u64 symtab_shoff = ehdr->e_shoff + symtab_idx * sizeof(elf64_shdr_t);
-        elf64_shdr_t *symtab_shdr = (elf64_shdr_t *)(elfbuf + symtab_shoff);
+    // apply every .rela section whose target was loaded.
+    for (i64 sec = 0; sec < ehdr->e_shnum; sec++) {
+        elf64_shdr_t *shdr = (elf64_shdr_t *)(elfbuf + ehdr->e_shoff + sec * sizeof(elf64_shdr_t));
+        if (shdr->sh_type != SHT_RELA || shdr->sh_info >= ehdr->e_shnum || !loaded[shdr->sh_info])
+            continue;
+
+        u64 base = sec_addr[shdr->sh_info];
+        i64 rels = shdr->sh_size / sizeof(elf64_rela_t);
 
         for (i64 idx = 0; idx < rels; idx++) {
 #ifndef __x86_64__
             fatal("only support x86_64 for now");
 #endif
             elf64_rela_t *rel = (elf64_rela_t *)(elfbuf + shdr->sh_offset + idx * sizeof(elf64_rela_t));
-            assert(rel->r_type == R_X86_64_PC32);
-
             elf64_sym_t *sym = (elf64_sym_t *)(elfbuf + symtab_shdr->sh_offset + rel->r_sym * sizeof(elf64_sym_t));
-            u32 *loc = (u32 *)(text_addr + rel->r_offset);
-            u64 S = rodata_addr + sym->st_value; /* actual virtual address of symbol */
-            u64 P = text_addr + rel->r_offset; /* relocation address */
+            if (sym->st_shndx >= ehdr->e_shnum || sec_addr[sym->st_shndx] == 0)
+                fatal("jit block refers to an unloaded symbol");
+
+            u64 S = sec_addr[sym->st_shndx] + sym->st_value; /* actual virtual address of symbol */
+            u64 P = base + rel->r_offset; /* relocation address */
             i64 A = rel->r_addend;
-            *loc = (u32)(S + A - P);
-            u64 rip_addr = P - A;
-            assert(rip_addr + *(i32 *)loc == S);
+
+            switch (rel->r_type) {
+            case R_X86_64_PC32:
+            case R_X86_64_PLT32: {
+                i64 val = (i64)(S + A - P);
+                assert(val == (i32)val);
+                *(u32 *)P = (u32)val;
+                break;
+            }
+            case R_X86_64_64:
+                *(u64 *)P = S + A;
+                break;
+            case R_X86_64_32:
+                assert(S + A == (u32)(S + A));
+                *(u32 *)P = (u32)(S + A);
+                break;
+            case R_X86_64_32S:
+                assert((i64)(S + A) == (i32)(S + A));
+                *(u32 *)P = (u32)(S + A);
+                break;
+            default:
+                fatal("unsupported relocation in jit block");
+            }
         }
     }
 
+    cache_add(m->cache, m->state.pc, (u8 *)text_addr, text_shdr->sh_size);
     return (u8 *)text_addr;
 }
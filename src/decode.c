@@ -14,13 +14,14 @@
 #define FUNCT3(data) (((data) >> 12) & 0x7 )
 #define FUNCT7(data) (((data) >> 25) & 0x7f)
 #define IMM116(data) (((data) >> 26) & 0x3f)
-
-static inline insn_t insn_utype_read(u32 data) {
-    return (insn_t) {
-        .imm = (i32)data & 0xfffff000,
-        .rd = RD(data),
-    };
-}
+#define FUNCT6(data) (((data) >> 26) & 0x3f)
+#define VM(data)     (((data) >> 25) & 0x1 )
+#define MOP(data)    (((data) >> 26) & 0x3 )
+#define MEW(data)    (((data) >> 28) & 0x1 )
+#define NF(data)     (((data) >> 29) & 0x7 )
+#define FUNCT5(data) (((data) >> 27) & 0x1f)
+#define AQ(data)     (((data) >> 26) & 0x1 )
+#define RL(data)     (((data) >> 25) & 0x1 )
 
 static inline insn_t insn_itype_read(u32 data) {
     return (insn_t) {
@@ -30,1302 +31,1123 @@ static inline insn_t insn_itype_read(u32 data) {
     };
 }
 
-static inline insn_t insn_jtype_read(u32 data) {
-    u32 imm20   = (data >> 31) & 0x1;
-    u32 imm101  = (data >> 21) & 0x3ff;
-    u32 imm11   = (data >> 20) & 0x1;
-    u32 imm1912 = (data >> 12) & 0xff;
-
-    i32 imm = (imm20 << 20) | (imm1912 << 12) | (imm11 << 11) | (imm101 << 1);
-    imm = (imm << 11) >> 11;
-
-    return (insn_t) {
-        .imm = imm,
-        .rd = RD(data),
-    };
-}
-
-static inline insn_t insn_btype_read(u32 data) {
-    u32 imm12  = (data >> 31) & 0x1;
-    u32 imm105 = (data >> 25) & 0x3f;
-    u32 imm41  = (data >>  8) & 0xf;
-    u32 imm11  = (data >>  7) & 0x1;
-
-    i32 imm = (imm12 << 12) | (imm11 << 11) |(imm105 << 5) | (imm41 << 1);
-    imm = (imm << 19) >> 19;
-
-    return (insn_t) {
-        .imm = imm,
-        .rs1 = RS1(data),
-        .rs2 = RS2(data),
-    };
-}
-
-static inline insn_t insn_rtype_read(u32 data) {
+static inline insn_t insn_vtype_read(u32 data) {
     return (insn_t) {
+        .imm = (i32)(data << 12) >> 27,
         .rs1 = RS1(data),
         .rs2 = RS2(data),
         .rd = RD(data),
+        .vm = VM(data),
     };
 }
 
-static inline insn_t insn_stype_read(u32 data) {
-    u32 imm115 = (data >> 25) & 0x7f;
-    u32 imm40  = (data >>  7) & 0x1f;
-
-    i32 imm = (imm115 << 5) | imm40;
-    imm = (imm << 20) >> 20;
-    return (insn_t) {
-        .imm = imm,
-        .rs1 = RS1(data),
-        .rs2 = RS2(data),
-    };
-}
-
-static inline insn_t insn_csrtype_read(u32 data) {
-    return (insn_t) {
-        .csr = data >> 20,
-        .rs1 = RS1(data),
-        .rd =  RD(data),
-    };
-}
-
-static inline insn_t insn_fprtype_read(u32 data) {
+static inline insn_t insn_vmemtype_read(u32 data) {
     return (insn_t) {
+        .imm = NF(data) + 1,
         .rs1 = RS1(data),
         .rs2 = RS2(data),
-        .rs3 = RS3(data),
-        .rd =  RD(data),
+        .rd = RD(data),
+        .vm = VM(data),
     };
 }
 
 /**
- * compressed types
+ * vector loads and stores share the LOAD-FP/STORE-FP major opcodes,
+ * the element width selects between the scalar and vector encodings.
 */
-#define COPCODE(data)     (((data) >> 13) & 0x7 )
-#define CFUNCT1(data)     (((data) >> 12) & 0x1 )
-#define CFUNCT2LOW(data)  (((data) >>  5) & 0x3 )
-#define CFUNCT2HIGH(data) (((data) >> 10) & 0x3 )
-#define RP1(data)         (((data) >>  7) & 0x7 )
-#define RP2(data)         (((data) >>  2) & 0x7 )
-#define RC1(data)         (((data) >>  7) & 0x1f)
-#define RC2(data)         (((data) >>  2) & 0x1f)
-
-static inline insn_t insn_catype_read(u16 data) {
-    return (insn_t) {
-        .rd = RP1(data) + 8,
-        .rs2 = RP2(data) + 8,
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_crtype_read(u16 data) {
-    return (insn_t) {
-        .rs1 = RC1(data),
-        .rs2 = RC2(data),
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_citype_read(u16 data) {
-    u32 imm40 = (data >>  2) & 0x1f;
-    u32 imm5  = (data >> 12) & 0x1;
-    i32 imm = (imm5 << 5) | imm40;
-    imm = (imm << 26) >> 26;
-
-    return (insn_t) {
-        .imm = imm,
-        .rd = RC1(data),
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_citype_read2(u16 data) {
-    u32 imm86 = (data >>  2) & 0x7;
-    u32 imm43 = (data >>  5) & 0x3;
-    u32 imm5  = (data >> 12) & 0x1;
-
-    i32 imm = (imm86 << 6) | (imm43 << 3) | (imm5 << 5);
-
-    return (insn_t) {
-        .imm = imm,
-        .rd = RC1(data),
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_citype_read3(u16 data) {
-    u32 imm5  = (data >>  2) & 0x1;
-    u32 imm87 = (data >>  3) & 0x3;
-    u32 imm6  = (data >>  5) & 0x1;
-    u32 imm4  = (data >>  6) & 0x1;
-    u32 imm9  = (data >> 12) & 0x1;
-
-    i32 imm = (imm5 << 5) | (imm87 << 7) | (imm6 << 6) | (imm4 << 4) | (imm9 << 9);
-    imm = (imm << 22) >> 22;
-
-    return (insn_t) {
-        .imm = imm,
-        .rd = RC1(data),
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_citype_read4(u16 data) {
-    u32 imm5  = (data >> 12) & 0x1;
-    u32 imm42 = (data >>  4) & 0x7;
-    u32 imm76 = (data >>  2) & 0x3;
-
-    i32 imm = (imm5 << 5) | (imm42 << 2) | (imm76 << 6);
-
-    return (insn_t) {
-        .imm = imm,
-        .rd = RC1(data),
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_citype_read5(u16 data) {
-    u32 imm1612 = (data >>  2) & 0x1f;
-    u32 imm17   = (data >> 12) & 0x1;
-
-    i32 imm = (imm1612 << 12) | (imm17 << 17);
-    imm = (imm << 14) >> 14;
-    return (insn_t) {
-        .imm = imm,
-        .rd = RC1(data),
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_cbtype_read(u16 data) {
-    u32 imm5  = (data >>  2) & 0x1;
-    u32 imm21 = (data >>  3) & 0x3;
-    u32 imm76 = (data >>  5) & 0x3;
-    u32 imm43 = (data >> 10) & 0x3;
-    u32 imm8  = (data >> 12) & 0x1;
-
-    i32 imm = (imm8 << 8) | (imm76 << 6) | (imm5 << 5) | (imm43 << 3) | (imm21 << 1);
-    imm = (imm << 23) >> 23;
-
-    return (insn_t) {
-        .imm = imm,
-        .rs1 = RP1(data) + 8,
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_cbtype_read2(u16 data) {
-    u32 imm40 = (data >>  2) & 0x1f;
-    u32 imm5  = (data >> 12) & 0x1;
-    i32 imm = (imm5 << 5) | imm40;
-    imm = (imm << 26) >> 26;
-
-    return (insn_t) {
-        .imm = imm,
-        .rd = RP1(data) + 8,
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_cstype_read(u16 data) {
-    u32 imm76 = (data >>  5) & 0x3;
-    u32 imm53 = (data >> 10) & 0x7;
-
-    i32 imm = ((imm76 << 6) | (imm53 << 3));
-
-    return (insn_t) {
-        .imm = imm,
-        .rs1 = RP1(data) + 8,
-        .rs2 = RP2(data) + 8,
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_cstype_read2(u16 data) {
-    u32 imm6  = (data >>  5) & 0x1;
-    u32 imm2  = (data >>  6) & 0x1;
-    u32 imm53 = (data >> 10) & 0x7;
-
-    i32 imm = ((imm6 << 6) | (imm2 << 2) | (imm53 << 3));
-
-    return (insn_t) {
-        .imm = imm,
-        .rs1 = RP1(data) + 8,
-        .rs2 = RP2(data) + 8,
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_cjtype_read(u16 data) {
-    u32 imm5  = (data >>  2) & 0x1;
-    u32 imm31 = (data >>  3) & 0x7;
-    u32 imm7  = (data >>  6) & 0x1;
-    u32 imm6  = (data >>  7) & 0x1;
-    u32 imm10 = (data >>  8) & 0x1;
-    u32 imm98 = (data >>  9) & 0x3;
-    u32 imm4  = (data >> 11) & 0x1;
-    u32 imm11 = (data >> 12) & 0x1;
-
-    i32 imm = ((imm5 << 5) | (imm31 << 1) | (imm7 << 7) | (imm6 << 6) |
-               (imm10 << 10) | (imm98 << 8) | (imm4 << 4) | (imm11 << 11));
-    imm = (imm << 20) >> 20;
-    return (insn_t) {
-        .imm = imm,
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_cltype_read(u16 data) {
-    u32 imm6  = (data >>  5) & 0x1;
-    u32 imm2  = (data >>  6) & 0x1;
-    u32 imm53 = (data >> 10) & 0x7;
-
-    i32 imm = (imm6 << 6) | (imm2 << 2) | (imm53 << 3);
-
-    return (insn_t) {
-        .imm = imm,
-        .rs1 = RP1(data) + 8,
-        .rd  = RP2(data) + 8,
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_cltype_read2(u16 data) {
-    u32 imm76 = (data >>  5) & 0x3;
-    u32 imm53 = (data >> 10) & 0x7;
-
-    i32 imm = (imm76 << 6) | (imm53 << 3);
-
-    return (insn_t) {
-        .imm = imm,
-        .rs1 = RP1(data) + 8,
-        .rd  = RP2(data) + 8,
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_csstype_read(u16 data) {
-    u32 imm86 = (data >>  7) & 0x7;
-    u32 imm53 = (data >> 10) & 0x7;
+static void insn_vmem_decode(insn_t *insn, u32 data, bool store) {
+    u32 funct3 = FUNCT3(data);
+    u32 eew = funct3 == 0x0 ? 0 : funct3 - 4;
+    u32 mop = MOP(data);
+    u32 lumop = RS2(data);
 
-    i32 imm = (imm86 << 6) | (imm53 << 3);
+    *insn = insn_vmemtype_read(data);
+    if (MEW(data) != 0) fatal("unimplemented");
 
-    return (insn_t) {
-        .imm = imm,
-        .rs2 = RC2(data),
-        .rvc = true,
-    };
-}
-
-static inline insn_t insn_csstype_read2(u16 data) {
-    u32 imm76 = (data >> 7) & 0x3;
-    u32 imm52 = (data >> 9) & 0xf;
-
-    i32 imm = (imm76 << 6) | (imm52 << 2);
-
-    return (insn_t) {
-        .imm = imm,
-        .rs2 = RC2(data),
-        .rvc = true,
-    };
+    switch (mop) {
+    case 0x0: {
+        switch (lumop) {
+        case 0x0:  /* VLE<EEW>.V, VSE<EEW>.V */
+        case 0x10: /* VLE<EEW>FF.V */
+            if (NF(data) != 0) fatal("unimplemented");
+            if (lumop == 0x10 && store) unreachable();
+            insn->type = (store ? insn_vse8_v : insn_vle8_v) + eew;
+            return;
+        case 0x8: /* VL<NF>RE<EEW>.V, VS<NF>R.V */
+            if (insn->imm != 1 && insn->imm != 2 && insn->imm != 4 && insn->imm != 8)
+                unreachable();
+            insn->type = store ? insn_vsr_v : insn_vlr_v;
+            return;
+        case 0xb: /* VLM.V, VSM.V */
+            assert(eew == 0);
+            insn->type = store ? insn_vsm_v : insn_vlm_v;
+            return;
+        default: fatal("unimplemented");
+        }
+    }
+    unreachable();
+    case 0x2: /* VLSE<EEW>.V, VSSE<EEW>.V */
+        if (NF(data) != 0) fatal("unimplemented");
+        insn->type = (store ? insn_vsse8_v : insn_vlse8_v) + eew;
+        return;
+    default: fatal("unimplemented");
+    }
 }
 
-static inline insn_t insn_ciwtype_read(u16 data) {
-    u32 imm3  = (data >>  5) & 0x1;
-    u32 imm2  = (data >>  6) & 0x1;
-    u32 imm96 = (data >>  7) & 0xf;
-    u32 imm54 = (data >> 11) & 0x3;
-
-    i32 imm = (imm3 << 3) | (imm2 << 2) | (imm96 << 6) | (imm54 << 4);
-
-    return (insn_t) {
-        .imm = imm,
-        .rd = RP2(data) + 8,
-        .rvc = true,
-    };
-}
+static void insn_vector_decode(insn_t *insn, u32 data) {
+    u32 funct3 = FUNCT3(data);
+    u32 funct6 = FUNCT6(data);
+
+    if (funct3 == 0x7) {
+        *insn = insn_itype_read(data);
+        if ((data >> 31) == 0) { /* VSETVLI */
+            insn->imm = (data >> 20) & 0x7ff;
+            insn->type = insn_vsetvli;
+        } else if ((data >> 30) == 0x3) { /* VSETIVLI */
+            insn->imm = (data >> 20) & 0x3ff;
+            insn->type = insn_vsetivli;
+        } else { /* VSETVL */
+            assert(FUNCT7(data) == 0x40);
+            insn->rs2 = RS2(data);
+            insn->type = insn_vsetvl;
+        }
+        return;
+    }
 
-void insn_decode(insn_t *insn, u32 data) {
-    u32 quadrant = QUADRANT(data);
-    switch (quadrant) {
-    case 0x0: {
-        u32 copcode = COPCODE(data);
+    *insn = insn_vtype_read(data);
 
-        switch (copcode) {
-        case 0x0: /* C.ADDI4SPN */
-            *insn = insn_ciwtype_read(data);
-            insn->rs1 = sp;
-            insn->type = insn_addi;
-            assert(insn->imm != 0);
+    switch (funct3) {
+    case 0x0: { /* OPIVV */
+        switch (funct6) {
+        case 0x00: /* VADD.VV */
+            insn->type = insn_vadd_vv;
+            return;
+        case 0x02: /* VSUB.VV */
+            insn->type = insn_vsub_vv;
+            return;
+        case 0x04: /* VMINU.VV */
+            insn->type = insn_vminu_vv;
+            return;
+        case 0x05: /* VMIN.VV */
+            insn->type = insn_vmin_vv;
             return;
-        case 0x1: /* C.FLD */
-            *insn = insn_cltype_read2(data);
-            insn->type = insn_fld;
+        case 0x06: /* VMAXU.VV */
+            insn->type = insn_vmaxu_vv;
             return;
-        case 0x2: /* C.LW */
-            *insn = insn_cltype_read(data);
-            insn->type = insn_lw;
+        case 0x07: /* VMAX.VV */
+            insn->type = insn_vmax_vv;
             return;
-        case 0x3: /* C.LD */
-            *insn = insn_cltype_read2(data);
-            insn->type = insn_ld;
+        case 0x09: /* VAND.VV */
+            insn->type = insn_vand_vv;
             return;
-        case 0x5: /* C.FSD */
-            *insn = insn_cstype_read(data);
-            insn->type = insn_fsd;
+        case 0x0a: /* VOR.VV */
+            insn->type = insn_vor_vv;
             return;
-        case 0x6: /* C.SW */
-            *insn = insn_cstype_read2(data);
-            insn->type = insn_sw;
+        case 0x0b: /* VXOR.VV */
+            insn->type = insn_vxor_vv;
             return;
-        case 0x7: /* C.SD */
-            *insn = insn_cstype_read(data);
-            insn->type = insn_sd;
+        case 0x17: /* VMERGE.VVM, VMV.V.V */
+            insn->type = insn_vmerge_vv;
             return;
-        default: printf("data: %x\n", data); fatal("unimplemented");
+        case 0x18: /* VMSEQ.VV */
+            insn->type = insn_vmseq_vv;
+            return;
+        case 0x19: /* VMSNE.VV */
+            insn->type = insn_vmsne_vv;
+            return;
+        case 0x1a: /* VMSLTU.VV */
+            insn->type = insn_vmsltu_vv;
+            return;
+        case 0x1b: /* VMSLT.VV */
+            insn->type = insn_vmslt_vv;
+            return;
+        case 0x1c: /* VMSLEU.VV */
+            insn->type = insn_vmsleu_vv;
+            return;
+        case 0x1d: /* VMSLE.VV */
+            insn->type = insn_vmsle_vv;
+            return;
+        case 0x25: /* VSLL.VV */
+            insn->type = insn_vsll_vv;
+            return;
+        case 0x28: /* VSRL.VV */
+            insn->type = insn_vsrl_vv;
+            return;
+        case 0x29: /* VSRA.VV */
+            insn->type = insn_vsra_vv;
+            return;
+        default: fatal("unimplemented");
         }
     }
     unreachable();
-    case 0x1: {
-        u32 copcode = COPCODE(data);
-
-        switch (copcode) {
-        case 0x0: /* C.ADDI */
-            *insn = insn_citype_read(data);
-            insn->rs1 = insn->rd;
-            insn->type = insn_addi;
-            return;
-        case 0x1: /* C.ADDIW */
-            *insn = insn_citype_read(data);
-            assert(insn->rd != 0);
-            insn->rs1 = insn->rd;
-            insn->type = insn_addiw;
-            return;
-        case 0x2: /* C.LI */
-            *insn = insn_citype_read(data);
-            insn->rs1 = zero;
-            insn->type = insn_addi;
-            return;
-        case 0x3: {
-            i32 rd = RC1(data);
-            if (rd == 2) { /* C.ADDI16SP */
-                *insn = insn_citype_read3(data);
-                assert(insn->imm != 0);
-                insn->rs1 = insn->rd;
-                insn->type = insn_addi;
-                return;
-            } else { /* C.LUI */
-                *insn = insn_citype_read5(data);
-                assert(insn->imm != 0);
-                insn->type = insn_lui;
-                return;
-            }
-        }
-        unreachable();
-        case 0x4: {
-            u32 cfunct2high = CFUNCT2HIGH(data);
-
-            switch (cfunct2high) {
-            case 0x0:   /* C.SRLI */
-            case 0x1:   /* C.SRAI */
-            case 0x2: { /* C.ANDI */
-                *insn = insn_cbtype_read2(data);
-                insn->rs1 = insn->rd;
-
-                if (cfunct2high == 0x0) {
-                    insn->type = insn_srli;
-                } else if (cfunct2high == 0x1) {
-                    insn->type = insn_srai;
-                } else {
-                    insn->type = insn_andi;
-                }
-                return;
-            }
-            unreachable();
-            case 0x3: {
-                u32 cfunct1 = CFUNCT1(data);
-
-                switch (cfunct1) {
-                case 0x0: {
-                    u32 cfunct2low = CFUNCT2LOW(data);
-
-                    *insn = insn_catype_read(data);
-                    insn->rs1 = insn->rd;
-
-                    switch (cfunct2low) {
-                    case 0x0: /* C.SUB */
-                        insn->type = insn_sub;
-                        break;
-                    case 0x1: /* C.XOR */
-                        insn->type = insn_xor;
-                        break;
-                    case 0x2: /* C.OR */
-                        insn->type = insn_or;
-                        break;
-                    case 0x3: /* C.AND */
-                        insn->type = insn_and;
-                        break;
-                    default: unreachable();
-                    }
-                    return;
-                }
-                unreachable();
-                case 0x1: {
-                    u32 cfunct2low = CFUNCT2LOW(data);
-
-                    *insn = insn_catype_read(data);
-                    insn->rs1 = insn->rd;
-
-                    switch (cfunct2low) {
-                    case 0x0: /* C.SUBW */
-                        insn->type = insn_subw;
-                        break;
-                    case 0x1: /* C.ADDW */
-                        insn->type = insn_addw;
-                        break;
-                    default: unreachable();
-                    }
-                    return;
-                }
-                unreachable();
-                default: unreachable();
-                }
-            }
-            unreachable();
-            default: unreachable();
-            }
-        }
-        unreachable();
-        case 0x5: /* C.J */
-            *insn = insn_cjtype_read(data);
-            insn->rd = zero;
-            insn->type = insn_jal;
-            insn->cont = true;
-            return;
-        case 0x6: /* C.BEQZ */
-        case 0x7: /* C.BNEZ */
-            *insn = insn_cbtype_read(data);
-            insn->rs2 = zero;
-            insn->type = copcode == 0x6 ? insn_beq : insn_bne;
-            return;
-        default: fatal("unrecognized copcode");
+    case 0x3: { /* OPIVI */
+        switch (funct6) {
+        case 0x00: /* VADD.VI */
+            insn->type = insn_vadd_vi;
+            return;
+        case 0x03: /* VRSUB.VI */
+            insn->type = insn_vrsub_vi;
+            return;
+        case 0x09: /* VAND.VI */
+            insn->type = insn_vand_vi;
+            return;
+        case 0x0a: /* VOR.VI */
+            insn->type = insn_vor_vi;
+            return;
+        case 0x0b: /* VXOR.VI */
+            insn->type = insn_vxor_vi;
+            return;
+        case 0x17: /* VMERGE.VIM, VMV.V.I */
+            insn->type = insn_vmerge_vi;
+            return;
+        case 0x18: /* VMSEQ.VI */
+            insn->type = insn_vmseq_vi;
+            return;
+        case 0x19: /* VMSNE.VI */
+            insn->type = insn_vmsne_vi;
+            return;
+        case 0x1c: /* VMSLEU.VI */
+            insn->type = insn_vmsleu_vi;
+            return;
+        case 0x1d: /* VMSLE.VI */
+            insn->type = insn_vmsle_vi;
+            return;
+        case 0x1e: /* VMSGTU.VI */
+            insn->type = insn_vmsgtu_vi;
+            return;
+        case 0x1f: /* VMSGT.VI */
+            insn->type = insn_vmsgt_vi;
+            return;
+        case 0x25: /* VSLL.VI */
+        case 0x28: /* VSRL.VI */
+        case 0x29: /* VSRA.VI */
+            insn->imm = RS1(data);
+            insn->type = funct6 == 0x25 ? insn_vsll_vi :
+                         funct6 == 0x28 ? insn_vsrl_vi : insn_vsra_vi;
+            return;
+        default: fatal("unimplemented");
         }
     }
     unreachable();
-    case 0x2: {
-        u32 copcode = COPCODE(data);
-        switch (copcode) {
-        case 0x0: /* C.SLLI */
-            *insn = insn_citype_read(data);
-            insn->rs1 = insn->rd;
-            insn->type = insn_slli;
-            return;
-        case 0x1: /* C.FLDSP */
-            *insn = insn_citype_read2(data);
-            insn->rs1 = sp;
-            insn->type = insn_fld;
-            return;
-        case 0x2: /* C.LWSP */
-            *insn = insn_citype_read4(data);
-            assert(insn->rd != 0);
-            insn->rs1 = sp;
-            insn->type = insn_lw;
-            return;
-        case 0x3: /* C.LDSP */
-            *insn = insn_citype_read2(data);
-            assert(insn->rd != 0);
-            insn->rs1 = sp;
-            insn->type = insn_ld;
-            return;
-        case 0x4: {
-            u32 cfunct1 = CFUNCT1(data);
-
-            switch (cfunct1) {
-            case 0x0: {
-                *insn = insn_crtype_read(data);
-
-                if (insn->rs2 == 0) { /* C.JR */
-                    assert(insn->rs1 != 0);
-                    insn->rd = zero;
-                    insn->type = insn_jalr;
-                    insn->cont = true;
-                } else { /* C.MV */
-                    insn->rd = insn->rs1;
-                    insn->rs1 = zero;
-                    insn->type = insn_add;
-                }
-                return;
-            }
-            unreachable();
-            case 0x1: {
-                *insn = insn_crtype_read(data);
-                if (insn->rs1 == 0 && insn->rs2 == 0) { /* C.EBREAK */
-                    fatal("unimplmented");
-                } else if (insn->rs2 == 0) { /* C.JALR */
-                    insn->rd = ra;
-                    insn->type = insn_jalr;
-                    insn->cont = true;
-                } else { /* C.ADD */
-                    insn->rd = insn->rs1;
-                    insn->type = insn_add;
-                }
-                return;
-            }
-            unreachable();
-            default: unreachable();
-            }
-        }
-        unreachable();
-        case 0x5: /* C.FSDSP */
-            *insn = insn_csstype_read(data);
-            insn->rs1 = sp;
-            insn->type = insn_fsd;
-            return;
-        case 0x6: /* C.SWSP */
-            *insn = insn_csstype_read2(data);
-            insn->rs1 = sp;
-            insn->type = insn_sw;
-            return;
-        case 0x7: /* C.SDSP */
-            *insn = insn_csstype_read(data);
-            insn->rs1 = sp;
-            insn->type = insn_sd;
-            return;
-        default: fatal("unrecognized copcode");
+    case 0x4: { /* OPIVX */
+        switch (funct6) {
+        case 0x00: /* VADD.VX */
+            insn->type = insn_vadd_vx;
+            return;
+        case 0x02: /* VSUB.VX */
+            insn->type = insn_vsub_vx;
+            return;
+        case 0x03: /* VRSUB.VX */
+            insn->type = insn_vrsub_vx;
+            return;
+        case 0x04: /* VMINU.VX */
+            insn->type = insn_vminu_vx;
+            return;
+        case 0x05: /* VMIN.VX */
+            insn->type = insn_vmin_vx;
+            return;
+        case 0x06: /* VMAXU.VX */
+            insn->type = insn_vmaxu_vx;
+            return;
+        case 0x07: /* VMAX.VX */
+            insn->type = insn_vmax_vx;
+            return;
+        case 0x09: /* VAND.VX */
+            insn->type = insn_vand_vx;
+            return;
+        case 0x0a: /* VOR.VX */
+            insn->type = insn_vor_vx;
+            return;
+        case 0x0b: /* VXOR.VX */
+            insn->type = insn_vxor_vx;
+            return;
+        case 0x17: /* VMERGE.VXM, VMV.V.X */
+            insn->type = insn_vmerge_vx;
+            return;
+        case 0x18: /* VMSEQ.VX */
+            insn->type = insn_vmseq_vx;
+            return;
+        case 0x19: /* VMSNE.VX */
+            insn->type = insn_vmsne_vx;
+            return;
+        case 0x1a: /* VMSLTU.VX */
+            insn->type = insn_vmsltu_vx;
+            return;
+        case 0x1b: /* VMSLT.VX */
+            insn->type = insn_vmslt_vx;
+            return;
+        case 0x1c: /* VMSLEU.VX */
+            insn->type = insn_vmsleu_vx;
+            return;
+        case 0x1d: /* VMSLE.VX */
+            insn->type = insn_vmsle_vx;
+            return;
+        case 0x1e: /* VMSGTU.VX */
+            insn->type = insn_vmsgtu_vx;
+            return;
+        case 0x1f: /* VMSGT.VX */
+            insn->type = insn_vmsgt_vx;
+            return;
+        case 0x25: /* VSLL.VX */
+            insn->type = insn_vsll_vx;
+            return;
+        case 0x28: /* VSRL.VX */
+            insn->type = insn_vsrl_vx;
+            return;
+        case 0x29: /* VSRA.VX */
+            insn->type = insn_vsra_vx;
+            return;
+        default: fatal("unimplemented");
         }
     }
     unreachable();
-    case 0x3: {
-        u32 opcode = OPCODE(data);
-        switch (opcode) {
-        case 0x0: {
-            u32 funct3 = FUNCT3(data);
-
-            *insn = insn_itype_read(data);
-            switch (funct3) {
-            case 0x0: /* LB */
-                insn->type = insn_lb;
-                return;
-            case 0x1: /* LH */
-                insn->type = insn_lh;
-                return;
-            case 0x2: /* LW */
-                insn->type = insn_lw;
-                return;
-            case 0x3: /* LD */
-                insn->type = insn_ld;
-                return;
-            case 0x4: /* LBU */
-                insn->type = insn_lbu;
-                return;
-            case 0x5: /* LHU */
-                insn->type = insn_lhu;
-                return;
-            case 0x6: /* LWU */
-                insn->type = insn_lwu;
-                return;
-            default: unreachable();
-            }
-        }
-        unreachable();
-        case 0x1: {
-            u32 funct3 = FUNCT3(data);
-
-            *insn = insn_itype_read(data);
-            switch (funct3) {
-            case 0x2: /* FLW */
-                insn->type = insn_flw;
-                return;
-            case 0x3: /* FLD */
-                insn->type = insn_fld;
-                return;
-            default: unreachable();
-            }
-        }
-        unreachable();
-        case 0x3: {
-            u32 funct3 = FUNCT3(data);
-
-            switch (funct3) {
-            case 0x0: { /* FENCE */
-                insn_t _insn = {0};
-                *insn = _insn;
-                insn->type = insn_fence;
-                return;
-            }
-            case 0x1: { /* FENCE.I */
-                insn_t _insn = {0};
-                *insn = _insn;
-                insn->type = insn_fence_i;
-                return;
-            }
-            default: unreachable();
-            }
-        }
-        unreachable();
-        case 0x4: {
-            u32 funct3 = FUNCT3(data);
-
-            *insn = insn_itype_read(data);
-            switch (funct3) {
-            case 0x0: /* ADDI */
-                insn->type = insn_addi;
-                return;
-            case 0x1: {
-                u32 imm116 = IMM116(data);
-                if (imm116 == 0) { /* SLLI */
-                    insn->type = insn_slli;
-                } else {
-                    unreachable();
-                }
-                return;
-            }
-            unreachable();
-            case 0x2: /* SLTI */
-                insn->type = insn_slti;
-                return;
-            case 0x3: /* SLTIU */
-                insn->type = insn_sltiu;
-                return;
-            case 0x4: /* XORI */
-                insn->type = insn_xori;
-                return;
-            case 0x5: {
-                u32 imm116 = IMM116(data);
-
-                if (imm116 == 0x0) { /* SRLI */
-                    insn->type = insn_srli;
-                } else if (imm116 == 0x10) { /* SRAI */
-                    insn->type = insn_srai;
-                } else {
-                    unreachable();
-                }
-                return;
-            }
-            unreachable();
-            case 0x6: /* ORI */
-                insn->type = insn_ori;
-                return;
-            case 0x7: /* ANDI */
-                insn->type = insn_andi;
-                return;
-            default: fatal("unrecognized funct3");
-            }
-        }
-        unreachable();
-        case 0x5: /* AUIPC */
-            *insn = insn_utype_read(data);
-            insn->type = insn_auipc;
-            return;
-        case 0x6: {
-            u32 funct3 = FUNCT3(data);
-            u32 funct7 = FUNCT7(data);
-
-            *insn = insn_itype_read(data);
-
-            switch (funct3) {
-            case 0x0: /* ADDIW */
-                insn->type = insn_addiw;
-                return;
-            case 0x1: /* SLLIW */
-                assert(funct7 == 0);
-                insn->type = insn_slliw;
-                return;
-            case 0x5: {
-                switch (funct7) {
-                case 0x0: /* SRLIW */
-                    insn->type = insn_srliw;
-                    return;
-                case 0x20: /* SRAIW */
-                    insn->type = insn_sraiw;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            default: fatal("unimplemented");
-            }
-        }
-        unreachable();
-        case 0x8: {
-            u32 funct3 = FUNCT3(data);
-
-            *insn = insn_stype_read(data);
-            switch (funct3) {
-            case 0x0: /* SB */
-                insn->type = insn_sb;
-                return;
-            case 0x1: /* SH */
-                insn->type = insn_sh;
-                return;
-            case 0x2: /* SW */
-                insn->type = insn_sw;
-                return;
-            case 0x3: /* SD */
-                insn->type = insn_sd;
-                return;
-            default: unreachable();
-            }
-        }
-        unreachable();
-        case 0x9: {
-            u32 funct3 = FUNCT3(data);
-
-            *insn = insn_stype_read(data);
-            switch (funct3) {
-            case 0x2: /* FSW */
-                insn->type = insn_fsw;
-                return;
-            case 0x3: /* FSD */
-                insn->type = insn_fsd;
-                return;
-            default: unreachable();
-            }
-        }
-        unreachable();
-        case 0xc: {
-            *insn = insn_rtype_read(data);
-
-            u32 funct3 = FUNCT3(data);
-            u32 funct7 = FUNCT7(data);
-
-            switch (funct7) {
-            case 0x0: {
-                switch (funct3) {
-                case 0x0: /* ADD */
-                    insn->type = insn_add;
-                    return;
-                case 0x1: /* SLL */
-                    insn->type = insn_sll;
-                    return;
-                case 0x2: /* SLT */
-                    insn->type = insn_slt;
-                    return;
-                case 0x3: /* SLTU */
-                    insn->type = insn_sltu;
-                    return;
-                case 0x4: /* XOR */
-                    insn->type = insn_xor;
-                    return;
-                case 0x5: /* SRL */
-                    insn->type = insn_srl;
-                    return;
-                case 0x6: /* OR */
-                    insn->type = insn_or;
-                    return;
-                case 0x7: /* AND */
-                    insn->type = insn_and;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x1: {
-                switch (funct3) {
-                case 0x0: /* MUL */
-                    insn->type = insn_mul;
-                    return;
-                case 0x1: /* MULH */
-                    insn->type = insn_mulh;
-                    return;
-                case 0x2: /* MULHSU */
-                    insn->type = insn_mulhsu;
-                    return;
-                case 0x3: /* MULHU */
-                    insn->type = insn_mulhu;
-                    return;
-                case 0x4: /* DIV */
-                    insn->type = insn_div;
-                    return;
-                case 0x5: /* DIVU */
-                    insn->type = insn_divu;
-                    return;
-                case 0x6: /* REM */
-                    insn->type = insn_rem;
-                    return;
-                case 0x7: /* REMU */
-                    insn->type = insn_remu;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x20: {
-                switch (funct3) {
-                case 0x0: /* SUB */
-                    insn->type = insn_sub;
-                    return;
-                case 0x5: /* SRA */
-                    insn->type = insn_sra;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            default: unreachable();
-            }
-        }
-        unreachable();
-        case 0xd: /* LUI */
-            *insn = insn_utype_read(data);
-            insn->type = insn_lui;
-            return;
-        case 0xe: {
-            *insn = insn_rtype_read(data);
-
-            u32 funct3 = FUNCT3(data);
-            u32 funct7 = FUNCT7(data);
-
-            switch (funct7) {
-            case 0x0: {
-                switch (funct3) {
-                case 0x0: /* ADDW */
-                    insn->type = insn_addw;
-                    return;
-                case 0x1: /* SLLW */
-                    insn->type = insn_sllw;
-                    return;
-                case 0x5: /* SRLW */
-                    insn->type = insn_srlw;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x1: {
-                switch (funct3) {
-                case 0x0: /* MULW */
-                    insn->type = insn_mulw;
-                    return;
-                case 0x4: /* DIVW */
-                    insn->type = insn_divw;
-                    return;
-                case 0x5: /* DIVUW */
-                    insn->type = insn_divuw;
-                    return;
-                case 0x6: /* REMW */
-                    insn->type = insn_remw;
-                    return;
-                case 0x7: /* REMUW */
-                    insn->type = insn_remuw;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x20: {
-                switch (funct3) {
-                case 0x0: /* SUBW */
-                    insn->type = insn_subw;
-                    return;
-                case 0x5: /* SRAW */
-                    insn->type = insn_sraw;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            default: unreachable();
-            }
+    case 0x2: { /* OPMVV */
+        switch (funct6) {
+        case 0x00: /* VREDSUM.VS */
+            insn->type = insn_vredsum_vs;
+            return;
+        case 0x10: /* VMV.X.S */
+            assert(insn->rs1 == 0);
+            insn->type = insn_vmv_x_s;
+            return;
+        case 0x14: /* VID.V */
+            if (insn->rs1 != 0x11) fatal("unimplemented");
+            insn->type = insn_vid_v;
+            return;
+        case 0x25: /* VMUL.VV */
+            insn->type = insn_vmul_vv;
+            return;
+        default: fatal("unimplemented");
         }
-        unreachable();
-        case 0x10: {
-            u32 funct2 = FUNCT2(data);
-
-            *insn = insn_fprtype_read(data);
-            switch (funct2) {
-            case 0x0: /* FMADD.S */
-                insn->type = insn_fmadd_s;
-                return;
-            case 0x1: /* FMADD.D */
-                insn->type = insn_fmadd_d;
-                return;
-            default: unreachable();
-            }
+    }
+    unreachable();
+    case 0x6: { /* OPMVX */
+        switch (funct6) {
+        case 0x10: /* VMV.S.X */
+            assert(insn->rs2 == 0);
+            insn->type = insn_vmv_s_x;
+            return;
+        case 0x25: /* VMUL.VX */
+            insn->type = insn_vmul_vx;
+            return;
+        default: fatal("unimplemented");
         }
-        unreachable();
-        case 0x11: {
-            u32 funct2 = FUNCT2(data);
-
-            *insn = insn_fprtype_read(data);
-            switch (funct2) {
-            case 0x0: /* FMSUB.S */
-                insn->type = insn_fmsub_s;
-                return;
-            case 0x1: /* FMSUB.D */
-                insn->type = insn_fmsub_d;
-                return;
-            default: unreachable();
-            }
+    }
+    unreachable();
+    case 0x1: { /* OPFVV */
+        switch (funct6) {
+        case 0x00: /* VFADD.VV */
+            insn->type = insn_vfadd_vv;
+            return;
+        case 0x02: /* VFSUB.VV */
+            insn->type = insn_vfsub_vv;
+            return;
+        case 0x10: /* VFMV.F.S */
+            assert(insn->rs1 == 0);
+            insn->type = insn_vfmv_f_s;
+            return;
+        case 0x20: /* VFDIV.VV */
+            insn->type = insn_vfdiv_vv;
+            return;
+        case 0x24: /* VFMUL.VV */
+            insn->type = insn_vfmul_vv;
+            return;
+        case 0x2c: /* VFMACC.VV */
+            insn->type = insn_vfmacc_vv;
+            return;
+        default: fatal("unimplemented");
         }
-        unreachable();
-        case 0x12: {
-            u32 funct2 = FUNCT2(data);
-
-            *insn = insn_fprtype_read(data);
-            switch (funct2) {
-            case 0x0: /* FNMSUB.S */
-                insn->type = insn_fnmsub_s;
-                return;
-            case 0x1: /* FNMSUB.D */
-                insn->type = insn_fnmsub_d;
-                return;
-            default: unreachable();
-            }
+    }
+    unreachable();
+    case 0x5: { /* OPFVF */
+        switch (funct6) {
+        case 0x00: /* VFADD.VF */
+            insn->type = insn_vfadd_vf;
+            return;
+        case 0x02: /* VFSUB.VF */
+            insn->type = insn_vfsub_vf;
+            return;
+        case 0x10: /* VFMV.S.F */
+            assert(insn->rs2 == 0);
+            insn->type = insn_vfmv_s_f;
+            return;
+        case 0x17: /* VFMERGE.VFM, VFMV.V.F */
+            insn->type = insn_vfmerge_vf;
+            return;
+        case 0x20: /* VFDIV.VF */
+            insn->type = insn_vfdiv_vf;
+            return;
+        case 0x24: /* VFMUL.VF */
+            insn->type = insn_vfmul_vf;
+            return;
+        case 0x2c: /* VFMACC.VF */
+            insn->type = insn_vfmacc_vf;
+            return;
+        default: fatal("unimplemented");
         }
-        unreachable();
-        case 0x13: {
-            u32 funct2 = FUNCT2(data);
-
-            *insn = insn_fprtype_read(data);
-            switch (funct2) {
-            case 0x0: /* FNMADD.S */
-                insn->type = insn_fnmadd_s;
-                return;
-            case 0x1: /* FNMADD.D */
-                insn->type = insn_fnmadd_d;
-                return;
-            default: unreachable();
-            }
+    }
+    unreachable();
+    default: unreachable();
+    }
+}
+
+/**
+ * compressed types
+*/
+#define COPCODE(data)     (((data) >> 13) & 0x7 )
+
+/**
+ * the decoder is driven by the table below: an instruction matches when
+ * (data & mask) == match, the first match in table order wins, so
+ * reserved encodings and special cases come before the general entry.
+ * at startup the table is split into buckets keyed by the compressed
+ * quadrant and funct3, or by the major opcode and funct3, so a lookup
+ * only scans the few entries that can possibly match.
+*/
+enum insn_fmt_t {
+    fmt_none, fmt_r, fmt_i, fmt_s, fmt_b, fmt_u, fmt_j, fmt_amo, fmt_csr, fmt_fpr,
+    fmt_v, fmt_vload, fmt_vstore,
+    fmt_ca, fmt_cr, fmt_ci, fmt_ci2, fmt_ci3, fmt_ci4, fmt_ci5, fmt_cb, fmt_cb2,
+    fmt_cs, fmt_cs2, fmt_cj, fmt_cl, fmt_cl2, fmt_css, fmt_css2, fmt_ciw,
+};
+
+/* operands implied by the compressed encodings */
+enum insn_fix_t {
+    fix_none, fix_rs1_rd, fix_rs1_sp, fix_rs1_zero, fix_rs2_zero,
+    fix_rd_zero, fix_rd_ra, fix_mv, fix_add, fix_rnum,
+};
+
+typedef struct {
+    u32 mask;
+    u32 match;
+    u16 type; /* num_insns marks a reserved encoding */
+    u8 fmt;
+    u8 fix : 7;
+    u8 cont : 1;
+} insn_desc_t;
+
+#define OPC(op) (((op) << 2) | 0x3)
+#define FN3(f)  ((u32)(f) << 12)
+#define FN7(f)  ((u32)(f) << 25)
+#define FN6(f)  ((u32)(f) << 26)
+#define FN5(f)  ((u32)(f) << 27)
+#define FN2(f)  ((u32)(f) << 25)
+#define FN12(f) ((u32)(f) << 20)
+#define CQ(q, f3) (((u32)(f3) << 13) | (q))
+
+#define M_OPC       0x0000007f
+#define M_F3        0x0000707f
+#define M_F3F7      0xfe00707f
+#define M_F3F6      0xfc00707f
+#define M_F3F5      0xf800707f
+#define M_F3F12     0xfff0707f
+#define M_F2        0x0600007f
+#define M_F7        0xfe00007f
+#define M_F7RS2     0xfff0007f
+#define M_ALL       0xffffffff
+#define M_C         0x0000e003
+#define M_C_RD      0x0000ef83
+#define M_C_RS2     0x0000f07f
+#define M_C_F1      0x0000f003
+#define M_C_F2HIGH  0x0000ec03
+#define M_C_F2LOW   0x0000fc63
+#define M_C_ALL     0x0000ffff
+
+#define ILLEGAL num_insns
+
+static const insn_desc_t insn_descs[] = {
+    /* quadrant 0 */
+    { 0x0000ffe3, CQ(0, 0x0), ILLEGAL, fmt_none },           /* C.ADDI4SPN, nzuimm=0 */
+    { M_C,        CQ(0, 0x0), insn_addi, fmt_ciw, fix_rs1_sp }, /* C.ADDI4SPN */
+    { M_C,        CQ(0, 0x1), insn_fld, fmt_cl2 },             /* C.FLD */
+    { M_C,        CQ(0, 0x2), insn_lw, fmt_cl },               /* C.LW */
+    { M_C,        CQ(0, 0x3), insn_ld, fmt_cl2 },              /* C.LD */
+    { M_C,        CQ(0, 0x5), insn_fsd, fmt_cs },              /* C.FSD */
+    { M_C,        CQ(0, 0x6), insn_sw, fmt_cs2 },              /* C.SW */
+    { M_C,        CQ(0, 0x7), insn_sd, fmt_cs },               /* C.SD */
+
+    /* quadrant 1 */
+    { M_C,        CQ(1, 0x0), insn_addi, fmt_ci, fix_rs1_rd },    /* C.ADDI */
+    { M_C_RD,     CQ(1, 0x1), ILLEGAL, fmt_none },               /* C.ADDIW, rd=0 */
+    { M_C,        CQ(1, 0x1), insn_addiw, fmt_ci, fix_rs1_rd },   /* C.ADDIW */
+    { M_C,        CQ(1, 0x2), insn_addi, fmt_ci, fix_rs1_zero },  /* C.LI */
+    { 0x0000f07f, CQ(1, 0x3), ILLEGAL, fmt_none },               /* C.LUI/C.ADDI16SP, imm=0 */
+    { M_C_RD,     CQ(1, 0x3) | (sp << 7), insn_addi, fmt_ci3, fix_rs1_rd }, /* C.ADDI16SP */
+    { M_C,        CQ(1, 0x3), insn_lui, fmt_ci5 },               /* C.LUI */
+    { M_C_F2HIGH, CQ(1, 0x4) | (0x0 << 10), insn_srli, fmt_cb2, fix_rs1_rd }, /* C.SRLI */
+    { M_C_F2HIGH, CQ(1, 0x4) | (0x1 << 10), insn_srai, fmt_cb2, fix_rs1_rd }, /* C.SRAI */
+    { M_C_F2HIGH, CQ(1, 0x4) | (0x2 << 10), insn_andi, fmt_cb2, fix_rs1_rd }, /* C.ANDI */
+    { M_C_F2LOW,  CQ(1, 0x4) | 0x0c00, insn_sub, fmt_ca, fix_rs1_rd },  /* C.SUB */
+    { M_C_F2LOW,  CQ(1, 0x4) | 0x0c20, insn_xor, fmt_ca, fix_rs1_rd },  /* C.XOR */
+    { M_C_F2LOW,  CQ(1, 0x4) | 0x0c40, insn_or, fmt_ca, fix_rs1_rd },   /* C.OR */
+    { M_C_F2LOW,  CQ(1, 0x4) | 0x0c60, insn_and, fmt_ca, fix_rs1_rd },  /* C.AND */
+    { M_C_F2LOW,  CQ(1, 0x4) | 0x1c00, insn_subw, fmt_ca, fix_rs1_rd }, /* C.SUBW */
+    { M_C_F2LOW,  CQ(1, 0x4) | 0x1c20, insn_addw, fmt_ca, fix_rs1_rd }, /* C.ADDW */
+    { M_C,        CQ(1, 0x5), insn_jal, fmt_cj, fix_rd_zero, true },   /* C.J */
+    { M_C,        CQ(1, 0x6), insn_beq, fmt_cb, fix_rs2_zero },        /* C.BEQZ */
+    { M_C,        CQ(1, 0x7), insn_bne, fmt_cb, fix_rs2_zero },        /* C.BNEZ */
+
+    /* quadrant 2 */
+    { M_C,        CQ(2, 0x0), insn_slli, fmt_ci, fix_rs1_rd },    /* C.SLLI */
+    { M_C,        CQ(2, 0x1), insn_fld, fmt_ci2, fix_rs1_sp },    /* C.FLDSP */
+    { M_C_RD,     CQ(2, 0x2), ILLEGAL, fmt_none },               /* C.LWSP, rd=0 */
+    { M_C,        CQ(2, 0x2), insn_lw, fmt_ci4, fix_rs1_sp },     /* C.LWSP */
+    { M_C_RD,     CQ(2, 0x3), ILLEGAL, fmt_none },               /* C.LDSP, rd=0 */
+    { M_C,        CQ(2, 0x3), insn_ld, fmt_ci2, fix_rs1_sp },     /* C.LDSP */
+    { M_C_ALL,    CQ(2, 0x4), ILLEGAL, fmt_none },               /* C.JR, rs1=0 */
+    { M_C_RS2,    CQ(2, 0x4), insn_jalr, fmt_cr, fix_rd_zero, true }, /* C.JR */
+    { M_C_F1,     CQ(2, 0x4), insn_add, fmt_cr, fix_mv },        /* C.MV */
+    { M_C_ALL,    CQ(2, 0x4) | 0x1000, ILLEGAL, fmt_none },      /* C.EBREAK */
+    { M_C_RS2,    CQ(2, 0x4) | 0x1000, insn_jalr, fmt_cr, fix_rd_ra, true }, /* C.JALR */
+    { M_C_F1,     CQ(2, 0x4) | 0x1000, insn_add, fmt_cr, fix_add },  /* C.ADD */
+    { M_C,        CQ(2, 0x5), insn_fsd, fmt_css, fix_rs1_sp },    /* C.FSDSP */
+    { M_C,        CQ(2, 0x6), insn_sw, fmt_css2, fix_rs1_sp },    /* C.SWSP */
+    { M_C,        CQ(2, 0x7), insn_sd, fmt_css, fix_rs1_sp },     /* C.SDSP */
+
+    /* LOAD */
+    { M_F3, OPC(0x00) | FN3(0x0), insn_lb, fmt_i },
+    { M_F3, OPC(0x00) | FN3(0x1), insn_lh, fmt_i },
+    { M_F3, OPC(0x00) | FN3(0x2), insn_lw, fmt_i },
+    { M_F3, OPC(0x00) | FN3(0x3), insn_ld, fmt_i },
+    { M_F3, OPC(0x00) | FN3(0x4), insn_lbu, fmt_i },
+    { M_F3, OPC(0x00) | FN3(0x5), insn_lhu, fmt_i },
+    { M_F3, OPC(0x00) | FN3(0x6), insn_lwu, fmt_i },
+
+    /* LOAD-FP */
+    { M_F3, OPC(0x01) | FN3(0x1), insn_flh, fmt_i },
+    { M_F3, OPC(0x01) | FN3(0x2), insn_flw, fmt_i },
+    { M_F3, OPC(0x01) | FN3(0x3), insn_fld, fmt_i },
+    { M_F3, OPC(0x01) | FN3(0x0), num_insns, fmt_vload },
+    { M_F3, OPC(0x01) | FN3(0x5), num_insns, fmt_vload },
+    { M_F3, OPC(0x01) | FN3(0x6), num_insns, fmt_vload },
+    { M_F3, OPC(0x01) | FN3(0x7), num_insns, fmt_vload },
+
+    /* MISC-MEM */
+    { M_F3, OPC(0x03) | FN3(0x0), insn_fence, fmt_none },
+    { M_F3, OPC(0x03) | FN3(0x1), insn_fence_i, fmt_none },
+
+    /* OP-IMM */
+    { M_F3,    OPC(0x04) | FN3(0x0), insn_addi, fmt_i },
+    { M_F3F6,  OPC(0x04) | FN3(0x1) | FN6(0x00), insn_slli, fmt_i },
+    { M_F3F6,  OPC(0x04) | FN3(0x1) | FN6(0x0a), insn_bseti, fmt_i },
+    { M_F3F6,  OPC(0x04) | FN3(0x1) | FN6(0x12), insn_bclri, fmt_i },
+    { M_F3F6,  OPC(0x04) | FN3(0x1) | FN6(0x1a), insn_binvi, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x100), insn_sha256sum0, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x101), insn_sha256sum1, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x102), insn_sha256sig0, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x103), insn_sha256sig1, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x104), insn_sha512sum0, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x105), insn_sha512sum1, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x106), insn_sha512sig0, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x107), insn_sha512sig1, fmt_i },
+    { M_F3F12,    OPC(0x04) | FN3(0x1) | FN12(0x31b), ILLEGAL, fmt_none },   /* AES64KS1I, rnum>0xa */
+    { 0xffc0707f, OPC(0x04) | FN3(0x1) | FN12(0x31c), ILLEGAL, fmt_none },
+    { 0xff00707f, OPC(0x04) | FN3(0x1) | FN12(0x310), insn_aes64ks1i, fmt_i, fix_rnum },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x300), insn_aes64im, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x600), insn_clz, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x601), insn_ctz, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x602), insn_cpop, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x604), insn_sext_b, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x1) | FN12(0x605), insn_sext_h, fmt_i },
+    { M_F3,    OPC(0x04) | FN3(0x2), insn_slti, fmt_i },
+    { M_F3,    OPC(0x04) | FN3(0x3), insn_sltiu, fmt_i },
+    { M_F3,    OPC(0x04) | FN3(0x4), insn_xori, fmt_i },
+    { M_F3F6,  OPC(0x04) | FN3(0x5) | FN6(0x00), insn_srli, fmt_i },
+    { M_F3F6,  OPC(0x04) | FN3(0x5) | FN6(0x10), insn_srai, fmt_i },
+    { M_F3F6,  OPC(0x04) | FN3(0x5) | FN6(0x12), insn_bexti, fmt_i },
+    { M_F3F6,  OPC(0x04) | FN3(0x5) | FN6(0x18), insn_rori, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x5) | FN12(0x287), insn_orc_b, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x5) | FN12(0x6b8), insn_rev8, fmt_i },
+    { M_F3F12, OPC(0x04) | FN3(0x5) | FN12(0x687), insn_brev8, fmt_i },
+    { M_F3,    OPC(0x04) | FN3(0x6), insn_ori, fmt_i },
+    { M_F3,    OPC(0x04) | FN3(0x7), insn_andi, fmt_i },
+
+    /* AUIPC */
+    { M_OPC, OPC(0x05), insn_auipc, fmt_u },
+
+    /* OP-IMM-32 */
+    { M_F3,    OPC(0x06) | FN3(0x0), insn_addiw, fmt_i },
+    { M_F3F7,  OPC(0x06) | FN3(0x1) | FN7(0x00), insn_slliw, fmt_i },
+    { M_F3F6,  OPC(0x06) | FN3(0x1) | FN6(0x02), insn_slli_uw, fmt_i },
+    { M_F3F12, OPC(0x06) | FN3(0x1) | FN12(0x600), insn_clzw, fmt_i },
+    { M_F3F12, OPC(0x06) | FN3(0x1) | FN12(0x601), insn_ctzw, fmt_i },
+    { M_F3F12, OPC(0x06) | FN3(0x1) | FN12(0x602), insn_cpopw, fmt_i },
+    { M_F3F7,  OPC(0x06) | FN3(0x5) | FN7(0x00), insn_srliw, fmt_i },
+    { M_F3F7,  OPC(0x06) | FN3(0x5) | FN7(0x20), insn_sraiw, fmt_i },
+    { M_F3F7,  OPC(0x06) | FN3(0x5) | FN7(0x30), insn_roriw, fmt_i },
+
+    /* STORE */
+    { M_F3, OPC(0x08) | FN3(0x0), insn_sb, fmt_s },
+    { M_F3, OPC(0x08) | FN3(0x1), insn_sh, fmt_s },
+    { M_F3, OPC(0x08) | FN3(0x2), insn_sw, fmt_s },
+    { M_F3, OPC(0x08) | FN3(0x3), insn_sd, fmt_s },
+
+    /* STORE-FP */
+    { M_F3, OPC(0x09) | FN3(0x1), insn_fsh, fmt_s },
+    { M_F3, OPC(0x09) | FN3(0x2), insn_fsw, fmt_s },
+    { M_F3, OPC(0x09) | FN3(0x3), insn_fsd, fmt_s },
+    { M_F3, OPC(0x09) | FN3(0x0), num_insns, fmt_vstore },
+    { M_F3, OPC(0x09) | FN3(0x5), num_insns, fmt_vstore },
+    { M_F3, OPC(0x09) | FN3(0x6), num_insns, fmt_vstore },
+    { M_F3, OPC(0x09) | FN3(0x7), num_insns, fmt_vstore },
+
+    /* AMO */
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x02), insn_lr_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x03), insn_sc_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x01), insn_amoswap_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x00), insn_amoadd_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x04), insn_amoxor_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x0c), insn_amoand_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x08), insn_amoor_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x10), insn_amomin_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x14), insn_amomax_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x18), insn_amominu_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x2) | FN5(0x1c), insn_amomaxu_w, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x02), insn_lr_d, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x03), insn_sc_d, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x01), insn_amoswap_d, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x00), insn_amoadd_d, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x04), insn_amoxor_d, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x0c), insn_amoand_d, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x08), insn_amoor_d, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x10), insn_amomin_d, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x14), insn_amomax_d, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x18), insn_amominu_d, fmt_amo },
+    { M_F3F5, OPC(0x0b) | FN3(0x3) | FN5(0x1c), insn_amomaxu_d, fmt_amo },
+
+    /* OP */
+    { M_F3F7, OPC(0x0c) | FN3(0x0) | FN7(0x00), insn_add, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x1) | FN7(0x00), insn_sll, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x2) | FN7(0x00), insn_slt, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x3) | FN7(0x00), insn_sltu, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x4) | FN7(0x00), insn_xor, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x5) | FN7(0x00), insn_srl, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x6) | FN7(0x00), insn_or, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x7) | FN7(0x00), insn_and, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x0) | FN7(0x01), insn_mul, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x1) | FN7(0x01), insn_mulh, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x2) | FN7(0x01), insn_mulhsu, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x3) | FN7(0x01), insn_mulhu, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x4) | FN7(0x01), insn_div, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x5) | FN7(0x01), insn_divu, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x6) | FN7(0x01), insn_rem, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x7) | FN7(0x01), insn_remu, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x0) | FN7(0x20), insn_sub, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x4) | FN7(0x20), insn_xnor, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x5) | FN7(0x20), insn_sra, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x6) | FN7(0x20), insn_orn, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x7) | FN7(0x20), insn_andn, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x4) | FN7(0x04), insn_pack, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x7) | FN7(0x04), insn_packh, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x1) | FN7(0x05), insn_clmul, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x3) | FN7(0x05), insn_clmulh, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x4) | FN7(0x05), insn_min, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x5) | FN7(0x05), insn_minu, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x6) | FN7(0x05), insn_max, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x7) | FN7(0x05), insn_maxu, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x2) | FN7(0x10), insn_sh1add, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x4) | FN7(0x10), insn_sh2add, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x6) | FN7(0x10), insn_sh3add, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x1) | FN7(0x30), insn_rol, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x5) | FN7(0x30), insn_ror, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x1) | FN7(0x14), insn_bset, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x1) | FN7(0x24), insn_bclr, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x5) | FN7(0x24), insn_bext, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x1) | FN7(0x34), insn_binv, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x0) | FN7(0x19), insn_aes64es, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x0) | FN7(0x1b), insn_aes64esm, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x0) | FN7(0x1d), insn_aes64ds, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x0) | FN7(0x1f), insn_aes64dsm, fmt_r },
+    { M_F3F7, OPC(0x0c) | FN3(0x0) | FN7(0x3f), insn_aes64ks2, fmt_r },
+
+    /* LUI */
+    { M_OPC, OPC(0x0d), insn_lui, fmt_u },
+
+    /* OP-32 */
+    { M_F3F7,  OPC(0x0e) | FN3(0x0) | FN7(0x00), insn_addw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x1) | FN7(0x00), insn_sllw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x5) | FN7(0x00), insn_srlw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x0) | FN7(0x01), insn_mulw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x4) | FN7(0x01), insn_divw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x5) | FN7(0x01), insn_divuw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x6) | FN7(0x01), insn_remw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x7) | FN7(0x01), insn_remuw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x0) | FN7(0x20), insn_subw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x5) | FN7(0x20), insn_sraw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x0) | FN7(0x04), insn_add_uw, fmt_r },
+    { M_F3F12, OPC(0x0e) | FN3(0x4) | FN7(0x04), insn_zext_h, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x4) | FN7(0x04), insn_packw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x2) | FN7(0x10), insn_sh1add_uw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x4) | FN7(0x10), insn_sh2add_uw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x6) | FN7(0x10), insn_sh3add_uw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x1) | FN7(0x30), insn_rolw, fmt_r },
+    { M_F3F7,  OPC(0x0e) | FN3(0x5) | FN7(0x30), insn_rorw, fmt_r },
+
+    /* MADD, MSUB, NMSUB, NMADD */
+    { M_F2, OPC(0x10) | FN2(0x0), insn_fmadd_s, fmt_fpr },
+    { M_F2, OPC(0x10) | FN2(0x1), insn_fmadd_d, fmt_fpr },
+    { M_F2, OPC(0x10) | FN2(0x2), insn_fmadd_h, fmt_fpr },
+    { M_F2, OPC(0x11) | FN2(0x0), insn_fmsub_s, fmt_fpr },
+    { M_F2, OPC(0x11) | FN2(0x1), insn_fmsub_d, fmt_fpr },
+    { M_F2, OPC(0x11) | FN2(0x2), insn_fmsub_h, fmt_fpr },
+    { M_F2, OPC(0x12) | FN2(0x0), insn_fnmsub_s, fmt_fpr },
+    { M_F2, OPC(0x12) | FN2(0x1), insn_fnmsub_d, fmt_fpr },
+    { M_F2, OPC(0x12) | FN2(0x2), insn_fnmsub_h, fmt_fpr },
+    { M_F2, OPC(0x13) | FN2(0x0), insn_fnmadd_s, fmt_fpr },
+    { M_F2, OPC(0x13) | FN2(0x1), insn_fnmadd_d, fmt_fpr },
+    { M_F2, OPC(0x13) | FN2(0x2), insn_fnmadd_h, fmt_fpr },
+
+    /* OP-FP */
+    { M_F7,    OPC(0x14) | FN7(0x00), insn_fadd_s, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x01), insn_fadd_d, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x02), insn_fadd_h, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x04), insn_fsub_s, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x05), insn_fsub_d, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x06), insn_fsub_h, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x08), insn_fmul_s, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x09), insn_fmul_d, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x0a), insn_fmul_h, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x0c), insn_fdiv_s, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x0d), insn_fdiv_d, fmt_r },
+    { M_F7,    OPC(0x14) | FN7(0x0e), insn_fdiv_h, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x2c), insn_fsqrt_s, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x2d), insn_fsqrt_d, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x2e), insn_fsqrt_h, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x0) | FN7(0x10), insn_fsgnj_s, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x1) | FN7(0x10), insn_fsgnjn_s, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x2) | FN7(0x10), insn_fsgnjx_s, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x0) | FN7(0x11), insn_fsgnj_d, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x1) | FN7(0x11), insn_fsgnjn_d, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x2) | FN7(0x11), insn_fsgnjx_d, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x0) | FN7(0x12), insn_fsgnj_h, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x1) | FN7(0x12), insn_fsgnjn_h, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x2) | FN7(0x12), insn_fsgnjx_h, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x0) | FN7(0x14), insn_fmin_s, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x1) | FN7(0x14), insn_fmax_s, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x0) | FN7(0x15), insn_fmin_d, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x1) | FN7(0x15), insn_fmax_d, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x0) | FN7(0x16), insn_fmin_h, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x1) | FN7(0x16), insn_fmax_h, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x20) | FN12(0x1), insn_fcvt_s_d, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x20) | FN12(0x2), insn_fcvt_s_h, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x21) | FN12(0x0), insn_fcvt_d_s, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x21) | FN12(0x2), insn_fcvt_d_h, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x22) | FN12(0x0), insn_fcvt_h_s, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x22) | FN12(0x1), insn_fcvt_h_d, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x0) | FN7(0x50), insn_fle_s, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x1) | FN7(0x50), insn_flt_s, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x2) | FN7(0x50), insn_feq_s, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x0) | FN7(0x51), insn_fle_d, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x1) | FN7(0x51), insn_flt_d, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x2) | FN7(0x51), insn_feq_d, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x0) | FN7(0x52), insn_fle_h, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x1) | FN7(0x52), insn_flt_h, fmt_r },
+    { M_F3F7,  OPC(0x14) | FN3(0x2) | FN7(0x52), insn_feq_h, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x60) | FN12(0x0), insn_fcvt_w_s, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x60) | FN12(0x1), insn_fcvt_wu_s, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x60) | FN12(0x2), insn_fcvt_l_s, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x60) | FN12(0x3), insn_fcvt_lu_s, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x61) | FN12(0x0), insn_fcvt_w_d, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x61) | FN12(0x1), insn_fcvt_wu_d, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x61) | FN12(0x2), insn_fcvt_l_d, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x61) | FN12(0x3), insn_fcvt_lu_d, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x62) | FN12(0x0), insn_fcvt_w_h, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x62) | FN12(0x1), insn_fcvt_wu_h, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x62) | FN12(0x2), insn_fcvt_l_h, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x62) | FN12(0x3), insn_fcvt_lu_h, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x68) | FN12(0x0), insn_fcvt_s_w, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x68) | FN12(0x1), insn_fcvt_s_wu, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x68) | FN12(0x2), insn_fcvt_s_l, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x68) | FN12(0x3), insn_fcvt_s_lu, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x69) | FN12(0x0), insn_fcvt_d_w, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x69) | FN12(0x1), insn_fcvt_d_wu, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x69) | FN12(0x2), insn_fcvt_d_l, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x69) | FN12(0x3), insn_fcvt_d_lu, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x6a) | FN12(0x0), insn_fcvt_h_w, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x6a) | FN12(0x1), insn_fcvt_h_wu, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x6a) | FN12(0x2), insn_fcvt_h_l, fmt_r },
+    { M_F7RS2, OPC(0x14) | FN7(0x6a) | FN12(0x3), insn_fcvt_h_lu, fmt_r },
+    { M_F3F12, OPC(0x14) | FN3(0x0) | FN7(0x70), insn_fmv_x_w, fmt_r },
+    { M_F3F12, OPC(0x14) | FN3(0x1) | FN7(0x70), insn_fclass_s, fmt_r },
+    { M_F3F12, OPC(0x14) | FN3(0x0) | FN7(0x71), insn_fmv_x_d, fmt_r },
+    { M_F3F12, OPC(0x14) | FN3(0x1) | FN7(0x71), insn_fclass_d, fmt_r },
+    { M_F3F12, OPC(0x14) | FN3(0x0) | FN7(0x72), insn_fmv_x_h, fmt_r },
+    { M_F3F12, OPC(0x14) | FN3(0x1) | FN7(0x72), insn_fclass_h, fmt_r },
+    { M_F3F12, OPC(0x14) | FN3(0x0) | FN7(0x78), insn_fmv_w_x, fmt_r },
+    { M_F3F12, OPC(0x14) | FN3(0x0) | FN7(0x79), insn_fmv_d_x, fmt_r },
+    { M_F3F12, OPC(0x14) | FN3(0x0) | FN7(0x7a), insn_fmv_h_x, fmt_r },
+
+    /* OP-V */
+    { M_OPC, OPC(0x15), num_insns, fmt_v },
+
+    /* BRANCH */
+    { M_F3, OPC(0x18) | FN3(0x0), insn_beq, fmt_b },
+    { M_F3, OPC(0x18) | FN3(0x1), insn_bne, fmt_b },
+    { M_F3, OPC(0x18) | FN3(0x4), insn_blt, fmt_b },
+    { M_F3, OPC(0x18) | FN3(0x5), insn_bge, fmt_b },
+    { M_F3, OPC(0x18) | FN3(0x6), insn_bltu, fmt_b },
+    { M_F3, OPC(0x18) | FN3(0x7), insn_bgeu, fmt_b },
+
+    /* JALR, JAL */
+    { M_OPC, OPC(0x19), insn_jalr, fmt_i, fix_none, true },
+    { M_OPC, OPC(0x1b), insn_jal, fmt_j, fix_none, true },
+
+    /* SYSTEM */
+    { M_ALL, OPC(0x1c), insn_ecall, fmt_none, fix_none, true },
+    { M_F3,  OPC(0x1c) | FN3(0x1), insn_csrrw, fmt_csr },
+    { M_F3,  OPC(0x1c) | FN3(0x2), insn_csrrs, fmt_csr },
+    { M_F3,  OPC(0x1c) | FN3(0x3), insn_csrrc, fmt_csr },
+    { M_F3,  OPC(0x1c) | FN3(0x5), insn_csrrwi, fmt_csr },
+    { M_F3,  OPC(0x1c) | FN3(0x6), insn_csrrsi, fmt_csr },
+    { M_F3,  OPC(0x1c) | FN3(0x7), insn_csrrci, fmt_csr },
+};
+
+#define NUM_DESCS (sizeof(insn_descs) / sizeof(insn_descs[0]))
+
+/**
+ * where the operands of a format live. a register is
+ * ((data >> shift) & mask) + add, so registers implied by a compressed
+ * encoding have a zero mask and add set to the register. the immediate is
+ * gathered from runs of bits, and is signed when sext is set, as the
+ * shift that brings its top bit to bit 31.
+*/
+#define IMM_SEGS 8
+
+typedef struct {
+    u8 shift;
+    u8 mask;
+    u8 add;
+} insn_reg_t;
+
+typedef struct {
+    u8 from;
+    u8 to;
+    u32 mask;
+} insn_seg_t;
+
+typedef struct {
+    insn_reg_t rd, rs1, rs2, rs3;
+    insn_seg_t imm[IMM_SEGS];
+    u8 sext;
+    u16 csr;   /* mask of the csr field */
+    u8 amo;    /* 1 where aq and rl are read */
+    bool rvc;
+} insn_operands_t;
+
+#define R_RD  { 7, 0x1f, 0 }
+#define R_RS1 { 15, 0x1f, 0 }
+#define R_RS2 { 20, 0x1f, 0 }
+#define R_RS3 { 27, 0x1f, 0 }
+#define R_RC1 { 7, 0x1f, 0 }
+#define R_RC2 { 2, 0x1f, 0 }
+#define R_RP1 { 7, 0x7, 8 }
+#define R_RP2 { 2, 0x7, 8 }
+#define SEG(from, len, to) { from, to, (1u << (len)) - 1 }
+
+static const insn_operands_t fmt_operands[] = {
+    [fmt_r]    = { .rd = R_RD, .rs1 = R_RS1, .rs2 = R_RS2 },
+    [fmt_i]    = { .rd = R_RD, .rs1 = R_RS1, .imm = { SEG(20, 12, 0) }, .sext = 20 },
+    [fmt_s]    = { .rs1 = R_RS1, .rs2 = R_RS2,
+                   .imm = { SEG(7, 5, 0), SEG(25, 7, 5) }, .sext = 20 },
+    [fmt_b]    = { .rs1 = R_RS1, .rs2 = R_RS2,
+                   .imm = { SEG(8, 4, 1), SEG(25, 6, 5), SEG(7, 1, 11), SEG(31, 1, 12) },
+                   .sext = 19 },
+    [fmt_u]    = { .rd = R_RD, .imm = { SEG(12, 20, 12) } },
+    [fmt_j]    = { .rd = R_RD,
+                   .imm = { SEG(21, 10, 1), SEG(20, 1, 11), SEG(12, 8, 12), SEG(31, 1, 20) },
+                   .sext = 11 },
+    [fmt_amo]  = { .rd = R_RD, .rs1 = R_RS1, .rs2 = R_RS2, .amo = 1 },
+    [fmt_csr]  = { .rd = R_RD, .rs1 = R_RS1, .csr = 0xfff },
+    [fmt_fpr]  = { .rd = R_RD, .rs1 = R_RS1, .rs2 = R_RS2, .rs3 = R_RS3 },
+    [fmt_ca]   = { .rd = R_RP1, .rs2 = R_RP2, .rvc = true },
+    [fmt_cr]   = { .rs1 = R_RC1, .rs2 = R_RC2, .rvc = true },
+    [fmt_ci]   = { .rd = R_RC1, .imm = { SEG(2, 5, 0), SEG(12, 1, 5) }, .sext = 26, .rvc = true },
+    [fmt_ci2]  = { .rd = R_RC1, .imm = { SEG(2, 3, 6), SEG(5, 2, 3), SEG(12, 1, 5) },
+                   .rvc = true },
+    [fmt_ci3]  = { .rd = R_RC1,
+                   .imm = { SEG(2, 1, 5), SEG(3, 2, 7), SEG(5, 1, 6), SEG(6, 1, 4),
+                            SEG(12, 1, 9) },
+                   .sext = 22, .rvc = true },
+    [fmt_ci4]  = { .rd = R_RC1, .imm = { SEG(12, 1, 5), SEG(4, 3, 2), SEG(2, 2, 6) },
+                   .rvc = true },
+    [fmt_ci5]  = { .rd = R_RC1, .imm = { SEG(2, 5, 12), SEG(12, 1, 17) }, .sext = 14,
+                   .rvc = true },
+    [fmt_cb]   = { .rs1 = R_RP1,
+                   .imm = { SEG(2, 1, 5), SEG(3, 2, 1), SEG(5, 2, 6), SEG(10, 2, 3),
+                            SEG(12, 1, 8) },
+                   .sext = 23, .rvc = true },
+    [fmt_cb2]  = { .rd = R_RP1, .imm = { SEG(2, 5, 0), SEG(12, 1, 5) }, .sext = 26, .rvc = true },
+    [fmt_cs]   = { .rs1 = R_RP1, .rs2 = R_RP2, .imm = { SEG(5, 2, 6), SEG(10, 3, 3) },
+                   .rvc = true },
+    [fmt_cs2]  = { .rs1 = R_RP1, .rs2 = R_RP2,
+                   .imm = { SEG(5, 1, 6), SEG(6, 1, 2), SEG(10, 3, 3) }, .rvc = true },
+    [fmt_cj]   = { .imm = { SEG(2, 1, 5), SEG(3, 3, 1), SEG(6, 1, 7), SEG(7, 1, 6),
+                            SEG(8, 1, 10), SEG(9, 2, 8), SEG(11, 1, 4), SEG(12, 1, 11) },
+                   .sext = 20, .rvc = true },
+    [fmt_cl]   = { .rs1 = R_RP1, .rd = R_RP2,
+                   .imm = { SEG(5, 1, 6), SEG(6, 1, 2), SEG(10, 3, 3) }, .rvc = true },
+    [fmt_cl2]  = { .rs1 = R_RP1, .rd = R_RP2, .imm = { SEG(5, 2, 6), SEG(10, 3, 3) },
+                   .rvc = true },
+    [fmt_css]  = { .rs2 = R_RC2, .imm = { SEG(7, 3, 6), SEG(10, 3, 3) }, .rvc = true },
+    [fmt_css2] = { .rs2 = R_RC2, .imm = { SEG(7, 2, 6), SEG(9, 4, 2) }, .rvc = true },
+    [fmt_ciw]  = { .rd = R_RP2,
+                   .imm = { SEG(5, 1, 3), SEG(6, 1, 2), SEG(7, 4, 6), SEG(11, 2, 4) },
+                   .rvc = true },
+};
+
+/**
+ * at startup every entry's format and fix are compiled into a layout, so
+ * insn_decode reads all formats the same way, without branching on them,
+ * and with constant shifts only. across all formats, bits of the
+ * immediate move by one of a few distances, imm_shifts, and the layout
+ * holds the mask of bits taken at each. registers are read four at a time,
+ * a byte each in the order of insn_t, from the two places they can be:
+ * rd, rs1, rs2, rs3 of the 32-bit formats, or the rd, rs1, rs2 that
+ * compressed formats keep at bits 2, 7 and 2.
+*/
+#define MAX_LAYOUTS 64
+
+static const i8 imm_shifts[] = { 0, 1, 2, 3, 4, 7, 9, 11, 19, 20, -1, -2, -3, -4, -5, -10 };
+
+#define NUM_IMM_SHIFTS (sizeof(imm_shifts) / sizeof(imm_shifts[0]))
+
+typedef struct {
+    u32 imm[NUM_IMM_SHIFTS];
+    u32 sign;    /* the sign bit of the immediate, 0 if unsigned */
+    u32 regs;    /* mask of the 32-bit register places */
+    u32 cregs;   /* mask of the compressed register places */
+    u32 add;
+    u16 csr;
+    u8 amo;
+    u8 rm;       /* mask of funct3 as the rounding mode */
+    u8 rm_or;    /* RM_DYN where there is none */
+    bool rvc;
+} insn_layout_t;
+
+static inline u32 insn_regs(u32 data) {
+    return ((data >> 7) & 0x00001f1f) | ((data >> 4) & 0x001f0000) | ((data >> 3) & 0x1f000000);
+}
+
+static inline u32 insn_cregs(u32 data) {
+    return ((data >> 2) & 0x1f) | ((data << 1) & 0x1f00) | ((data << 14) & 0x1f0000);
+}
+
+/**
+ * buckets 0..23 are the compressed quadrants 0..2 by funct3, the rest are
+ * the 32 major opcodes by funct3. each bucket is split once more on the
+ * widest run of bits (up to 7) that all of its entries match on, which is
+ * funct7 for most 32-bit opcodes. the entries of a slot end with one that
+ * matches anything, so the scan needs no bound; empty slots share the
+ * first one.
+*/
+#define NUM_BUCKETS  (3 * 8 + 32 * 8)
+#define MAX_SUB_BITS 7
+#define UNIMPL       (num_insns + 1)
+
+typedef struct {
+    u8 shift;
+    u8 bits;
+    u32 slot;
+} insn_bucket_t;
+
+/* layout 0 marks the entries insn_special decodes */
+typedef struct {
+    u32 mask;
+    u32 match;
+    u16 type;
+    u8 layout;
+    u8 fmt : 7;
+    u8 cont : 1;
+} insn_slot_t;
+
+static insn_bucket_t buckets[NUM_BUCKETS];
+static u16 slot_start[NUM_BUCKETS * (1 << MAX_SUB_BITS)];
+static insn_slot_t slot_descs[NUM_DESCS * 8] = { { .type = UNIMPL } };
+static insn_layout_t layouts[MAX_LAYOUTS];
+static u32 num_layouts = 1;
+
+static inline u32 insn_bucket(u32 data) {
+    u32 quadrant = QUADRANT(data);
+    if (quadrant != 0x3) return (quadrant << 3) | COPCODE(data);
+    return 3 * 8 + ((OPCODE(data) << 3) | FUNCT3(data));
+}
+
+static u32 insn_place(const insn_reg_t *reg, u32 byte, u8 shift, u8 cshift,
+                      insn_layout_t *l) {
+    if (reg->mask != 0 && reg->shift == shift) l->regs |= reg->mask << (8 * byte);
+    else if (reg->mask != 0 && reg->shift == cshift) l->cregs |= reg->mask << (8 * byte);
+    else assert(reg->mask == 0);
+    return reg->add << (8 * byte);
+}
+
+static u8 insn_layout(const insn_desc_t *desc) {
+    if (desc->type == ILLEGAL) return 0;
+
+    insn_operands_t o = fmt_operands[desc->fmt];
+    insn_reg_t zero_reg = { 0, 0, zero };
+    switch (desc->fix) {
+    case fix_none: break;
+    case fix_rs1_rd:   o.rs1 = o.rd; break;
+    case fix_rs1_sp:   o.rs1 = (insn_reg_t){ 0, 0, sp }; break;
+    case fix_rs1_zero: o.rs1 = zero_reg; break;
+    case fix_rs2_zero: o.rs2 = zero_reg; break;
+    case fix_rd_zero:  o.rd = zero_reg; break;
+    case fix_rd_ra:    o.rd = (insn_reg_t){ 0, 0, ra }; break;
+    case fix_mv:       o.rd = o.rs1; o.rs1 = zero_reg; break;
+    case fix_add:      o.rd = o.rs1; break;
+    case fix_rnum:     /* rnum>0xa is reserved, see the table */
+        o.imm[0].mask = 0xf;
+        o.sext = 0;
+        break;
+    default: unreachable();
+    }
+
+    /* funct3 is the rounding mode of fp ops wherever it does not pick the op */
+    u32 op = desc->match & 0x7f;
+    bool fp = op == 0x53 || (op & 0x73) == 0x43;
+    bool rm = fp && !(desc->mask & (0x7 << 12));
+
+    /* widening conversions are exact, whatever rm says */
+    switch (desc->type) {
+    case insn_fcvt_d_w:
+    case insn_fcvt_d_wu:
+    case insn_fcvt_d_s:
+    case insn_fcvt_s_h:
+    case insn_fcvt_d_h:
+        rm = false;
+        break;
+    default: break;
+    }
+
+    insn_layout_t l;
+    memset(&l, 0, sizeof(l));
+    for (u32 i = 0; i < IMM_SEGS; i++) {
+        insn_seg_t *seg = &o.imm[i];
+        if (seg->mask == 0) continue;
+        u32 k = 0;
+        while (imm_shifts[k] != seg->from - seg->to) k++;
+        assert(k < NUM_IMM_SHIFTS);
+        l.imm[k] |= seg->mask << seg->to;
+    }
+    l.sign = o.sext ? 1u << (31 - o.sext) : 0;
+    l.add = insn_place(&o.rd, 0, 7, 2, &l) | insn_place(&o.rs1, 1, 15, 7, &l) |
+            insn_place(&o.rs2, 2, 20, 2, &l) | insn_place(&o.rs3, 3, 27, 27, &l);
+    l.csr = o.csr;
+    l.amo = o.amo;
+    l.rm = rm ? 0x7 : 0;
+    l.rm_or = rm ? 0 : RM_DYN;
+    l.rvc = o.rvc;
+
+    for (u32 i = 1; i < num_layouts; i++) {
+        if (memcmp(&layouts[i], &l, sizeof(l)) == 0) return i;
+    }
+    assert(num_layouts < MAX_LAYOUTS);
+    layouts[num_layouts] = l;
+    return num_layouts++;
+}
+
+__attribute__((constructor))
+static void insn_decode_init() {
+    u32 slot = 0;
+    u64 n = 1;
+    for (u32 b = 0; b < NUM_BUCKETS; b++) {
+        u32 key_mask, key, common;
+        if (b < 3 * 8) {
+            key_mask = M_C;
+            key = CQ(b >> 3, b & 0x7);
+            common = 0xffff & ~key_mask;
+        } else {
+            key_mask = M_F3;
+            key = OPC((b - 3 * 8) >> 3) | FN3(b & 0x7);
+            common = ~key_mask;
         }
-        unreachable();
-        case 0x14: {
-            u32 funct7 = FUNCT7(data);
-
-            *insn = insn_rtype_read(data);
-            switch (funct7) {
-            case 0x0:  /* FADD.S */
-                insn->type = insn_fadd_s;
-                return;
-            case 0x1:  /* FADD.D */
-                insn->type = insn_fadd_d;
-                return;
-            case 0x4:  /* FSUB.S */
-                insn->type = insn_fsub_s;
-                return;
-            case 0x5:  /* FSUB.D */
-                insn->type = insn_fsub_d;
-                return;
-            case 0x8:  /* FMUL.S */
-                insn->type = insn_fmul_s;
-                return;
-            case 0x9:  /* FMUL.D */
-                insn->type = insn_fmul_d;
-                return;
-            case 0xc:  /* FDIV.S */
-                insn->type = insn_fdiv_s;
-                return;
-            case 0xd:  /* FDIV.D */
-                insn->type = insn_fdiv_d;
-                return;
-            case 0x10: {
-                u32 funct3 = FUNCT3(data);
-
-                switch (funct3) {
-                case 0x0: /* FSGNJ.S */
-                    insn->type = insn_fsgnj_s;
-                    return;
-                case 0x1: /* FSGNJN.S */
-                    insn->type = insn_fsgnjn_s;
-                    return;
-                case 0x2: /* FSGNJX.S */
-                    insn->type = insn_fsgnjx_s;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x11: {
-                u32 funct3 = FUNCT3(data);
-
-                switch (funct3) {
-                case 0x0: /* FSGNJ.D */
-                    insn->type = insn_fsgnj_d;
-                    return;
-                case 0x1: /* FSGNJN.D */
-                    insn->type = insn_fsgnjn_d;
-                    return;
-                case 0x2: /* FSGNJX.D */
-                    insn->type = insn_fsgnjx_d;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x14: {
-                u32 funct3 = FUNCT3(data);
-
-                switch (funct3) {
-                case 0x0: /* FMIN.S */
-                    insn->type = insn_fmin_s;
-                    return;
-                case 0x1: /* FMAX.S */
-                    insn->type = insn_fmax_s;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x15: {
-                u32 funct3 = FUNCT3(data);
-
-                switch (funct3) {
-                case 0x0: /* FMIN.D */
-                    insn->type = insn_fmin_d;
-                    return;
-                case 0x1: /* FMAX.D */
-                    insn->type = insn_fmax_d;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x20: /* FCVT.S.D */
-                assert(RS2(data) == 1);
-                insn->type = insn_fcvt_s_d;
-                return;
-            case 0x21: /* FCVT.D.S */
-                assert(RS2(data) == 0);
-                insn->type = insn_fcvt_d_s;
-                return;
-            case 0x2c: /* FSQRT.S */
-                assert(insn->rs2 == 0);
-                insn->type = insn_fsqrt_s;
-                return;
-            case 0x2d: /* FSQRT.D */
-                assert(insn->rs2 == 0);
-                insn->type = insn_fsqrt_d;
-                return;
-            case 0x50: {
-                u32 funct3 = FUNCT3(data);
-
-                switch (funct3) {
-                case 0x0: /* FLE.S */
-                    insn->type = insn_fle_s;
-                    return;
-                case 0x1: /* FLT.S */
-                    insn->type = insn_flt_s;
-                    return;
-                case 0x2: /* FEQ.S */
-                    insn->type = insn_feq_s;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x51: {
-                u32 funct3 = FUNCT3(data);
-
-                switch (funct3) {
-                case 0x0: /* FLE.D */
-                    insn->type = insn_fle_d;
-                    return;
-                case 0x1: /* FLT.D */
-                    insn->type = insn_flt_d;
-                    return;
-                case 0x2: /* FEQ.D */
-                    insn->type = insn_feq_d;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x60: {
-                u32 rs2 = RS2(data);
-
-                switch (rs2) {
-                case 0x0: /* FCVT.W.S */
-                    insn->type = insn_fcvt_w_s;
-                    return;
-                case 0x1: /* FCVT.WU.S */
-                    insn->type = insn_fcvt_wu_s;
-                    return;
-                case 0x2: /* FCVT.L.S */
-                    insn->type = insn_fcvt_l_s;
-                    return;
-                case 0x3: /* FCVT.LU.S */
-                    insn->type = insn_fcvt_lu_s;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x61: {
-                u32 rs2 = RS2(data);
-
-                switch (rs2) {
-                case 0x0: /* FCVT.W.D */
-                    insn->type = insn_fcvt_w_d;
-                    return;
-                case 0x1: /* FCVT.WU.D */
-                    insn->type = insn_fcvt_wu_d;
-                    return;
-                case 0x2: /* FCVT.L.D */
-                    insn->type = insn_fcvt_l_d;
-                    return;
-                case 0x3: /* FCVT.LU.D */
-                    insn->type = insn_fcvt_lu_d;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x68: {
-                u32 rs2 = RS2(data);
-
-                switch (rs2) {
-                case 0x0: /* FCVT.S.W */
-                    insn->type = insn_fcvt_s_w;
-                    return;
-                case 0x1: /* FCVT.S.WU */
-                    insn->type = insn_fcvt_s_wu;
-                    return;
-                case 0x2: /* FCVT.S.L */
-                    insn->type = insn_fcvt_s_l;
-                    return;
-                case 0x3: /* FCVT.S.LU */
-                    insn->type = insn_fcvt_s_lu;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x69: {
-                u32 rs2 = RS2(data);
-
-                switch (rs2) {
-                case 0x0: /* FCVT.D.W */
-                    insn->type = insn_fcvt_d_w;
-                    return;
-                case 0x1: /* FCVT.D.WU */
-                    insn->type = insn_fcvt_d_wu;
-                    return;
-                case 0x2: /* FCVT.D.L */
-                    insn->type = insn_fcvt_d_l;
-                    return;
-                case 0x3: /* FCVT.D.LU */
-                    insn->type = insn_fcvt_d_lu;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x70: {
-                assert(RS2(data) == 0);
-                u32 funct3 = FUNCT3(data);
-
-                switch (funct3) {
-                case 0x0: /* FMV.X.W */
-                    insn->type = insn_fmv_x_w;
-                    return;
-                case 0x1: /* FCLASS.S */
-                    insn->type = insn_fclass_s;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x71: {
-                assert(RS2(data) == 0);
-                u32 funct3 = FUNCT3(data);
-
-                switch (funct3) {
-                case 0x0: /* FMV.X.D */
-                    insn->type = insn_fmv_x_d;
-                    return;
-                case 0x1: /* FCLASS.D */
-                    insn->type = insn_fclass_d;
-                    return;
-                default: unreachable();
-                }
-            }
-            unreachable();
-            case 0x78: /* FMV_W_X */
-                assert(RS2(data) == 0 && FUNCT3(data) == 0);
-                insn->type = insn_fmv_w_x;
-                return;
-            case 0x79: /* FMV_D_X */
-                assert(RS2(data) == 0 && FUNCT3(data) == 0);
-                insn->type = insn_fmv_d_x;
-                return;
-            default: unreachable();
-            }
+
+        const insn_desc_t *descs[NUM_DESCS];
+        u64 ndescs = 0;
+        for (u64 i = 0; i < NUM_DESCS; i++) {
+            const insn_desc_t *desc = &insn_descs[i];
+            if (((desc->match ^ key) & desc->mask & key_mask) != 0) continue;
+            descs[ndescs++] = desc;
+            common &= desc->mask;
         }
-        unreachable();
-        case 0x18: {
-            *insn = insn_btype_read(data);
-
-            u32 funct3 = FUNCT3(data);
-            switch (funct3) {
-            case 0x0: /* BEQ */
-                insn->type = insn_beq;
-                return;
-            case 0x1: /* BNE */
-                insn->type = insn_bne;
-                return;
-            case 0x4: /* BLT */
-                insn->type = insn_blt;
-                return;
-            case 0x5: /* BGE */
-                insn->type = insn_bge;
-                return;
-            case 0x6: /* BLTU */
-                insn->type = insn_bltu;
-                return;
-            case 0x7: /* BGEU */
-                insn->type = insn_bgeu;
-                return;
-            default: unreachable();
+
+        u32 shift = 0, bits = 0;
+        for (u32 lo = 0; lo < 32 && ndescs > 0; lo++) {
+            u32 len = 0;
+            while (lo + len < 32 && len < MAX_SUB_BITS && (common >> (lo + len)) & 1) len++;
+            if (len > bits) {
+                shift = lo;
+                bits = len;
             }
         }
-        unreachable();
-        case 0x19: /* JALR */
-            *insn = insn_itype_read(data);
-            insn->type = insn_jalr;
-            insn->cont = true;
-            return;
-        case 0x1b: /* JAL */
-            *insn = insn_jtype_read(data);
-            insn->type = insn_jal;
-            insn->cont = true;
-            return;
-        case 0x1c: {
-            if (data == 0x73) { /* ECALL */
-                insn->type = insn_ecall;
-                insn->cont = true;
-                return;
-            }
 
-            u32 funct3 = FUNCT3(data);
-            *insn = insn_csrtype_read(data);
-            switch(funct3) {
-            case 0x1: /* CSRRW */
-                insn->type = insn_csrrw;
-                return;
-            case 0x2: /* CSRRS */
-                insn->type = insn_csrrs;
-                return;
-            case 0x3: /* CSRRC */
-                insn->type = insn_csrrc;
-                return;
-            case 0x5: /* CSRRWI */
-                insn->type = insn_csrrwi;
-                return;
-            case 0x6: /* CSRRSI */
-                insn->type = insn_csrrsi;
-                return;
-            case 0x7: /* CSRRCI */
-                insn->type = insn_csrrci;
-                return;
-            default: unreachable();
+        buckets[b] = (insn_bucket_t){ .shift = shift, .bits = bits, .slot = slot };
+        for (u32 sub = 0; sub < (1u << bits); sub++) {
+            u64 start = n;
+            for (u64 i = 0; i < ndescs; i++) {
+                const insn_desc_t *desc = descs[i];
+                if (((desc->match >> shift) & ((1u << bits) - 1)) != sub) continue;
+                assert(n + 1 < NUM_DESCS * 8);
+                slot_descs[n++] = (insn_slot_t){
+                    .mask = desc->mask,
+                    .match = desc->match,
+                    .type = desc->type,
+                    .layout = insn_layout(desc),
+                    .fmt = desc->fmt,
+                    .cont = desc->cont,
+                };
             }
-        }
-        unreachable();
-        default: unreachable();
+            if (n > start) slot_descs[n++] = (insn_slot_t){ .type = UNIMPL };
+            slot_start[slot++] = n > start ? start : 0;
         }
     }
-    unreachable();
-    default: unreachable();
+}
+
+/* reserved and vector encodings, and those not implemented */
+__attribute__((noinline))
+static void insn_special(insn_t *insn, u32 data, const insn_slot_t *desc) {
+    switch (desc->fmt) {
+    case fmt_v:      insn_vector_decode(insn, data); break;
+    case fmt_vload:  insn_vmem_decode(insn, data, false); break;
+    case fmt_vstore: insn_vmem_decode(insn, data, true); break;
+    default:
+        if (desc->type == UNIMPL) fatal("unimplemented");
+        fatal("illegal instruction");
+    }
+    insn->rm = RM_DYN;
+}
+
+void insn_decode(insn_t *insn, u32 data) {
+    insn_bucket_t *bucket = &buckets[insn_bucket(data)];
+    u32 slot = bucket->slot + ((data >> bucket->shift) & ((1u << bucket->bits) - 1));
+    insn_slot_t *desc = &slot_descs[slot_start[slot]];
+    while ((data & desc->mask) != desc->match) desc++;
+
+    if (desc->layout == 0) {
+        insn_special(insn, data, desc);
+        return;
     }
+
+    const insn_layout_t *l = &layouts[desc->layout];
+    u32 imm = 0;
+    for (u32 i = 0; i < NUM_IMM_SHIFTS; i++) {
+        i32 k = imm_shifts[i];
+        imm |= (k >= 0 ? data >> k : data << -k) & l->imm[i];
+    }
+    u32 regs = ((insn_regs(data) & l->regs) | (insn_cregs(data) & l->cregs)) + l->add;
+
+    *insn = (insn_t){
+        .rd = regs,
+        .rs1 = regs >> 8,
+        .rs2 = regs >> 16,
+        .rs3 = regs >> 24,
+        .imm = (imm ^ l->sign) - l->sign,
+        .csr = (data >> 20) & l->csr,
+        .rm = (FUNCT3(data) & l->rm) | l->rm_or,
+        .type = desc->type,
+        .rvc = l->rvc,
+        .cont = desc->cont,
+        .aq = (data >> 26) & l->amo,
+        .rl = (data >> 25) & l->amo,
+    };
 }
@@ -18,8 +18,16 @@
 #define PF_W 0x2
 #define PF_R 0x4
 
+#define SHT_RELA 4
 
-#define R_X86_64_PC32 2
+#define SHF_EXECINSTR 0x4
+
+
+#define R_X86_64_64    1
+#define R_X86_64_PC32  2
+#define R_X86_64_PLT32 4
+#define R_X86_64_32    10
+#define R_X86_64_32S   11
 
 typedef struct {
     u8 e_ident[EI_NIDENT];
@@ -4,9 +4,16 @@
 
 static void func_empty(state_t *state, insn_t *insn) {}
 
-#define FUNC(typ)                                          \
-    u64 addr = state->gp_regs[insn->rs1] + (i64)insn->imm; \
-    state->gp_regs[insn->rd] = *(typ *)TO_HOST(addr);      \
+/* every thread drops its decoded blocks, and this one leaves its stale block now */
+static void func_fence_i(state_t *state, insn_t *insn) {
+    __atomic_add_fetch(&state->decoded->gen, 1, __ATOMIC_RELEASE);
+    state->exit_reason = direct_branch;
+    state->reenter_pc = state->pc + 4;
+}
+
+#define FUNC(typ)                                                 \
+    u64 addr = state->gp_regs[insn->rs1] + (i64)insn->imm;        \
+    state->gp_regs[insn->rd] = *(typ *)TO_HOST(state->mem, addr); \
 
 static void func_lb(state_t *state, insn_t *insn) {
     FUNC(i8);
@@ -102,10 +109,10 @@ static void func_auipc(state_t *state, insn_t *insn) {
     state->gp_regs[insn->rd] = val;
 }
 
-#define FUNC(typ)                                \
-    u64 rs1 = state->gp_regs[insn->rs1];         \
-    u64 rs2 = state->gp_regs[insn->rs2];         \
-    *(typ *)TO_HOST(rs1 + insn->imm) = (typ)rs2; \
+#define FUNC(typ)                                            \
+    u64 rs1 = state->gp_regs[insn->rs1];                     \
+    u64 rs2 = state->gp_regs[insn->rs2];                     \
+    *(typ *)TO_HOST(state->mem, rs1 + insn->imm) = (typ)rs2; \
 
 static void func_sb(state_t *state, insn_t *insn) {
     FUNC(u8);
@@ -283,7 +290,6 @@ static void func_lui(state_t *state, insn_t *insn) {
     if (expr) {                                      \
         state->reenter_pc = state->pc = target_addr; \
         state->exit_reason = direct_branch;          \
-        insn->cont = true;                           \
     }                                                \
 
 static void func_beq(state_t *state, insn_t *insn) {
@@ -330,38 +336,108 @@ static void func_ecall(state_t *state, insn_t *insn) {
     state->reenter_pc = state->pc + 4;
 }
 
-#define FUNC()                         \
-    switch (insn->csr) {               \
-    case fflags:                       \
-    case frm:                          \
-    case fcsr:                         \
-        break;                         \
-    default: fatal("unsupported csr"); \
-    }                                  \
-    state->gp_regs[insn->rd] = 0;      \
+/**
+ * fcsr lives partly in the host: exception flags accrue in the host fenv
+ * and are folded into state->fcsr only when the guest looks at them, and
+ * frm is mirrored into the host rounding mode whenever it is written, so
+ * fp instructions themselves run at full speed.
+ */
+static const int host_round[8] = {
+    FE_TONEAREST, FE_TOWARDZERO, FE_DOWNWARD, FE_UPWARD,
+    FE_TONEAREST, /* rmm has no host equivalent */
+    FE_TONEAREST, FE_TONEAREST, FE_TONEAREST,
+};
+
+void fenv_sync(state_t *state) {
+    int ex = fetestexcept(FE_ALL_EXCEPT);
+    if (ex == 0) return;
+
+    state->fcsr |= (ex & FE_INVALID   ? 0x10 : 0) |
+                   (ex & FE_DIVBYZERO ? 0x08 : 0) |
+                   (ex & FE_OVERFLOW  ? 0x04 : 0) |
+                   (ex & FE_UNDERFLOW ? 0x02 : 0) |
+                   (ex & FE_INEXACT   ? 0x01 : 0);
+    feclearexcept(FE_ALL_EXCEPT);
+}
+
+/* puts frm back into the host, for a state that comes from elsewhere */
+void fenv_load(state_t *state) {
+    feclearexcept(FE_ALL_EXCEPT);
+    fesetround(host_round[(state->fcsr >> 5) & 0x7]);
+}
+
+/* the host rounding mode for rm, or for frm again with RM_DYN */
+void fenv_round(state_t *state, u32 rm) {
+    if (rm == RM_DYN) rm = (state->fcsr >> 5) & 0x7;
+    fesetround(host_round[rm]);
+}
+
+static u64 fcsr_access(state_t *state, insn_t *insn, u64 arg, bool write) {
+    fenv_sync(state);
+
+    u32 shift = insn->csr == frm ? 5 : 0;
+    u32 mask = insn->csr == fflags ? 0x1f : insn->csr == frm ? 0x7 : 0xff;
+    u64 old = (state->fcsr >> shift) & mask;
+    if (!write) return old;
 
-static void func_csrrw(state_t *state, insn_t *insn) { FUNC(); }
-static void func_csrrs(state_t *state, insn_t *insn) { FUNC(); }
-static void func_csrrc(state_t *state, insn_t *insn) { FUNC(); }
-static void func_csrrwi(state_t *state, insn_t *insn) { FUNC(); }
-static void func_csrrsi(state_t *state, insn_t *insn) { FUNC(); }
-static void func_csrrci(state_t *state, insn_t *insn) { FUNC(); }
+    u64 val;
+    switch (insn->type) {
+    case insn_csrrw: case insn_csrrwi: val = arg;        break;
+    case insn_csrrs: case insn_csrrsi: val = old | arg;  break;
+    case insn_csrrc: case insn_csrrci: val = old & ~arg; break;
+    default: unreachable();
+    }
+    state->fcsr = (state->fcsr & ~(mask << shift)) | ((val & mask) << shift);
+
+    u32 rm = (state->fcsr >> 5) & 0x7;
+    if (rm != 0) state->fenv_used = true;
+    fesetround(host_round[rm]);
+    return old;
+}
+
+/* csrrs/csrrc with x0 or a zero immediate only read */
+#define FUNC(arg, write)                                                \
+    u64 val = 0;                                                        \
+    switch (insn->csr) {                                                \
+    case fflags:                                                        \
+    case frm:                                                           \
+    case fcsr:                                                          \
+        val = fcsr_access(state, insn, (arg), (write));                 \
+        break;                                                          \
+    case vxsat:                                                         \
+    case vxrm:                                                          \
+    case vcsr:                                                          \
+        break;                                                          \
+    case vstart: val = state->vstart; break;                            \
+    case vl:     val = state->vl;     break;                            \
+    case vtype:  val = state->vtype;  break;                            \
+    case vlenb:  val = VLENB;         break;                            \
+    default: fatal("unsupported csr");                                  \
+    }                                                                   \
+    state->gp_regs[insn->rd] = val;                                     \
+
+static void func_csrrw(state_t *state, insn_t *insn) { FUNC(state->gp_regs[insn->rs1], true); }
+static void func_csrrs(state_t *state, insn_t *insn) { FUNC(state->gp_regs[insn->rs1], insn->rs1 != zero); }
+static void func_csrrc(state_t *state, insn_t *insn) { FUNC(state->gp_regs[insn->rs1], insn->rs1 != zero); }
+static void func_csrrwi(state_t *state, insn_t *insn) { FUNC(insn->rs1, true); }
+static void func_csrrsi(state_t *state, insn_t *insn) { FUNC(insn->rs1, insn->rs1 != 0); }
+static void func_csrrci(state_t *state, insn_t *insn) { FUNC(insn->rs1, insn->rs1 != 0); }
 
 #undef FUNC
 
 static void func_flw(state_t *state, insn_t *insn) {
     u64 addr = state->gp_regs[insn->rs1] + (i64)insn->imm;
-    state->fp_regs[insn->rd].v = *(u32 *)TO_HOST(addr) | ((u64)-1 << 32);
+    state->fp_regs[insn->rd].v = *(u32 *)TO_HOST(state->mem, addr) | ((u64)-1 << 32);
 }
 static void func_fld(state_t *state, insn_t *insn) {
     u64 addr = state->gp_regs[insn->rs1] + (i64)insn->imm;
-    state->fp_regs[insn->rd].v = *(u64 *)TO_HOST(addr);
+    state->fp_regs[insn->rd].v = *(u64 *)TO_HOST(state->mem, addr);
 }
 
-#define FUNC(typ)                                \
-    u64 rs1 = state->gp_regs[insn->rs1];         \
-    u64 rs2 = state->fp_regs[insn->rs2].v;       \
-    *(typ *)TO_HOST(rs1 + insn->imm) = (typ)rs2; \
+#define FUNC(typ)                                            \
+    u64 rs1 = state->gp_regs[insn->rs1];                     \
+    u64 rs2 = state->fp_regs[insn->rs2].v;                   \
+    *(typ *)TO_HOST(state->mem, rs1 + insn->imm) = (typ)rs2; \
 
 static void func_fsw(state_t *state, insn_t *insn) {
     FUNC(u32);
@@ -655,155 +731,1939 @@ static void func_fcvt_d_s(state_t *state, insn_t *insn) {
     state->fp_regs[insn->rd].d = (f64)state->fp_regs[insn->rs1].f;
 }
 
-typedef void (func_t)(state_t *, insn_t *);
+static u64 vset(state_t *state, u64 avl, u64 vtype) {
+    u64 vlmax = vtype_vlmax(vtype);
+    if (vlmax == 0) {
+        state->vtype = VTYPE_VILL;
+        state->vl = 0;
+    } else {
+        state->vtype = vtype;
+        state->vl = MIN(avl, vlmax);
+    }
+    state->vstart = 0;
+    return state->vl;
+}
 
-static func_t *funcs[] = {
-    func_lb,
-    func_lh,
-    func_lw,
-    func_ld,
-    func_lbu,
-    func_lhu,
-    func_lwu,
-    func_empty, // fence
-    func_empty, // fence_i
-    func_addi,
-    func_slli,
-    func_slti,
-    func_sltiu,
-    func_xori,
-    func_srli,
-    func_srai,
-    func_ori,
-    func_andi,
-    func_auipc,
-    func_addiw,
-    func_slliw,
-    func_srliw,
-    func_sraiw,
-    func_sb,
-    func_sh,
-    func_sw,
-    func_sd,
-    func_add,
-    func_sll,
-    func_slt,
-    func_sltu,
-    func_xor,
-    func_srl,
-    func_or,
-    func_and,
-    func_mul,
-    func_mulh,
-    func_mulhsu,
-    func_mulhu,
-    func_div,
-    func_divu,
-    func_rem,
-    func_remu,
-    func_sub,
-    func_sra,
-    func_lui,
-    func_addw,
-    func_sllw,
-    func_srlw,
-    func_mulw,
-    func_divw,
-    func_divuw,
-    func_remw,
-    func_remuw,
-    func_subw,
-    func_sraw,
-    func_beq,
-    func_bne,
-    func_blt,
-    func_bge,
-    func_bltu,
-    func_bgeu,
-    func_jalr,
-    func_jal,
-    func_ecall,
-    func_csrrw,
-    func_csrrs,
-    func_csrrc,
-    func_csrrwi,
-    func_csrrsi,
-    func_csrrci,
-    func_flw,
-    func_fsw,
-    func_fmadd_s,
-    func_fmsub_s,
-    func_fnmsub_s,
-    func_fnmadd_s,
-    func_fadd_s,
-    func_fsub_s,
-    func_fmul_s,
-    func_fdiv_s,
-    func_fsqrt_s,
-    func_fsgnj_s,
-    func_fsgnjn_s,
-    func_fsgnjx_s,
-    func_fmin_s,
-    func_fmax_s,
-    func_fcvt_w_s,
-    func_fcvt_wu_s,
-    func_fmv_x_w,
-    func_feq_s,
-    func_flt_s,
-    func_fle_s,
-    func_fclass_s,
-    func_fcvt_s_w,
-    func_fcvt_s_wu,
-    func_fmv_w_x,
-    func_fcvt_l_s,
-    func_fcvt_lu_s,
-    func_fcvt_s_l,
-    func_fcvt_s_lu,
-    func_fld,
-    func_fsd,
-    func_fmadd_d,
-    func_fmsub_d,
-    func_fnmsub_d,
-    func_fnmadd_d,
-    func_fadd_d,
-    func_fsub_d,
-    func_fmul_d,
-    func_fdiv_d,
-    func_fsqrt_d,
-    func_fsgnj_d,
-    func_fsgnjn_d,
-    func_fsgnjx_d,
-    func_fmin_d,
-    func_fmax_d,
-    func_fcvt_s_d,
-    func_fcvt_d_s,
-    func_feq_d,
-    func_flt_d,
-    func_fle_d,
-    func_fclass_d,
-    func_fcvt_w_d,
-    func_fcvt_wu_d,
-    func_fcvt_d_w,
-    func_fcvt_d_wu,
-    func_fcvt_l_d,
-    func_fcvt_lu_d,
-    func_fmv_x_d,
-    func_fcvt_d_l,
-    func_fcvt_d_lu,
-    func_fmv_d_x,
-};
+#define FUNC(vtype)                                                    \
+    u64 avl = state->vl;                                               \
+    if (insn->rs1 != zero) avl = state->gp_regs[insn->rs1];            \
+    else if (insn->rd != zero && insn->rd != GP_SCRATCH) avl = UINT64_MAX; \
+    state->gp_regs[insn->rd] = vset(state, avl, (vtype));              \
 
-void exec_block_interp(state_t *state) {
-    static insn_t insn = {0};
-    while (true) {
-        u32 data = *(u32 *)TO_HOST(state->pc);
-        insn_decode(&insn, data);
+static void func_vsetvli(state_t *state, insn_t *insn) {
+    FUNC((u64)insn->imm);
+}
+
+static void func_vsetvl(state_t *state, insn_t *insn) {
+    FUNC(state->gp_regs[insn->rs2]);
+}
+
+#undef FUNC
+
+static void func_vsetivli(state_t *state, insn_t *insn) {
+    state->gp_regs[insn->rd] = vset(state, (u64)insn->rs1, (u64)insn->imm);
+}
+
+static inline u8 *v_elem(state_t *state, i32 reg, u64 i, u64 sew) {
+    return state->v_regs + reg * VLENB + i * (sew / 8);
+}
+
+static inline u64 v_get(state_t *state, i32 reg, u64 i, u64 sew) {
+    u8 *p = v_elem(state, reg, i, sew);
+    switch (sew) {
+    case 8:  return *(u8 *)p;
+    case 16: return *(u16 *)p;
+    case 32: return *(u32 *)p;
+    case 64: return *(u64 *)p;
+    default: unreachable();
+    }
+}
 
-        funcs[insn.type](state, &insn);
-        state->gp_regs[zero] = 0;
+static inline void v_set(state_t *state, i32 reg, u64 i, u64 sew, u64 val) {
+    u8 *p = v_elem(state, reg, i, sew);
+    switch (sew) {
+    case 8:  *(u8 *)p = val;  return;
+    case 16: *(u16 *)p = val; return;
+    case 32: *(u32 *)p = val; return;
+    case 64: *(u64 *)p = val; return;
+    default: unreachable();
+    }
+}
 
-        if (insn.cont) break;
+static inline u64 v_mem_get(state_t *state, u64 addr, u64 eew) {
+    switch (eew) {
+    case 8:  return *(u8 *)TO_HOST(state->mem, addr);
+    case 16: return *(u16 *)TO_HOST(state->mem, addr);
+    case 32: return *(u32 *)TO_HOST(state->mem, addr);
+    case 64: return *(u64 *)TO_HOST(state->mem, addr);
+    default: unreachable();
+    }
+}
 
-        state->pc += insn.rvc ? 2 : 4;
+static inline void v_mem_set(state_t *state, u64 addr, u64 eew, u64 val) {
+    switch (eew) {
+    case 8:  *(u8 *)TO_HOST(state->mem, addr) = val;  return;
+    case 16: *(u16 *)TO_HOST(state->mem, addr) = val; return;
+    case 32: *(u32 *)TO_HOST(state->mem, addr) = val; return;
+    case 64: *(u64 *)TO_HOST(state->mem, addr) = val; return;
+    default: unreachable();
     }
 }
+
+static inline bool v_mask(state_t *state, u64 i) {
+    return (state->v_regs[i / 8] >> (i % 8)) & 1;
+}
+
+static inline u64 v_trunc(u64 val, u64 sew) {
+    return sew == 64 ? val : val & (((u64)1 << sew) - 1);
+}
+
+static inline i64 v_sext(u64 val, u64 sew) {
+    return (i64)(val << (64 - sew)) >> (64 - sew);
+}
+
+#define ACTIVE (insn->vm || v_mask(state, i))
+
+#define FUNC(eew, stride)                                        \
+    u64 addr = state->gp_regs[insn->rs1];                        \
+    for (u64 i = 0; i < state->vl; i++) {                        \
+        if (!ACTIVE) continue;                                   \
+        u64 val = v_mem_get(state, addr + i * (stride), eew);    \
+        v_set(state, insn->rd, i, eew, val);                     \
+    }                                                            \
+
+static void func_vle8_v(state_t *state, insn_t *insn) {
+    FUNC(8, 1);
+}
+
+static void func_vle16_v(state_t *state, insn_t *insn) {
+    FUNC(16, 2);
+}
+
+static void func_vle32_v(state_t *state, insn_t *insn) {
+    FUNC(32, 4);
+}
+
+static void func_vle64_v(state_t *state, insn_t *insn) {
+    FUNC(64, 8);
+}
+
+static void func_vlse8_v(state_t *state, insn_t *insn) {
+    FUNC(8, state->gp_regs[insn->rs2]);
+}
+
+static void func_vlse16_v(state_t *state, insn_t *insn) {
+    FUNC(16, state->gp_regs[insn->rs2]);
+}
+
+static void func_vlse32_v(state_t *state, insn_t *insn) {
+    FUNC(32, state->gp_regs[insn->rs2]);
+}
+
+static void func_vlse64_v(state_t *state, insn_t *insn) {
+    FUNC(64, state->gp_regs[insn->rs2]);
+}
+
+#undef FUNC
+
+#define FUNC(eew, stride)                                        \
+    u64 addr = state->gp_regs[insn->rs1];                        \
+    for (u64 i = 0; i < state->vl; i++) {                        \
+        if (!ACTIVE) continue;                                   \
+        u64 val = v_get(state, insn->rd, i, eew);                \
+        v_mem_set(state, addr + i * (stride), eew, val);         \
+    }                                                            \
+
+static void func_vse8_v(state_t *state, insn_t *insn) {
+    FUNC(8, 1);
+}
+
+static void func_vse16_v(state_t *state, insn_t *insn) {
+    FUNC(16, 2);
+}
+
+static void func_vse32_v(state_t *state, insn_t *insn) {
+    FUNC(32, 4);
+}
+
+static void func_vse64_v(state_t *state, insn_t *insn) {
+    FUNC(64, 8);
+}
+
+static void func_vsse8_v(state_t *state, insn_t *insn) {
+    FUNC(8, state->gp_regs[insn->rs2]);
+}
+
+static void func_vsse16_v(state_t *state, insn_t *insn) {
+    FUNC(16, state->gp_regs[insn->rs2]);
+}
+
+static void func_vsse32_v(state_t *state, insn_t *insn) {
+    FUNC(32, state->gp_regs[insn->rs2]);
+}
+
+static void func_vsse64_v(state_t *state, insn_t *insn) {
+    FUNC(64, state->gp_regs[insn->rs2]);
+}
+
+#undef FUNC
+
+static void func_vlm_v(state_t *state, insn_t *insn) {
+    u64 addr = state->gp_regs[insn->rs1];
+    memcpy(state->v_regs + insn->rd * VLENB, (void *)TO_HOST(state->mem, addr), (state->vl + 7) / 8);
+}
+
+static void func_vsm_v(state_t *state, insn_t *insn) {
+    u64 addr = state->gp_regs[insn->rs1];
+    memcpy((void *)TO_HOST(state->mem, addr), state->v_regs + insn->rd * VLENB, (state->vl + 7) / 8);
+}
+
+static void func_vlr_v(state_t *state, insn_t *insn) {
+    u64 addr = state->gp_regs[insn->rs1];
+    memcpy(state->v_regs + insn->rd * VLENB, (void *)TO_HOST(state->mem, addr), insn->imm * VLENB);
+}
+
+static void func_vsr_v(state_t *state, insn_t *insn) {
+    u64 addr = state->gp_regs[insn->rs1];
+    memcpy((void *)TO_HOST(state->mem, addr), state->v_regs + insn->rd * VLENB, insn->imm * VLENB);
+}
+
+#define VV v_get(state, insn->rs1, i, sew)
+#define VX state->gp_regs[insn->rs1]
+#define VI (u64)(i64)insn->imm
+#define VF (sew == 32 ? state->fp_regs[insn->rs1].w : state->fp_regs[insn->rs1].v)
+
+#define FUNC(operand, expr)                                    \
+    u64 sew = VSEW(state->vtype);                              \
+    for (u64 i = 0; i < state->vl; i++) {                      \
+        if (!ACTIVE) continue;                                 \
+        u64 a = v_get(state, insn->rs2, i, sew);               \
+        u64 b = v_trunc((operand), sew);                       \
+        __attribute__((unused)) i64 sa = v_sext(a, sew);       \
+        __attribute__((unused)) i64 sb = v_sext(b, sew);       \
+        v_set(state, insn->rd, i, sew, (expr));                \
+    }                                                          \
+
+static void func_vadd_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a + b);
+}
+
+static void func_vadd_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a + b);
+}
+
+static void func_vadd_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, a + b);
+}
+
+static void func_vsub_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a - b);
+}
+
+static void func_vsub_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a - b);
+}
+
+static void func_vrsub_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, b - a);
+}
+
+static void func_vrsub_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, b - a);
+}
+
+static void func_vminu_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a < b ? a : b);
+}
+
+static void func_vminu_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a < b ? a : b);
+}
+
+static void func_vmin_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, sa < sb ? a : b);
+}
+
+static void func_vmin_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, sa < sb ? a : b);
+}
+
+static void func_vmaxu_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a > b ? a : b);
+}
+
+static void func_vmaxu_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a > b ? a : b);
+}
+
+static void func_vmax_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, sa > sb ? a : b);
+}
+
+static void func_vmax_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, sa > sb ? a : b);
+}
+
+static void func_vand_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a & b);
+}
+
+static void func_vand_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a & b);
+}
+
+static void func_vand_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, a & b);
+}
+
+static void func_vor_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a | b);
+}
+
+static void func_vor_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a | b);
+}
+
+static void func_vor_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, a | b);
+}
+
+static void func_vxor_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a ^ b);
+}
+
+static void func_vxor_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a ^ b);
+}
+
+static void func_vxor_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, a ^ b);
+}
+
+static void func_vsll_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a << (b & (sew - 1)));
+}
+
+static void func_vsll_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a << (b & (sew - 1)));
+}
+
+static void func_vsll_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, a << (b & (sew - 1)));
+}
+
+static void func_vsrl_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a >> (b & (sew - 1)));
+}
+
+static void func_vsrl_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a >> (b & (sew - 1)));
+}
+
+static void func_vsrl_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, a >> (b & (sew - 1)));
+}
+
+static void func_vsra_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, sa >> (b & (sew - 1)));
+}
+
+static void func_vsra_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, sa >> (b & (sew - 1)));
+}
+
+static void func_vsra_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, sa >> (b & (sew - 1)));
+}
+
+static void func_vmul_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a * b);
+}
+
+static void func_vmul_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a * b);
+}
+
+#undef FUNC
+
+#define FUNC(operand)                                             \
+    u64 sew = VSEW(state->vtype);                                 \
+    for (u64 i = 0; i < state->vl; i++) {                         \
+        u64 val = ACTIVE ? (u64)(operand)                         \
+                         : v_get(state, insn->rs2, i, sew);       \
+        v_set(state, insn->rd, i, sew, val);                      \
+    }                                                             \
+
+static void func_vmerge_vv(state_t *state, insn_t *insn) {
+    FUNC(VV);
+}
+
+static void func_vmerge_vx(state_t *state, insn_t *insn) {
+    FUNC(VX);
+}
+
+static void func_vmerge_vi(state_t *state, insn_t *insn) {
+    FUNC(VI);
+}
+
+static void func_vfmerge_vf(state_t *state, insn_t *insn) {
+    FUNC(VF);
+}
+
+#undef FUNC
+
+#define FUNC(operand, expr)                                         \
+    u64 sew = VSEW(state->vtype);                                   \
+    u8 mask[VLENB];                                                 \
+    memcpy(mask, state->v_regs + insn->rd * VLENB, VLENB);          \
+    for (u64 i = 0; i < state->vl; i++) {                           \
+        if (!ACTIVE) continue;                                      \
+        u64 a = v_get(state, insn->rs2, i, sew);                    \
+        u64 b = v_trunc((operand), sew);                            \
+        __attribute__((unused)) i64 sa = v_sext(a, sew);            \
+        __attribute__((unused)) i64 sb = v_sext(b, sew);            \
+        u8 bit = (u8)1 << (i % 8);                                  \
+        mask[i / 8] = (expr) ? (mask[i / 8] | bit) : (mask[i / 8] & ~bit); \
+    }                                                               \
+    memcpy(state->v_regs + insn->rd * VLENB, mask, VLENB);          \
+
+static void func_vmseq_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a == b);
+}
+
+static void func_vmseq_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a == b);
+}
+
+static void func_vmseq_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, a == b);
+}
+
+static void func_vmsne_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a != b);
+}
+
+static void func_vmsne_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a != b);
+}
+
+static void func_vmsne_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, a != b);
+}
+
+static void func_vmsltu_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a < b);
+}
+
+static void func_vmsltu_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a < b);
+}
+
+static void func_vmslt_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, sa < sb);
+}
+
+static void func_vmslt_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, sa < sb);
+}
+
+static void func_vmsleu_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, a <= b);
+}
+
+static void func_vmsleu_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a <= b);
+}
+
+static void func_vmsleu_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, a <= b);
+}
+
+static void func_vmsle_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, sa <= sb);
+}
+
+static void func_vmsle_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, sa <= sb);
+}
+
+static void func_vmsle_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, sa <= sb);
+}
+
+static void func_vmsgtu_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, a > b);
+}
+
+static void func_vmsgtu_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, a > b);
+}
+
+static void func_vmsgt_vx(state_t *state, insn_t *insn) {
+    FUNC(VX, sa > sb);
+}
+
+static void func_vmsgt_vi(state_t *state, insn_t *insn) {
+    FUNC(VI, sa > sb);
+}
+
+#undef FUNC
+
+static void func_vredsum_vs(state_t *state, insn_t *insn) {
+    u64 sew = VSEW(state->vtype);
+    u64 sum = v_get(state, insn->rs1, 0, sew);
+    for (u64 i = 0; i < state->vl; i++) {
+        if (!ACTIVE) continue;
+        sum += v_get(state, insn->rs2, i, sew);
+    }
+    if (state->vl > 0) v_set(state, insn->rd, 0, sew, sum);
+}
+
+static void func_vmv_x_s(state_t *state, insn_t *insn) {
+    u64 sew = VSEW(state->vtype);
+    state->gp_regs[insn->rd] = v_sext(v_get(state, insn->rs2, 0, sew), sew);
+}
+
+static void func_vmv_s_x(state_t *state, insn_t *insn) {
+    u64 sew = VSEW(state->vtype);
+    if (state->vl > 0) v_set(state, insn->rd, 0, sew, state->gp_regs[insn->rs1]);
+}
+
+static void func_vid_v(state_t *state, insn_t *insn) {
+    u64 sew = VSEW(state->vtype);
+    for (u64 i = 0; i < state->vl; i++) {
+        if (!ACTIVE) continue;
+        v_set(state, insn->rd, i, sew, i);
+    }
+}
+
+#define FUNC(operand, expr)                                     \
+    u64 sew = VSEW(state->vtype);                               \
+    if (sew != 32 && sew != 64) fatal("unsupported sew");       \
+    for (u64 i = 0; i < state->vl; i++) {                       \
+        if (!ACTIVE) continue;                                  \
+        u64 a = v_get(state, insn->rs2, i, sew);                \
+        u64 b = (operand);                                      \
+        u64 c = v_get(state, insn->rd, i, sew);                 \
+        if (sew == 32) {                                        \
+            f32 x = ((union u32_f32){ .ui = a }).f;             \
+            f32 y = ((union u32_f32){ .ui = b }).f;             \
+            __attribute__((unused))                             \
+            f32 z = ((union u32_f32){ .ui = c }).f;             \
+            f32 r = (expr);                                     \
+            v_set(state, insn->rd, i, sew, ((union u32_f32){ .f = r }).ui); \
+        } else {                                                \
+            f64 x = ((union u64_f64){ .ui = a }).f;             \
+            f64 y = ((union u64_f64){ .ui = b }).f;             \
+            __attribute__((unused))                             \
+            f64 z = ((union u64_f64){ .ui = c }).f;             \
+            f64 r = (expr);                                     \
+            v_set(state, insn->rd, i, sew, ((union u64_f64){ .f = r }).ui); \
+        }                                                       \
+    }                                                           \
+
+static void func_vfadd_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, x + y);
+}
+
+static void func_vfadd_vf(state_t *state, insn_t *insn) {
+    FUNC(VF, x + y);
+}
+
+static void func_vfsub_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, x - y);
+}
+
+static void func_vfsub_vf(state_t *state, insn_t *insn) {
+    FUNC(VF, x - y);
+}
+
+static void func_vfmul_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, x * y);
+}
+
+static void func_vfmul_vf(state_t *state, insn_t *insn) {
+    FUNC(VF, x * y);
+}
+
+static void func_vfdiv_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, x / y);
+}
+
+static void func_vfdiv_vf(state_t *state, insn_t *insn) {
+    FUNC(VF, x / y);
+}
+
+static void func_vfmacc_vv(state_t *state, insn_t *insn) {
+    FUNC(VV, y * x + z);
+}
+
+static void func_vfmacc_vf(state_t *state, insn_t *insn) {
+    FUNC(VF, y * x + z);
+}
+
+#undef FUNC
+
+static void func_vfmv_f_s(state_t *state, insn_t *insn) {
+    u64 sew = VSEW(state->vtype);
+    u64 val = v_get(state, insn->rs2, 0, sew);
+    if (sew == 32) val |= (u64)-1 << 32;
+    else if (sew != 64) fatal("unsupported sew");
+    state->fp_regs[insn->rd].v = val;
+}
+
+static void func_vfmv_s_f(state_t *state, insn_t *insn) {
+    u64 sew = VSEW(state->vtype);
+    if (state->vl > 0) v_set(state, insn->rd, 0, sew, VF);
+}
+
+#undef VV
+#undef VX
+#undef VI
+#undef VF
+#undef ACTIVE
+
+#define FUNC(expr)                       \
+    u64 rs1 = state->gp_regs[insn->rs1]; \
+    u64 rs2 = state->gp_regs[insn->rs2]; \
+    state->gp_regs[insn->rd] = (expr);   \
+
+static void func_add_uw(state_t *state, insn_t *insn) {
+    FUNC((u64)(u32)rs1 + rs2);
+}
+
+static void func_sh1add(state_t *state, insn_t *insn) {
+    FUNC((rs1 << 1) + rs2);
+}
+
+static void func_sh2add(state_t *state, insn_t *insn) {
+    FUNC((rs1 << 2) + rs2);
+}
+
+static void func_sh3add(state_t *state, insn_t *insn) {
+    FUNC((rs1 << 3) + rs2);
+}
+
+static void func_sh1add_uw(state_t *state, insn_t *insn) {
+    FUNC(((u64)(u32)rs1 << 1) + rs2);
+}
+
+static void func_sh2add_uw(state_t *state, insn_t *insn) {
+    FUNC(((u64)(u32)rs1 << 2) + rs2);
+}
+
+static void func_sh3add_uw(state_t *state, insn_t *insn) {
+    FUNC(((u64)(u32)rs1 << 3) + rs2);
+}
+
+static void func_andn(state_t *state, insn_t *insn) {
+    FUNC(rs1 & ~rs2);
+}
+
+static void func_orn(state_t *state, insn_t *insn) {
+    FUNC(rs1 | ~rs2);
+}
+
+static void func_xnor(state_t *state, insn_t *insn) {
+    FUNC(~(rs1 ^ rs2));
+}
+
+static void func_max(state_t *state, insn_t *insn) {
+    FUNC((i64)rs1 > (i64)rs2 ? rs1 : rs2);
+}
+
+static void func_maxu(state_t *state, insn_t *insn) {
+    FUNC(rs1 > rs2 ? rs1 : rs2);
+}
+
+static void func_min(state_t *state, insn_t *insn) {
+    FUNC((i64)rs1 < (i64)rs2 ? rs1 : rs2);
+}
+
+static void func_minu(state_t *state, insn_t *insn) {
+    FUNC(rs1 < rs2 ? rs1 : rs2);
+}
+
+static void func_rol(state_t *state, insn_t *insn) {
+    FUNC((rs1 << (rs2 & 0x3f)) | (rs1 >> (-rs2 & 0x3f)));
+}
+
+static void func_rolw(state_t *state, insn_t *insn) {
+    FUNC((i64)(i32)(((u32)rs1 << (rs2 & 0x1f)) | ((u32)rs1 >> (-rs2 & 0x1f))));
+}
+
+static void func_ror(state_t *state, insn_t *insn) {
+    FUNC((rs1 >> (rs2 & 0x3f)) | (rs1 << (-rs2 & 0x3f)));
+}
+
+static void func_rorw(state_t *state, insn_t *insn) {
+    FUNC((i64)(i32)(((u32)rs1 >> (rs2 & 0x1f)) | ((u32)rs1 << (-rs2 & 0x1f))));
+}
+
+static void func_bclr(state_t *state, insn_t *insn) {
+    FUNC(rs1 & ~((u64)1 << (rs2 & 0x3f)));
+}
+
+static void func_bext(state_t *state, insn_t *insn) {
+    FUNC((rs1 >> (rs2 & 0x3f)) & 1);
+}
+
+static void func_binv(state_t *state, insn_t *insn) {
+    FUNC(rs1 ^ ((u64)1 << (rs2 & 0x3f)));
+}
+
+static void func_bset(state_t *state, insn_t *insn) {
+    FUNC(rs1 | ((u64)1 << (rs2 & 0x3f)));
+}
+
+#undef FUNC
+
+#define FUNC(expr)                       \
+    u64 rs1 = state->gp_regs[insn->rs1]; \
+    u64 imm = insn->imm & 0x3f;          \
+    state->gp_regs[insn->rd] = (expr);   \
+
+static void func_slli_uw(state_t *state, insn_t *insn) {
+    FUNC((u64)(u32)rs1 << imm);
+}
+
+static void func_rori(state_t *state, insn_t *insn) {
+    FUNC((rs1 >> imm) | (rs1 << (-imm & 0x3f)));
+}
+
+static void func_roriw(state_t *state, insn_t *insn) {
+    FUNC((i64)(i32)(((u32)rs1 >> (imm & 0x1f)) | ((u32)rs1 << (-imm & 0x1f))));
+}
+
+static void func_bclri(state_t *state, insn_t *insn) {
+    FUNC(rs1 & ~((u64)1 << imm));
+}
+
+static void func_bexti(state_t *state, insn_t *insn) {
+    FUNC((rs1 >> imm) & 1);
+}
+
+static void func_binvi(state_t *state, insn_t *insn) {
+    FUNC(rs1 ^ ((u64)1 << imm));
+}
+
+static void func_bseti(state_t *state, insn_t *insn) {
+    FUNC(rs1 | ((u64)1 << imm));
+}
+
+#undef FUNC
+
+#define FUNC(expr)                       \
+    u64 rs1 = state->gp_regs[insn->rs1]; \
+    state->gp_regs[insn->rd] = (expr);   \
+
+static void func_clz(state_t *state, insn_t *insn) {
+    FUNC(rs1 == 0 ? 64 : __builtin_clzll(rs1));
+}
+
+static void func_clzw(state_t *state, insn_t *insn) {
+    FUNC((u32)rs1 == 0 ? 32 : __builtin_clz((u32)rs1));
+}
+
+static void func_ctz(state_t *state, insn_t *insn) {
+    FUNC(rs1 == 0 ? 64 : __builtin_ctzll(rs1));
+}
+
+static void func_ctzw(state_t *state, insn_t *insn) {
+    FUNC((u32)rs1 == 0 ? 32 : __builtin_ctz((u32)rs1));
+}
+
+static void func_cpop(state_t *state, insn_t *insn) {
+    FUNC(__builtin_popcountll(rs1));
+}
+
+static void func_cpopw(state_t *state, insn_t *insn) {
+    FUNC(__builtin_popcount((u32)rs1));
+}
+
+static void func_sext_b(state_t *state, insn_t *insn) {
+    FUNC((i64)(i8)rs1);
+}
+
+static void func_sext_h(state_t *state, insn_t *insn) {
+    FUNC((i64)(i16)rs1);
+}
+
+static void func_zext_h(state_t *state, insn_t *insn) {
+    FUNC((u16)rs1);
+}
+
+static void func_orc_b(state_t *state, insn_t *insn) {
+    FUNC(orc_b(rs1));
+}
+
+static void func_rev8(state_t *state, insn_t *insn) {
+    FUNC(__builtin_bswap64(rs1));
+}
+
+#undef FUNC
+
+#define FUNC(expr)                       \
+    u64 rs1 = state->gp_regs[insn->rs1]; \
+    u64 rs2 = state->gp_regs[insn->rs2]; \
+    state->gp_regs[insn->rd] = (expr);   \
+
+static void func_pack(state_t *state, insn_t *insn) {
+    FUNC((u64)(u32)rs1 | (rs2 << 32));
+}
+
+static void func_packh(state_t *state, insn_t *insn) {
+    FUNC((u64)(u8)rs1 | ((u64)(u8)rs2 << 8));
+}
+
+static void func_packw(state_t *state, insn_t *insn) {
+    FUNC((i64)(i32)((u32)(u16)rs1 | ((u32)rs2 << 16)));
+}
+
+static void func_clmul(state_t *state, insn_t *insn) {
+    FUNC(clmul(rs1, rs2, false));
+}
+
+static void func_clmulh(state_t *state, insn_t *insn) {
+    FUNC(clmul(rs1, rs2, true));
+}
+
+static void func_aes64es(state_t *state, insn_t *insn) {
+    FUNC(aes64_round(rs1, rs2, false, false));
+}
+
+static void func_aes64esm(state_t *state, insn_t *insn) {
+    FUNC(aes64_round(rs1, rs2, false, true));
+}
+
+static void func_aes64ds(state_t *state, insn_t *insn) {
+    FUNC(aes64_round(rs1, rs2, true, false));
+}
+
+static void func_aes64dsm(state_t *state, insn_t *insn) {
+    FUNC(aes64_round(rs1, rs2, true, true));
+}
+
+static void func_aes64ks2(state_t *state, insn_t *insn) {
+    u64 rs1 = state->gp_regs[insn->rs1];
+    u64 rs2 = state->gp_regs[insn->rs2];
+    u32 w0 = (rs1 >> 32) ^ (u32)rs2;
+    u32 w1 = w0 ^ (rs2 >> 32);
+    state->gp_regs[insn->rd] = w0 | (u64)w1 << 32;
+}
+
+#undef FUNC
+
+#define FUNC(expr)                       \
+    u64 rs1 = state->gp_regs[insn->rs1]; \
+    state->gp_regs[insn->rd] = (expr);   \
+
+static void func_brev8(state_t *state, insn_t *insn) {
+    FUNC(brev8(rs1));
+}
+
+static void func_aes64im(state_t *state, insn_t *insn) {
+    FUNC(aes_mix64(rs1, true));
+}
+
+static void func_aes64ks1i(state_t *state, insn_t *insn) {
+    FUNC(aes64_ks1i(rs1, insn->imm));
+}
+
+static void func_sha256sig0(state_t *state, insn_t *insn) {
+    FUNC((i64)(i32)(ror32(rs1, 7) ^ ror32(rs1, 18) ^ ((u32)rs1 >> 3)));
+}
+
+static void func_sha256sig1(state_t *state, insn_t *insn) {
+    FUNC((i64)(i32)(ror32(rs1, 17) ^ ror32(rs1, 19) ^ ((u32)rs1 >> 10)));
+}
+
+static void func_sha256sum0(state_t *state, insn_t *insn) {
+    FUNC((i64)(i32)(ror32(rs1, 2) ^ ror32(rs1, 13) ^ ror32(rs1, 22)));
+}
+
+static void func_sha256sum1(state_t *state, insn_t *insn) {
+    FUNC((i64)(i32)(ror32(rs1, 6) ^ ror32(rs1, 11) ^ ror32(rs1, 25)));
+}
+
+static void func_sha512sig0(state_t *state, insn_t *insn) {
+    FUNC(ror64(rs1, 1) ^ ror64(rs1, 8) ^ (rs1 >> 7));
+}
+
+static void func_sha512sig1(state_t *state, insn_t *insn) {
+    FUNC(ror64(rs1, 19) ^ ror64(rs1, 61) ^ (rs1 >> 6));
+}
+
+static void func_sha512sum0(state_t *state, insn_t *insn) {
+    FUNC(ror64(rs1, 28) ^ ror64(rs1, 34) ^ ror64(rs1, 39));
+}
+
+static void func_sha512sum1(state_t *state, insn_t *insn) {
+    FUNC(ror64(rs1, 14) ^ ror64(rs1, 18) ^ ror64(rs1, 41));
+}
+
+#undef FUNC
+
+static void func_flh(state_t *state, insn_t *insn) {
+    u64 addr = state->gp_regs[insn->rs1] + (i64)insn->imm;
+    state->fp_regs[insn->rd].v = F16_BOX(*(u16 *)TO_HOST(state->mem, addr));
+}
+
+static void func_fsh(state_t *state, insn_t *insn) {
+    u64 rs1 = state->gp_regs[insn->rs1];
+    *(u16 *)TO_HOST(state->mem, rs1 + insn->imm) = state->fp_regs[insn->rs2].h;
+}
+
+#define FUNC(expr)                                                \
+    f64 rs1 = f16_to_f32(state->fp_regs[insn->rs1].h);            \
+    f64 rs2 = f16_to_f32(state->fp_regs[insn->rs2].h);            \
+    f64 rs3 = f16_to_f32(state->fp_regs[insn->rs3].h);            \
+    state->fp_regs[insn->rd].v = F16_BOX(f64_to_f16(expr));       \
+
+static void func_fmadd_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 * rs2 + rs3);
+}
+
+static void func_fmsub_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 * rs2 - rs3);
+}
+
+static void func_fnmsub_h(state_t *state, insn_t *insn) {
+    FUNC(-(rs1 * rs2) + rs3);
+}
+
+static void func_fnmadd_h(state_t *state, insn_t *insn) {
+    FUNC(-(rs1 * rs2) - rs3);
+}
+
+#undef FUNC
+
+#define FUNC(expr)                                                         \
+    f32 rs1 = f16_to_f32(state->fp_regs[insn->rs1].h);                     \
+    __attribute__((unused)) f32 rs2 = f16_to_f32(state->fp_regs[insn->rs2].h); \
+    state->fp_regs[insn->rd].v = F16_BOX(f64_to_f16((f32)(expr)));         \
+
+static void func_fadd_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 + rs2);
+}
+
+static void func_fsub_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 - rs2);
+}
+
+static void func_fmul_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 * rs2);
+}
+
+static void func_fdiv_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 / rs2);
+}
+
+static void func_fsqrt_h(state_t *state, insn_t *insn) {
+    FUNC(sqrtf(rs1));
+}
+
+static void func_fmin_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 < rs2 ? rs1 : rs2);
+}
+
+static void func_fmax_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 > rs2 ? rs1 : rs2);
+}
+
+#undef FUNC
+
+#define F16_SIGN ((u16)1 << 15)
+
+#define FUNC(n, x)                                                 \
+    u16 rs1 = state->fp_regs[insn->rs1].h;                         \
+    u16 rs2 = state->fp_regs[insn->rs2].h;                         \
+    u16 v = x ? rs1 : n ? F16_SIGN : 0;                            \
+    u16 rd = (rs1 & ~F16_SIGN) | ((v ^ rs2) & F16_SIGN);           \
+    state->fp_regs[insn->rd].v = F16_BOX(rd);                      \
+
+static void func_fsgnj_h(state_t *state, insn_t *insn) {
+    FUNC(false, false);
+}
+
+static void func_fsgnjn_h(state_t *state, insn_t *insn) {
+    FUNC(true, false);
+}
+
+static void func_fsgnjx_h(state_t *state, insn_t *insn) {
+    FUNC(false, true);
+}
+
+#undef FUNC
+#undef F16_SIGN
+
+static void func_fcvt_s_h(state_t *state, insn_t *insn) {
+    state->fp_regs[insn->rd].f = f16_to_f32(state->fp_regs[insn->rs1].h);
+}
+
+static void func_fcvt_h_s(state_t *state, insn_t *insn) {
+    state->fp_regs[insn->rd].v = F16_BOX(f64_to_f16(state->fp_regs[insn->rs1].f));
+}
+
+static void func_fcvt_d_h(state_t *state, insn_t *insn) {
+    state->fp_regs[insn->rd].d = f16_to_f32(state->fp_regs[insn->rs1].h);
+}
+
+static void func_fcvt_h_d(state_t *state, insn_t *insn) {
+    state->fp_regs[insn->rd].v = F16_BOX(f64_to_f16(state->fp_regs[insn->rs1].d));
+}
+
+#define FUNC(expr)                                         \
+    f32 rs1 = f16_to_f32(state->fp_regs[insn->rs1].h);     \
+    f32 rs2 = f16_to_f32(state->fp_regs[insn->rs2].h);     \
+    state->gp_regs[insn->rd] = (expr);                     \
+
+static void func_feq_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 == rs2);
+}
+
+static void func_flt_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 < rs2);
+}
+
+static void func_fle_h(state_t *state, insn_t *insn) {
+    FUNC(rs1 <= rs2);
+}
+
+#undef FUNC
+
+static void func_fclass_h(state_t *state, insn_t *insn) {
+    state->gp_regs[insn->rd] = f16_classify(state->fp_regs[insn->rs1].h);
+}
+
+static void func_fmv_x_h(state_t *state, insn_t *insn) {
+    state->gp_regs[insn->rd] = (i64)(i16)state->fp_regs[insn->rs1].h;
+}
+
+static void func_fmv_h_x(state_t *state, insn_t *insn) {
+    state->fp_regs[insn->rd].v = F16_BOX(state->gp_regs[insn->rs1]);
+}
+
+static void func_fcvt_w_h(state_t *state, insn_t *insn) {
+    state->gp_regs[insn->rd] = (i64)(i32)llrintf(f16_to_f32(state->fp_regs[insn->rs1].h));
+}
+
+static void func_fcvt_wu_h(state_t *state, insn_t *insn) {
+    state->gp_regs[insn->rd] = (i64)(i32)(u32)llrintf(f16_to_f32(state->fp_regs[insn->rs1].h));
+}
+
+static void func_fcvt_l_h(state_t *state, insn_t *insn) {
+    state->gp_regs[insn->rd] = (i64)llrintf(f16_to_f32(state->fp_regs[insn->rs1].h));
+}
+
+static void func_fcvt_lu_h(state_t *state, insn_t *insn) {
+    state->gp_regs[insn->rd] = (u64)llrintf(f16_to_f32(state->fp_regs[insn->rs1].h));
+}
+
+static void func_fcvt_h_w(state_t *state, insn_t *insn) {
+    state->fp_regs[insn->rd].v = F16_BOX(f64_to_f16((f64)(i32)state->gp_regs[insn->rs1]));
+}
+
+static void func_fcvt_h_wu(state_t *state, insn_t *insn) {
+    state->fp_regs[insn->rd].v = F16_BOX(f64_to_f16((f64)(u32)state->gp_regs[insn->rs1]));
+}
+
+static void func_fcvt_h_l(state_t *state, insn_t *insn) {
+    state->fp_regs[insn->rd].v = F16_BOX(f64_to_f16((f64)(i64)state->gp_regs[insn->rs1]));
+}
+
+static void func_fcvt_h_lu(state_t *state, insn_t *insn) {
+    state->fp_regs[insn->rd].v = F16_BOX(f64_to_f16((f64)(u64)state->gp_regs[insn->rs1]));
+}
+
+#define FUNC(typ)                                                              \
+    u64 addr = state->gp_regs[insn->rs1];                                      \
+    typ v = __atomic_load_n((typ *)TO_HOST(state->mem, addr), lr_order(insn)); \
+    state->reserve_addr = addr;                                                \
+    state->reserve_val = v;                                                    \
+    state->gp_regs[insn->rd] = (i64)v;                                         \
+
+static void func_lr_w(state_t *state, insn_t *insn) {
+    FUNC(i32);
+}
+
+static void func_lr_d(state_t *state, insn_t *insn) {
+    FUNC(i64);
+}
+
+#undef FUNC
+
+/* sc succeeds if memory still holds the value lr saw. */
+#define FUNC(typ)                                                                            \
+    u64 addr = state->gp_regs[insn->rs1];                                                    \
+    typ rs2 = state->gp_regs[insn->rs2];                                                     \
+    typ expected = state->reserve_val;                                                       \
+    bool ok = state->reserve_addr == addr &&                                                 \
+        __atomic_compare_exchange_n((typ *)TO_HOST(state->mem, addr), &expected, rs2, false, \
+                                    amo_order(insn), __ATOMIC_RELAXED);                      \
+    state->reserve_addr = RESERVE_NONE;                                                      \
+    state->gp_regs[insn->rd] = !ok;                                                          \
+
+static void func_sc_w(state_t *state, insn_t *insn) {
+    FUNC(i32);
+}
+
+static void func_sc_d(state_t *state, insn_t *insn) {
+    FUNC(i64);
+}
+
+#undef FUNC
+
+#define FUNC(typ, expr)                                             \
+    typ *p = (typ *)TO_HOST(state->mem, state->gp_regs[insn->rs1]); \
+    typ rs2 = state->gp_regs[insn->rs2];                            \
+    int order = amo_order(insn);                                    \
+    state->gp_regs[insn->rd] = (i64)(expr);                         \
+
+static void func_amoswap_w(state_t *state, insn_t *insn) {
+    FUNC(i32, __atomic_exchange_n(p, rs2, order));
+}
+
+static void func_amoadd_w(state_t *state, insn_t *insn) {
+    FUNC(i32, __atomic_fetch_add(p, rs2, order));
+}
+
+static void func_amoxor_w(state_t *state, insn_t *insn) {
+    FUNC(i32, __atomic_fetch_xor(p, rs2, order));
+}
+
+static void func_amoand_w(state_t *state, insn_t *insn) {
+    FUNC(i32, __atomic_fetch_and(p, rs2, order));
+}
+
+static void func_amoor_w(state_t *state, insn_t *insn) {
+    FUNC(i32, __atomic_fetch_or(p, rs2, order));
+}
+
+static void func_amomin_w(state_t *state, insn_t *insn) {
+    FUNC(i32, AMO_CAS(i32, p, rs2, AMO_MIN, order));
+}
+
+static void func_amomax_w(state_t *state, insn_t *insn) {
+    FUNC(i32, AMO_CAS(i32, p, rs2, AMO_MAX, order));
+}
+
+static void func_amominu_w(state_t *state, insn_t *insn) {
+    FUNC(i32, (i32)AMO_CAS(u32, p, rs2, AMO_MIN, order));
+}
+
+static void func_amomaxu_w(state_t *state, insn_t *insn) {
+    FUNC(i32, (i32)AMO_CAS(u32, p, rs2, AMO_MAX, order));
+}
+
+static void func_amoswap_d(state_t *state, insn_t *insn) {
+    FUNC(i64, __atomic_exchange_n(p, rs2, order));
+}
+
+static void func_amoadd_d(state_t *state, insn_t *insn) {
+    FUNC(i64, __atomic_fetch_add(p, rs2, order));
+}
+
+static void func_amoxor_d(state_t *state, insn_t *insn) {
+    FUNC(i64, __atomic_fetch_xor(p, rs2, order));
+}
+
+static void func_amoand_d(state_t *state, insn_t *insn) {
+    FUNC(i64, __atomic_fetch_and(p, rs2, order));
+}
+
+static void func_amoor_d(state_t *state, insn_t *insn) {
+    FUNC(i64, __atomic_fetch_or(p, rs2, order));
+}
+
+static void func_amomin_d(state_t *state, insn_t *insn) {
+    FUNC(i64, AMO_CAS(i64, p, rs2, AMO_MIN, order));
+}
+
+static void func_amomax_d(state_t *state, insn_t *insn) {
+    FUNC(i64, AMO_CAS(i64, p, rs2, AMO_MAX, order));
+}
+
+static void func_amominu_d(state_t *state, insn_t *insn) {
+    FUNC(i64, (i64)AMO_CAS(u64, p, rs2, AMO_MIN, order));
+}
+
+static void func_amomaxu_d(state_t *state, insn_t *insn) {
+    FUNC(i64, (i64)AMO_CAS(u64, p, rs2, AMO_MAX, order));
+}
+
+#undef FUNC
+
+typedef void (func_t)(state_t *, insn_t *);
+
+static func_t *funcs[] = {
+    func_lb,
+    func_lh,
+    func_lw,
+    func_ld,
+    func_lbu,
+    func_lhu,
+    func_lwu,
+    func_empty, // fence
+    func_fence_i,
+    func_addi,
+    func_slli,
+    func_slti,
+    func_sltiu,
+    func_xori,
+    func_srli,
+    func_srai,
+    func_ori,
+    func_andi,
+    func_auipc,
+    func_addiw,
+    func_slliw,
+    func_srliw,
+    func_sraiw,
+    func_sb,
+    func_sh,
+    func_sw,
+    func_sd,
+    func_add,
+    func_sll,
+    func_slt,
+    func_sltu,
+    func_xor,
+    func_srl,
+    func_or,
+    func_and,
+    func_mul,
+    func_mulh,
+    func_mulhsu,
+    func_mulhu,
+    func_div,
+    func_divu,
+    func_rem,
+    func_remu,
+    func_sub,
+    func_sra,
+    func_lui,
+    func_addw,
+    func_sllw,
+    func_srlw,
+    func_mulw,
+    func_divw,
+    func_divuw,
+    func_remw,
+    func_remuw,
+    func_subw,
+    func_sraw,
+    func_beq,
+    func_bne,
+    func_blt,
+    func_bge,
+    func_bltu,
+    func_bgeu,
+    func_jalr,
+    func_jal,
+    func_ecall,
+    func_csrrw,
+    func_csrrs,
+    func_csrrc,
+    func_csrrwi,
+    func_csrrsi,
+    func_csrrci,
+    func_flw,
+    func_fsw,
+    func_fmadd_s,
+    func_fmsub_s,
+    func_fnmsub_s,
+    func_fnmadd_s,
+    func_fadd_s,
+    func_fsub_s,
+    func_fmul_s,
+    func_fdiv_s,
+    func_fsqrt_s,
+    func_fsgnj_s,
+    func_fsgnjn_s,
+    func_fsgnjx_s,
+    func_fmin_s,
+    func_fmax_s,
+    func_fcvt_w_s,
+    func_fcvt_wu_s,
+    func_fmv_x_w,
+    func_feq_s,
+    func_flt_s,
+    func_fle_s,
+    func_fclass_s,
+    func_fcvt_s_w,
+    func_fcvt_s_wu,
+    func_fmv_w_x,
+    func_fcvt_l_s,
+    func_fcvt_lu_s,
+    func_fcvt_s_l,
+    func_fcvt_s_lu,
+    func_fld,
+    func_fsd,
+    func_fmadd_d,
+    func_fmsub_d,
+    func_fnmsub_d,
+    func_fnmadd_d,
+    func_fadd_d,
+    func_fsub_d,
+    func_fmul_d,
+    func_fdiv_d,
+    func_fsqrt_d,
+    func_fsgnj_d,
+    func_fsgnjn_d,
+    func_fsgnjx_d,
+    func_fmin_d,
+    func_fmax_d,
+    func_fcvt_s_d,
+    func_fcvt_d_s,
+    func_feq_d,
+    func_flt_d,
+    func_fle_d,
+    func_fclass_d,
+    func_fcvt_w_d,
+    func_fcvt_wu_d,
+    func_fcvt_d_w,
+    func_fcvt_d_wu,
+    func_fcvt_l_d,
+    func_fcvt_lu_d,
+    func_fmv_x_d,
+    func_fcvt_d_l,
+    func_fcvt_d_lu,
+    func_fmv_d_x,
+    func_vsetvli,
+    func_vsetivli,
+    func_vsetvl,
+    func_vle8_v,
+    func_vle16_v,
+    func_vle32_v,
+    func_vle64_v,
+    func_vse8_v,
+    func_vse16_v,
+    func_vse32_v,
+    func_vse64_v,
+    func_vlse8_v,
+    func_vlse16_v,
+    func_vlse32_v,
+    func_vlse64_v,
+    func_vsse8_v,
+    func_vsse16_v,
+    func_vsse32_v,
+    func_vsse64_v,
+    func_vlm_v,
+    func_vsm_v,
+    func_vlr_v,
+    func_vsr_v,
+    func_vadd_vv,
+    func_vadd_vx,
+    func_vadd_vi,
+    func_vsub_vv,
+    func_vsub_vx,
+    func_vrsub_vx,
+    func_vrsub_vi,
+    func_vminu_vv,
+    func_vminu_vx,
+    func_vmin_vv,
+    func_vmin_vx,
+    func_vmaxu_vv,
+    func_vmaxu_vx,
+    func_vmax_vv,
+    func_vmax_vx,
+    func_vand_vv,
+    func_vand_vx,
+    func_vand_vi,
+    func_vor_vv,
+    func_vor_vx,
+    func_vor_vi,
+    func_vxor_vv,
+    func_vxor_vx,
+    func_vxor_vi,
+    func_vsll_vv,
+    func_vsll_vx,
+    func_vsll_vi,
+    func_vsrl_vv,
+    func_vsrl_vx,
+    func_vsrl_vi,
+    func_vsra_vv,
+    func_vsra_vx,
+    func_vsra_vi,
+    func_vmerge_vv,
+    func_vmerge_vx,
+    func_vmerge_vi,
+    func_vmseq_vv,
+    func_vmseq_vx,
+    func_vmseq_vi,
+    func_vmsne_vv,
+    func_vmsne_vx,
+    func_vmsne_vi,
+    func_vmsltu_vv,
+    func_vmsltu_vx,
+    func_vmslt_vv,
+    func_vmslt_vx,
+    func_vmsleu_vv,
+    func_vmsleu_vx,
+    func_vmsleu_vi,
+    func_vmsle_vv,
+    func_vmsle_vx,
+    func_vmsle_vi,
+    func_vmsgtu_vx,
+    func_vmsgtu_vi,
+    func_vmsgt_vx,
+    func_vmsgt_vi,
+    func_vmul_vv,
+    func_vmul_vx,
+    func_vredsum_vs,
+    func_vmv_x_s,
+    func_vmv_s_x,
+    func_vid_v,
+    func_vfadd_vv,
+    func_vfadd_vf,
+    func_vfsub_vv,
+    func_vfsub_vf,
+    func_vfmul_vv,
+    func_vfmul_vf,
+    func_vfdiv_vv,
+    func_vfdiv_vf,
+    func_vfmacc_vv,
+    func_vfmacc_vf,
+    func_vfmerge_vf,
+    func_vfmv_f_s,
+    func_vfmv_s_f,
+    func_add_uw,
+    func_sh1add,
+    func_sh2add,
+    func_sh3add,
+    func_sh1add_uw,
+    func_sh2add_uw,
+    func_sh3add_uw,
+    func_slli_uw,
+    func_andn,
+    func_orn,
+    func_xnor,
+    func_clz,
+    func_clzw,
+    func_ctz,
+    func_ctzw,
+    func_cpop,
+    func_cpopw,
+    func_max,
+    func_maxu,
+    func_min,
+    func_minu,
+    func_sext_b,
+    func_sext_h,
+    func_zext_h,
+    func_rol,
+    func_rolw,
+    func_ror,
+    func_rori,
+    func_roriw,
+    func_rorw,
+    func_orc_b,
+    func_rev8,
+    func_bclr,
+    func_bclri,
+    func_bext,
+    func_bexti,
+    func_binv,
+    func_binvi,
+    func_bset,
+    func_bseti,
+    func_pack,
+    func_packh,
+    func_packw,
+    func_brev8,
+    func_clmul,
+    func_clmulh,
+    func_aes64es,
+    func_aes64esm,
+    func_aes64ds,
+    func_aes64dsm,
+    func_aes64im,
+    func_aes64ks1i,
+    func_aes64ks2,
+    func_sha256sig0,
+    func_sha256sig1,
+    func_sha256sum0,
+    func_sha256sum1,
+    func_sha512sig0,
+    func_sha512sig1,
+    func_sha512sum0,
+    func_sha512sum1,
+    func_flh,
+    func_fsh,
+    func_fmadd_h,
+    func_fmsub_h,
+    func_fnmsub_h,
+    func_fnmadd_h,
+    func_fadd_h,
+    func_fsub_h,
+    func_fmul_h,
+    func_fdiv_h,
+    func_fsqrt_h,
+    func_fsgnj_h,
+    func_fsgnjn_h,
+    func_fsgnjx_h,
+    func_fmin_h,
+    func_fmax_h,
+    func_fcvt_s_h,
+    func_fcvt_h_s,
+    func_fcvt_d_h,
+    func_fcvt_h_d,
+    func_feq_h,
+    func_flt_h,
+    func_fle_h,
+    func_fclass_h,
+    func_fmv_x_h,
+    func_fmv_h_x,
+    func_fcvt_w_h,
+    func_fcvt_wu_h,
+    func_fcvt_l_h,
+    func_fcvt_lu_h,
+    func_fcvt_h_w,
+    func_fcvt_h_wu,
+    func_fcvt_h_l,
+    func_fcvt_h_lu,
+    func_lr_w,
+    func_sc_w,
+    func_amoswap_w,
+    func_amoadd_w,
+    func_amoxor_w,
+    func_amoand_w,
+    func_amoor_w,
+    func_amomin_w,
+    func_amomax_w,
+    func_amominu_w,
+    func_amomaxu_w,
+    func_lr_d,
+    func_sc_d,
+    func_amoswap_d,
+    func_amoadd_d,
+    func_amoxor_d,
+    func_amoand_d,
+    func_amoor_d,
+    func_amomin_d,
+    func_amomax_d,
+    func_amominu_d,
+    func_amomaxu_d,
+};
+
+/**
+ * rd names an fp or vector register for these, so x0 must not be
+ * redirected (vector stores even read vs3 from that field).
+ */
+bool rd_is_gp(enum insn_type_t type) {
+    switch (type) {
+    case insn_flw: case insn_fld: case insn_flh:
+    case insn_fmadd_s: case insn_fmsub_s: case insn_fnmsub_s: case insn_fnmadd_s:
+    case insn_fadd_s: case insn_fsub_s: case insn_fmul_s: case insn_fdiv_s: case insn_fsqrt_s:
+    case insn_fsgnj_s: case insn_fsgnjn_s: case insn_fsgnjx_s: case insn_fmin_s: case insn_fmax_s:
+    case insn_fcvt_s_w: case insn_fcvt_s_wu: case insn_fcvt_s_l: case insn_fcvt_s_lu: case insn_fmv_w_x:
+    case insn_fmadd_d: case insn_fmsub_d: case insn_fnmsub_d: case insn_fnmadd_d:
+    case insn_fadd_d: case insn_fsub_d: case insn_fmul_d: case insn_fdiv_d: case insn_fsqrt_d:
+    case insn_fsgnj_d: case insn_fsgnjn_d: case insn_fsgnjx_d: case insn_fmin_d: case insn_fmax_d:
+    case insn_fcvt_s_d: case insn_fcvt_d_s:
+    case insn_fcvt_d_w: case insn_fcvt_d_wu: case insn_fcvt_d_l: case insn_fcvt_d_lu: case insn_fmv_d_x:
+    case insn_fmadd_h: case insn_fmsub_h: case insn_fnmsub_h: case insn_fnmadd_h:
+    case insn_fadd_h: case insn_fsub_h: case insn_fmul_h: case insn_fdiv_h: case insn_fsqrt_h:
+    case insn_fsgnj_h: case insn_fsgnjn_h: case insn_fsgnjx_h: case insn_fmin_h: case insn_fmax_h:
+    case insn_fcvt_s_h: case insn_fcvt_h_s: case insn_fcvt_d_h: case insn_fcvt_h_d: case insn_fmv_h_x:
+    case insn_fcvt_h_w: case insn_fcvt_h_wu: case insn_fcvt_h_l: case insn_fcvt_h_lu:
+        return false;
+    case insn_vsetvli: case insn_vsetivli: case insn_vsetvl: case insn_vmv_x_s:
+        return true;
+    default:
+        return type < insn_vle8_v || type > insn_vfmv_s_f;
+    }
+}
+
+/**
+ * decoded-block cache: a guest basic block is decoded once into a packed
+ * array of insn_t with its handler resolved, so blocks that are not hot
+ * yet no longer pay insn_decode on every execution. each guest thread owns
+ * one through its state_t, so no locking is needed. the blocks are dropped
+ * whenever the decoded code may have changed (decoded_t in the mmu: a
+ * fence.i, or guest mappings over it changing), at the next entry.
+ */
+#define ICACHE_SIZE      (16 * 1024)
+#define ICACHE_ARENA     (1024 * 1024)
+#define IBLOCK_MAX_INSNS 64
+
+/**
+ * the threaded core (GNU C labels-as-values) executes the common integer
+ * instructions and a few fused pairs inline; everything else is an
+ * iop_call back into funcs[]. define INTERP_NO_THREADED to build the
+ * portable call loop instead.
+ */
+#if defined(__GNUC__) && !defined(INTERP_NO_THREADED)
+#define INTERP_THREADED
+#endif
+
+enum iop_t {
+    iop_call, iop_end,
+    iop_lb, iop_lh, iop_lw, iop_ld, iop_lbu, iop_lhu, iop_lwu,
+    iop_sb, iop_sh, iop_sw, iop_sd,
+    iop_addi, iop_slli, iop_slti, iop_sltiu, iop_xori, iop_srli, iop_srai, iop_ori, iop_andi, iop_addiw,
+    iop_add, iop_sub, iop_sll, iop_slt, iop_sltu, iop_xor, iop_srl, iop_sra, iop_or, iop_and, iop_addw, iop_subw,
+    iop_lui, iop_auipc,
+    iop_beq, iop_bne, iop_blt, iop_bge, iop_bltu, iop_bgeu,
+    /* superinstructions */
+    iop_lui_addi, iop_auipc_ld,
+    iop_slt_beqz, iop_slt_bnez, iop_sltu_beqz, iop_sltu_bnez,
+    iop_slti_beqz, iop_slti_bnez, iop_sltiu_beqz, iop_sltiu_bnez,
+    num_iops,
+};
+
+static const u8 iops[num_insns] = {
+    [insn_lb] = iop_lb, [insn_lh] = iop_lh, [insn_lw] = iop_lw, [insn_ld] = iop_ld,
+    [insn_lbu] = iop_lbu, [insn_lhu] = iop_lhu, [insn_lwu] = iop_lwu,
+    [insn_sb] = iop_sb, [insn_sh] = iop_sh, [insn_sw] = iop_sw, [insn_sd] = iop_sd,
+    [insn_addi] = iop_addi, [insn_slli] = iop_slli, [insn_slti] = iop_slti, [insn_sltiu] = iop_sltiu,
+    [insn_xori] = iop_xori, [insn_srli] = iop_srli, [insn_srai] = iop_srai, [insn_ori] = iop_ori,
+    [insn_andi] = iop_andi, [insn_addiw] = iop_addiw,
+    [insn_add] = iop_add, [insn_sub] = iop_sub, [insn_sll] = iop_sll, [insn_slt] = iop_slt,
+    [insn_sltu] = iop_sltu, [insn_xor] = iop_xor, [insn_srl] = iop_srl, [insn_sra] = iop_sra,
+    [insn_or] = iop_or, [insn_and] = iop_and, [insn_addw] = iop_addw, [insn_subw] = iop_subw,
+    [insn_lui] = iop_lui, [insn_auipc] = iop_auipc,
+    [insn_beq] = iop_beq, [insn_bne] = iop_bne, [insn_blt] = iop_blt,
+    [insn_bge] = iop_bge, [insn_bltu] = iop_bltu, [insn_bgeu] = iop_bgeu,
+};
+
+static enum iop_t iop_select(insn_t *a, insn_t *b) {
+    if (b == NULL) return iops[a->type];
+
+    if (a->type == insn_lui && b->type == insn_addi && b->rs1 == a->rd)
+        return iop_lui_addi;
+    if (a->type == insn_auipc && b->type == insn_ld && b->rs1 == a->rd)
+        return iop_auipc_ld;
+    if ((b->type == insn_beq || b->type == insn_bne) && b->rs1 == a->rd && b->rs2 == zero) {
+        bool nez = b->type == insn_bne;
+        switch (a->type) {
+        case insn_slt:   return nez ? iop_slt_bnez : iop_slt_beqz;
+        case insn_sltu:  return nez ? iop_sltu_bnez : iop_sltu_beqz;
+        case insn_slti:  return nez ? iop_slti_bnez : iop_slti_beqz;
+        case insn_sltiu: return nez ? iop_sltiu_bnez : iop_sltiu_beqz;
+        default: break;
+        }
+    }
+    return iops[a->type];
+}
+
+typedef struct {
+    const void *op; /* label in the threaded core, unused by the call loop */
+    func_t *func;
+    insn_t insn;
+} iinsn_t;
+
+typedef struct iblock_t {
+    u64 pc;
+    struct iblock_t *next;
+    u64 len;
+    iinsn_t insns[]; /* len insns, then an iop_end sentinel */
+} iblock_t;
+
+struct icache_t {
+    iblock_t *table[ICACHE_SIZE];
+    u8 *arena;
+    u64 arena_used;
+    u64 mem; /* the guest base, to fetch from */
+    decoded_t *decoded;
+    u64 gen; /* decoded->gen the blocks were decoded under */
+};
+
+static inline u64 icache_hash(u64 pc) {
+    return (pc >> 1) % ICACHE_SIZE;
+}
+
+/* an fp op with a static rounding mode runs under it, then frm again */
+static void func_static_rm(state_t *state, insn_t *insn) {
+    int frm = host_round[(state->fcsr >> 5) & 0x7];
+    if (host_round[insn->rm] == frm) {
+        funcs[insn->type](state, insn);
+        return;
+    }
+    fesetround(host_round[insn->rm]);
+    funcs[insn->type](state, insn);
+    fesetround(frm);
+}
+
+static iblock_t *icache_build(icache_t *icache, u64 pc, const void *const *labels) {
+    iinsn_t insns[IBLOCK_MAX_INSNS + 1];
+    u64 len = 0;
+    u64 cur = pc;
+    while (len < IBLOCK_MAX_INSNS) {
+        insn_t *insn = &insns[len].insn;
+        *insn = (insn_t){0};
+        insn_decode(insn, *(u32 *)TO_HOST(icache->mem, cur));
+        if (insn->rd == zero && rd_is_gp(insn->type)) insn->rd = GP_SCRATCH;
+        insns[len++].func = insn->rm == RM_DYN ? funcs[insn->type] : func_static_rm;
+
+        if (insn->cont) break;
+        cur += insn->rvc ? 2 : 4;
+    }
+
+    insns[len].func = NULL;
+    for (u64 k = 0; k <= len; k++) {
+        if (labels == NULL) {
+            insns[k].op = NULL;
+        } else if (k == len) {
+            insns[k].op = labels[iop_end];
+        } else {
+            insn_t *next = k + 1 < len ? &insns[k + 1].insn : NULL;
+            insns[k].op = labels[iop_select(&insns[k].insn, next)];
+        }
+    }
+
+    /* each arena starts with a link to the one before it, for icache_free */
+    size_t sz = ROUNDUP(sizeof(iblock_t) + (len + 1) * sizeof(iinsn_t), 16);
+    if (icache->arena == NULL || icache->arena_used + sz > ICACHE_ARENA) {
+        u8 *arena = (u8 *)malloc(ICACHE_ARENA);
+        *(u8 **)arena = icache->arena;
+        icache->arena = arena;
+        icache->arena_used = 16;
+    }
+
+    iblock_t *block = (iblock_t *)(icache->arena + icache->arena_used);
+    icache->arena_used += sz;
+    block->pc = pc;
+    block->len = len;
+    memcpy(block->insns, insns, (len + 1) * sizeof(iinsn_t));
+
+    u64 index = icache_hash(pc);
+    block->next = icache->table[index];
+    icache->table[index] = block;
+
+    decoded_t *d = icache->decoded;
+    u64 lo = __atomic_load_n(&d->lo, __ATOMIC_RELAXED);
+    while (pc < lo && !__atomic_compare_exchange_n(&d->lo, &lo, pc, true,
+                                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    u64 hi = __atomic_load_n(&d->hi, __ATOMIC_RELAXED);
+    while (cur + 4 > hi && !__atomic_compare_exchange_n(&d->hi, &hi, cur + 4, true,
+                                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return block;
+}
+
+static void icache_drop(icache_t *icache) {
+    for (u8 *arena = icache->arena; arena != NULL; ) {
+        u8 *prev = *(u8 **)arena;
+        free(arena);
+        arena = prev;
+    }
+    icache->arena = NULL;
+    memset(icache->table, 0, sizeof(icache->table));
+}
+
+static icache_t *icache_get(state_t *state) {
+    icache_t *icache = state->icache;
+    if (icache == NULL) {
+        icache = state->icache = (icache_t *)calloc(1, sizeof(icache_t));
+        icache->mem = state->mem;
+        icache->decoded = state->decoded;
+        icache->gen = __atomic_load_n(&state->decoded->gen, __ATOMIC_ACQUIRE);
+        return icache;
+    }
+
+    u64 gen = __atomic_load_n(&icache->decoded->gen, __ATOMIC_ACQUIRE);
+    if (gen != icache->gen) {
+        icache_drop(icache);
+        icache->gen = gen;
+    }
+    return icache;
+}
+
+void icache_free(icache_t *icache) {
+    if (icache == NULL) return;
+    icache_drop(icache);
+    free(icache);
+}
+
+static inline iblock_t *icache_lookup(icache_t *icache, u64 pc, const void *const *labels) {
+    for (iblock_t *b = icache->table[icache_hash(pc)]; b != NULL; b = b->next) {
+        if (b->pc == pc) return b;
+    }
+    return icache_build(icache, pc, labels);
+}
+
+/* handlers record exits in state, hand them back as the block's return value. */
+static inline block_exit_t interp_exit(state_t *state) {
+    block_exit_t ret = { .pc = state->reenter_pc, .reason = state->exit_reason };
+    state->exit_reason = none;
+    return ret;
+}
+
+#ifdef INTERP_THREADED
+
+#define X(n)   state->gp_regs[i->insn.n]
+#define IMM    ((i64)i->insn.imm)
+#define STEP() state->pc += i->insn.rvc ? 2 : 4, i++
+#define NEXT() STEP(); goto *i->op
+
+#define TAKE_BRANCH()                                                 \
+    state->pc += (i64)i->insn.imm;                                    \
+    return (block_exit_t){ .pc = state->pc, .reason = direct_branch }; \
+
+#define LOAD(name, typ)                                    \
+    op_##name:                                             \
+        X(rd) = *(typ *)TO_HOST(state->mem, X(rs1) + IMM); \
+        NEXT();                                            \
+
+#define STORE(name, typ)                                         \
+    op_##name:                                                   \
+        *(typ *)TO_HOST(state->mem, X(rs1) + IMM) = (typ)X(rs2); \
+        NEXT();                                                  \
+
+#define ALU(name, expr)                                     \
+    op_##name: {                                            \
+        u64 rs1 = X(rs1);                                   \
+        u64 rs2 = X(rs2);                                   \
+        i64 imm = IMM;                                      \
+        (void)rs1; (void)rs2; (void)imm;                    \
+        X(rd) = (expr);                                     \
+        NEXT();                                             \
+    }                                                       \
+
+#define BRANCH(name, expr)                                  \
+    op_##name: {                                            \
+        u64 rs1 = X(rs1);                                   \
+        u64 rs2 = X(rs2);                                   \
+        if (expr) { TAKE_BRANCH(); }                        \
+        NEXT();                                             \
+    }                                                       \
+
+#define CMP_BRANCH(name, expr, nez)                         \
+    op_##name: {                                            \
+        u64 rs1 = X(rs1);                                   \
+        u64 rs2 = X(rs2);                                   \
+        i64 imm = IMM;                                      \
+        (void)rs2; (void)imm;                               \
+        u64 v = (expr);                                     \
+        X(rd) = v;                                          \
+        STEP();                                             \
+        if ((v != 0) == (nez)) { TAKE_BRANCH(); }           \
+        NEXT();                                             \
+    }                                                       \
+
+#define L(name) [iop_##name] = &&op_##name
+
+block_exit_t exec_block_interp(state_t *state) {
+    static const void *const labels[num_iops] = {
+        L(call), L(end),
+        L(lb), L(lh), L(lw), L(ld), L(lbu), L(lhu), L(lwu),
+        L(sb), L(sh), L(sw), L(sd),
+        L(addi), L(slli), L(slti), L(sltiu), L(xori), L(srli), L(srai), L(ori), L(andi), L(addiw),
+        L(add), L(sub), L(sll), L(slt), L(sltu), L(xor), L(srl), L(sra), L(or), L(and), L(addw), L(subw),
+        L(lui), L(auipc),
+        L(beq), L(bne), L(blt), L(bge), L(bltu), L(bgeu),
+        L(lui_addi), L(auipc_ld),
+        L(slt_beqz), L(slt_bnez), L(sltu_beqz), L(sltu_bnez),
+        L(slti_beqz), L(slti_bnez), L(sltiu_beqz), L(sltiu_bnez),
+    };
+
+    icache_t *icache = icache_get(state);
+    iinsn_t *i = icache_lookup(icache, state->pc, labels)->insns;
+    goto *i->op;
+
+    op_call:
+        i->func(state, &i->insn);
+        if (state->exit_reason != none) return interp_exit(state);
+        NEXT();
+
+    op_end:
+        i = icache_lookup(icache, state->pc, labels)->insns;
+        goto *i->op;
+
+    LOAD(lb, i8)
+    LOAD(lh, i16)
+    LOAD(lw, i32)
+    LOAD(ld, i64)
+    LOAD(lbu, u8)
+    LOAD(lhu, u16)
+    LOAD(lwu, u32)
+
+    STORE(sb, u8)
+    STORE(sh, u16)
+    STORE(sw, u32)
+    STORE(sd, u64)
+
+    ALU(addi, rs1 + imm)
+    ALU(slli, rs1 << (imm & 0x3f))
+    ALU(slti, (i64)rs1 < (i64)imm)
+    ALU(sltiu, (u64)rs1 < (u64)imm)
+    ALU(xori, rs1 ^ imm)
+    ALU(srli, rs1 >> (imm & 0x3f))
+    ALU(srai, (i64)rs1 >> (imm & 0x3f))
+    ALU(ori, rs1 | (u64)imm)
+    ALU(andi, rs1 & (u64)imm)
+    ALU(addiw, (i64)(i32)(rs1 + imm))
+    ALU(add, rs1 + rs2)
+    ALU(sub, rs1 - rs2)
+    ALU(sll, rs1 << (rs2 & 0x3f))
+    ALU(slt, (i64)rs1 < (i64)rs2)
+    ALU(sltu, (u64)rs1 < (u64)rs2)
+    ALU(xor, rs1 ^ rs2)
+    ALU(srl, rs1 >> (rs2 & 0x3f))
+    ALU(sra, (i64)rs1 >> (rs2 & 0x3f))
+    ALU(or, rs1 | rs2)
+    ALU(and, rs1 & rs2)
+    ALU(addw, (i64)(i32)(rs1 + rs2))
+    ALU(subw, (i64)(i32)(rs1 - rs2))
+    ALU(lui, imm)
+    ALU(auipc, state->pc + imm)
+
+    BRANCH(beq, (u64)rs1 == (u64)rs2)
+    BRANCH(bne, (u64)rs1 != (u64)rs2)
+    BRANCH(blt, (i64)rs1 < (i64)rs2)
+    BRANCH(bge, (i64)rs1 >= (i64)rs2)
+    BRANCH(bltu, (u64)rs1 < (u64)rs2)
+    BRANCH(bgeu, (u64)rs1 >= (u64)rs2)
+
+    op_lui_addi:
+        X(rd) = IMM;
+        STEP();
+        X(rd) = X(rs1) + IMM;
+        NEXT();
+
+    op_auipc_ld:
+        X(rd) = state->pc + IMM;
+        STEP();
+        X(rd) = *(i64 *)TO_HOST(state->mem, X(rs1) + IMM);
+        NEXT();
+
+    CMP_BRANCH(slt_beqz, (i64)rs1 < (i64)rs2, false)
+    CMP_BRANCH(slt_bnez, (i64)rs1 < (i64)rs2, true)
+    CMP_BRANCH(sltu_beqz, (u64)rs1 < (u64)rs2, false)
+    CMP_BRANCH(sltu_bnez, (u64)rs1 < (u64)rs2, true)
+    CMP_BRANCH(slti_beqz, (i64)rs1 < (i64)imm, false)
+    CMP_BRANCH(slti_bnez, (i64)rs1 < (i64)imm, true)
+    CMP_BRANCH(sltiu_beqz, (u64)rs1 < (u64)imm, false)
+    CMP_BRANCH(sltiu_bnez, (u64)rs1 < (u64)imm, true)
+}
+
+#undef L
+#undef CMP_BRANCH
+#undef BRANCH
+#undef ALU
+#undef STORE
+#undef LOAD
+#undef TAKE_BRANCH
+#undef NEXT
+#undef STEP
+#undef IMM
+#undef X
+
+#else
+
+block_exit_t exec_block_interp(state_t *state) {
+    icache_t *icache = icache_get(state);
+    while (true) {
+        iblock_t *block = icache_lookup(icache, state->pc, NULL);
+        iinsn_t *end = block->insns + block->len;
+        for (iinsn_t *i = block->insns; i < end; i++) {
+            i->func(state, &i->insn);
+            if (state->exit_reason != none) return interp_exit(state);
+
+            state->pc += i->insn.rvc ? 2 : 4;
+        }
+    }
+}
+
+#endif
@@ -106,3 +106,227 @@ inline u16 f64_classify(f64 a) {
         (isNaN &&  isSNaN)                       << 8 |
         (isNaN && !isSNaN)                       << 9;
 }
+
+#define VTYPE_VILL ((u64)1 << 63)
+#define VSEW(vtype) ((u64)8 << (((vtype) >> 3) & 0x7))
+
+inline u64 vtype_vlmax(u64 vtype) {
+    u64 sew = VSEW(vtype);
+    u64 vlmul = vtype & 0x7;
+    if ((vtype >> 8) != 0 || sew > 64 || vlmul == 4) return 0;
+    if (vlmul < 4) return (VLEN << vlmul) / sew;
+    return (VLEN >> (8 - vlmul)) / sew;
+}
+
+inline u64 orc_b(u64 x) {
+    u64 t = ((x & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | x;
+    return ((t & 0x8080808080808080ULL) >> 7) * 0xff;
+}
+
+inline u32 ror32(u32 x, u32 n) {
+    return (x >> (n & 31)) | (x << (-n & 31));
+}
+
+inline u64 ror64(u64 x, u64 n) {
+    return (x >> (n & 63)) | (x << (-n & 63));
+}
+
+inline u64 brev8(u64 x) {
+    x = ((x & 0x5555555555555555ULL) << 1) | ((x >> 1) & 0x5555555555555555ULL);
+    x = ((x & 0x3333333333333333ULL) << 2) | ((x >> 2) & 0x3333333333333333ULL);
+    return ((x & 0x0f0f0f0f0f0f0f0fULL) << 4) | ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL);
+}
+
+inline u64 clmul(u64 a, u64 b, bool high) {
+    u64 lo = 0, hi = 0;
+    for (int i = 0; i < 64; i++) {
+        if ((b >> i) & 1) {
+            lo ^= a << i;
+            hi ^= i ? a >> (64 - i) : 0;
+        }
+    }
+    return high ? hi : lo;
+}
+
+static const u8 aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static const u8 aes_inv_sbox[256] = {
+    0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+    0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+    0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+    0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+    0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+    0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+    0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+    0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+    0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+    0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+    0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+    0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+    0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+    0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+    0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+    0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d,
+};
+
+static inline u8 aes_gfmul(u8 a, u8 b) {
+    u8 r = 0;
+    while (b) {
+        if (b & 1) r ^= a;
+        a = (a << 1) ^ ((a >> 7) * 0x1b);
+        b >>= 1;
+    }
+    return r;
+}
+
+static inline u32 aes_mixcolumn(u32 col, bool inv) {
+    u8 a[4] = {col, col >> 8, col >> 16, col >> 24};
+    u8 m[4] = {2, 3, 1, 1};
+    if (inv) {
+        m[0] = 14, m[1] = 11, m[2] = 13, m[3] = 9;
+    }
+    u32 res = 0;
+    for (int i = 0; i < 4; i++) {
+        u8 b = 0;
+        for (int j = 0; j < 4; j++)
+            b ^= aes_gfmul(a[j], m[(j - i + 4) % 4]);
+        res |= (u32)b << (i * 8);
+    }
+    return res;
+}
+
+static inline u64 aes_mix64(u64 x, bool inv) {
+    return aes_mixcolumn(x, inv) | (u64)aes_mixcolumn(x >> 32, inv) << 32;
+}
+
+/*
+ * the low two columns of (Inv)ShiftRows and (Inv)SubBytes applied to
+ * the state rs2:rs1, optionally followed by (Inv)MixColumns.
+ */
+static inline u64 aes64_round(u64 rs1, u64 rs2, bool dec, bool mix) {
+    u8 in[16];
+    memcpy(in, &rs1, 8);
+    memcpy(in + 8, &rs2, 8);
+    u64 res = 0;
+    for (int i = 0; i < 8; i++) {
+        int col = i / 4, row = i % 4;
+        int from = ((dec ? col - row + 4 : col + row) % 4) * 4 + row;
+        u8 b = dec ? aes_inv_sbox[in[from]] : aes_sbox[in[from]];
+        res |= (u64)b << (i * 8);
+    }
+    return mix ? aes_mix64(res, dec) : res;
+}
+
+static inline u64 aes64_ks1i(u64 rs1, u32 rnum) {
+    static const u8 rcon[] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+    u32 t = rs1 >> 32;
+    if (rnum != 0xa) t = ror32(t, 8);
+    u32 w = 0;
+    for (int i = 0; i < 4; i++)
+        w |= (u32)aes_sbox[(t >> (i * 8)) & 0xff] << (i * 8);
+    if (rnum != 0xa) w ^= rcon[rnum];
+    return w | (u64)w << 32;
+}
+
+#define F16_BOX(h) ((u64)(u16)(h) | ((u64)-1 << 16))
+
+static inline f32 f16_to_f32(u16 h) {
+    u32 sign = (u32)(h & 0x8000) << 16;
+    u32 exp = (h >> 10) & 0x1f;
+    u32 mant = h & 0x3ff;
+    union u32_f32 u;
+    if (exp == 0x1f) {
+        u.ui = sign | 0x7f800000 | (mant << 13);
+    } else if (exp == 0) {
+        u.f = (f32)mant * 0x1p-24f;
+        u.ui |= sign;
+    } else {
+        u.ui = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    return u.f;
+}
+
+/* round to nearest even, NaNs become the canonical NaN. */
+static inline u16 f64_to_f16(f64 d) {
+    union u64_f64 u = { .f = d };
+    u16 sign = (u.ui >> 48) & 0x8000;
+    i32 exp = (u.ui >> 52) & 0x7ff;
+    u64 mant = u.ui & 0xfffffffffffffULL;
+    if (exp == 0x7ff) return mant ? 0x7e00 : sign | 0x7c00;
+    if (exp == 0) return sign;
+
+    i32 e = exp - 1023 + 15;
+    u64 m = mant | (1ULL << 52);
+    i32 shift = 42;
+    if (e <= 0) {
+        shift += 1 - e;
+        e = 0;
+    }
+    if (shift > 60) return sign;
+
+    u64 r = m >> shift;
+    u64 rem = m & ((1ULL << shift) - 1);
+    u64 half = 1ULL << (shift - 1);
+    if (rem > half || (rem == half && (r & 1))) r++;
+
+    u64 bits = e > 0 ? ((u64)(e - 1) << 10) + r : r;
+    return bits >= 0x7c00 ? sign | 0x7c00 : sign | bits;
+}
+
+static inline u16 f16_classify(u16 h) {
+    bool sign = h >> 15;
+    u32 exp = (h >> 10) & 0x1f;
+    u32 mant = h & 0x3ff;
+
+    if (exp == 0x1f) {
+        if (mant == 0) return sign ? 1 << 0 : 1 << 7;
+        return (mant & 0x200) ? 1 << 9 : 1 << 8;
+    }
+    if (exp == 0) {
+        if (mant == 0) return sign ? 1 << 3 : 1 << 4;
+        return sign ? 1 << 2 : 1 << 5;
+    }
+    return sign ? 1 << 1 : 1 << 6;
+}
+
+inline int amo_order(insn_t *insn) {
+    if (insn->aq && insn->rl) return __ATOMIC_SEQ_CST;
+    if (insn->aq) return __ATOMIC_ACQUIRE;
+    if (insn->rl) return __ATOMIC_RELEASE;
+    return __ATOMIC_RELAXED;
+}
+
+/* loads can't carry release semantics, so lr.rl is strengthened. */
+inline int lr_order(insn_t *insn) {
+    if (insn->rl) return __ATOMIC_SEQ_CST;
+    return insn->aq ? __ATOMIC_ACQUIRE : __ATOMIC_RELAXED;
+}
+
+#define AMO_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define AMO_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* read-modify-write with no host builtin, done as a CAS loop. */
+#define AMO_CAS(typ, ptr, val, op, order) ({                              \
+    typ *p_ = (typ *)(ptr);                                               \
+    typ o_ = __atomic_load_n(p_, __ATOMIC_RELAXED);                       \
+    while (!__atomic_compare_exchange_n(p_, &o_, op(o_, (typ)(val)), true, \
+                                        (order), __ATOMIC_RELAXED));      \
+    o_;                                                                   \
+})
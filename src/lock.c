@@ -0,0 +1,25 @@
+#include "rvemu.h"
+
+/* its address tells threads apart */
+static __thread char self;
+
+void lock_acquire(lock_t *l) {
+    pthread_mutex_lock(&l->mutex);
+    __atomic_store_n(&l->owner, &self, __ATOMIC_RELAXED);
+}
+
+void lock_release(lock_t *l) {
+    __atomic_store_n(&l->owner, NULL, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&l->mutex);
+}
+
+/* only this thread ever stores &self, so no other can make this true */
+void lock_drop(lock_t *l) {
+    if (__atomic_load_n(&l->owner, __ATOMIC_RELAXED) == &self) lock_release(l);
+}
+
+/* a forked child has the lock as the parent left it, held or not */
+void lock_reset(lock_t *l) {
+    pthread_mutex_init(&l->mutex, NULL);
+    l->owner = NULL;
+}
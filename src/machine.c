@@ -1,15 +1,103 @@
+/* for the register names in ucontext_t */
+#define _GNU_SOURCE
+/* signal.h has a stack_t of its own, keep it out of the way of ours */
+#define stack_t host_stack_t
+#include <signal.h>
+#include <ucontext.h>
+#undef stack_t
+
 #include "rvemu.h"
 
+static __thread machine_t *current;
+
+static u8 *fault_host_pc(void *ctx) {
+#if defined(__x86_64__)
+    return (u8 *)((ucontext_t *)ctx)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    return (u8 *)((ucontext_t *)ctx)->uc_mcontext.pc;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * guest memory is one PROT_NONE reservation with only the guest's own
+ * mappings punched into it, so a stray guest access faults here instead of
+ * reaching rvemu. the faulting guest pc comes from the host pc: compiled
+ * code is found through the cache's block table (to the block entry), the
+ * interpreter keeps state.pc exact. the fault is only recorded here, and
+ * the guest ended as if killed by the signal once machine_run has unwound
+ * out of the handler; faults outside guest memory are ours, and are left
+ * to crash as usual.
+ */
+static void guest_fault(int sig, siginfo_t *info, void *ctx) {
+    u64 addr = (u64)info->si_addr;
+    if (current == NULL || addr < TO_HOST(current->mmu->mem, 0) ||
+        addr >= current->mmu->mem + GUEST_MEMORY_SIZE) {
+        signal(sig, SIG_DFL);
+        return;
+    }
+
+    u64 pc = cache_block_pc(current->cache, fault_host_pc(ctx));
+    current->fault_addr = TO_GUEST(current->mmu->mem, addr);
+    current->fault_pc = pc ? pc : current->state.pc;
+    current->fault_block = pc != 0;
+    siglongjmp(current->fault, sig);
+}
+
+/**
+ * a guest thread spinning in compiled code makes no syscalls, and would
+ * never notice the guest has exited. once it has, the other threads are
+ * kicked with SIG_KICK: one in compiled code holds no locks, and unwinds
+ * out of machine_run from here; anywhere else, it is on its way back to
+ * machine_step, which looks at mmu->exited itself. a blocking syscall
+ * fails with EINTR instead of restarting.
+ */
+#define SIG_KICK SIGURG
+
+static void guest_kick(int sig, siginfo_t *info, void *ctx) {
+    if (current == NULL || !__atomic_load_n(&current->mmu->exited, __ATOMIC_ACQUIRE)) return;
+    if (cache_block_pc(current->cache, fault_host_pc(ctx)) == 0) return;
+    siglongjmp(current->fault, sig);
+}
+
+static void install_fault_handler(void) {
+    struct sigaction sa = { .sa_sigaction = guest_fault, .sa_flags = SA_SIGINFO };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+    sigaction(SIGBUS, &sa, NULL);
+
+    struct sigaction kick = { .sa_sigaction = guest_kick, .sa_flags = SA_SIGINFO };
+    sigemptyset(&kick.sa_mask);
+    sigaction(SIG_KICK, &kick, NULL);
+}
+
+/* the caller holds mmu->lock */
+static void kick_locked(mmu_t *mmu) {
+    for (machine_t *t = mmu->running; t != NULL; t = t->next) {
+        if (!pthread_equal(t->thread, pthread_self())) pthread_kill(t->thread, SIG_KICK);
+    }
+}
+
+static block_exit_t exec_block(state_t *state, u8 *code) {
+    if (code == (u8 *)exec_block_interp) return exec_block_interp(state);
+
+    u64 *r = state->gp_regs;
+    return ((jit_block_func_t)code)(state, r[hot_regs[0]], r[hot_regs[1]],
+                                    r[hot_regs[2]], r[hot_regs[3]], r[hot_regs[4]]);
+}
+
 enum exit_reason_t machine_step(machine_t *m) {
     while(true) {
         bool hot = true;
 
         u8 *code = cache_lookup(m->cache, m->state.pc);
         if (code == NULL) {
-            hot = cache_hot(m->cache, m->state.pc);
+            hot = cache_hot(m->cache, m->state.pc, m->state.gp_regs);
             if (hot) {
                 str_t source = machine_genblock(m);
                 code = machine_compile(m, source);
+                str_free(source);
             }
         }
 
@@ -17,28 +105,41 @@ enum exit_reason_t machine_step(machine_t *m) {
             code = (u8 *)exec_block_interp;
         }
 
+        block_exit_t ret;
         while (true) {
-            m->state.exit_reason = none;
-            ((exec_block_func_t)code)(&m->state);
-            assert(m->state.exit_reason != none);
+            /* another thread ended the guest, see guest_kick */
+            if (__atomic_load_n(&m->mmu->exited, __ATOMIC_RELAXED)) return none;
+
+            ret = exec_block(&m->state, code);
+            assert(ret.reason != none);
 
-            if (m->state.exit_reason == indirect_branch ||
-                m->state.exit_reason == direct_branch ) {
-                code = cache_lookup(m->cache, m->state.reenter_pc);
+            if (ret.reason == indirect_branch || ret.reason == direct_branch) {
+                code = cache_lookup(m->cache, ret.pc);
                 if (code != NULL) continue;
             }
 
-            if (m->state.exit_reason == interp) {
-                m->state.pc = m->state.reenter_pc;
+            if (ret.reason == interp) {
+                m->state.pc = ret.pc;
                 code = (u8 *)exec_block_interp;
                 continue;
             }
 
+            if (ret.reason == deopt) {
+                m->state.pc = ret.pc;
+                code = (u8 *)exec_block_interp;
+                if (cache_deopt(m->cache, ret.pc)) {
+                    str_t source = machine_genblock(m);
+                    code = machine_compile(m, source);
+                    str_free(source);
+                }
+                continue;
+            }
+
             break;
         }
 
-        m->state.pc = m->state.reenter_pc;
-        switch (m->state.exit_reason) {
+        m->state.pc = ret.pc;
+        switch (ret.reason) {
         case direct_branch:
         case indirect_branch:
             // continue execution
@@ -57,30 +158,172 @@ void machine_load_program(machine_t *m, char *prog) {
         fatal(strerror(errno));
     }
 
-    mmu_load_elf(&m->mmu, fd);
+    mmu_load_elf(m->mmu, fd);
     close(fd);
 
-    m->state.pc = (u64)m->mmu.entry;
+    m->state.pc = (u64)m->mmu->entry;
 }
 
+/* argv[0] is the guest program */
 void machine_setup(machine_t *m, int argc, char *argv[]) {
     size_t stack_size = 32 * 1024 * 1024;
-    u64 stack = mmu_alloc(&m->mmu, stack_size);
+    u64 stack = mmu_alloc(m->mmu, stack_size);
+    /* a guard page, so a stack overflow faults instead of running into .bss */
+    mprotect((void *)TO_HOST(m->mmu->mem, stack), getpagesize(), PROT_NONE);
     m->state.gp_regs[sp] = stack + stack_size;
+    m->state.mem = m->mmu->mem;
+    m->state.decoded = &m->mmu->decoded;
+    m->state.reserve_addr = RESERVE_NONE;
+    m->state.cache = m->cache;
+    m->state.lookup = cache_lookup;
+    m->state.round = fenv_round;
 
     m->state.gp_regs[sp] -= 8; // auxp
     m->state.gp_regs[sp] -= 8; // envp
     m->state.gp_regs[sp] -= 8; // argv end
 
-    u64 args = argc - 1;
-    for (int i = args; i > 0; i--) {
+    u64 args = argc;
+    for (int i = args - 1; i >= 0; i--) {
         size_t len = strlen(argv[i]);
-        u64 addr = mmu_alloc(&m->mmu, len+1);
-        mmu_write(addr, (u8 *)argv[i], len);
+        u64 addr = mmu_alloc(m->mmu, len+1);
+        mmu_write(m->mmu, addr, (u8 *)argv[i], len);
         m->state.gp_regs[sp] -= 8; // argv[i]
-        mmu_write(m->state.gp_regs[sp], (u8 *)&addr, sizeof(u64));
+        mmu_write(m->mmu, m->state.gp_regs[sp], (u8 *)&addr, sizeof(u64));
     }
 
     m->state.gp_regs[sp] -= 8; // argc
-    mmu_write(m->state.gp_regs[sp], (u8 *)&args, sizeof(u64));
+    mmu_write(m->mmu, m->state.gp_regs[sp], (u8 *)&args, sizeof(u64));
+}
+
+/**
+ * takes this thread out of the guest. the exit status is final once the
+ * last thread is gone or any of them exits the whole group; the others
+ * are kicked out of the guest.
+ */
+void machine_exit(machine_t *m, bool group, i32 code) {
+    mmu_t *mmu = m->mmu;
+    pthread_mutex_lock(&mmu->lock);
+    if (!m->exited) {
+        m->exited = true;
+        __atomic_sub_fetch(&mmu->nthreads, 1, __ATOMIC_ACQ_REL);
+        for (machine_t **p = &mmu->running; *p != NULL; p = &(*p)->next) {
+            if (*p == m) {
+                *p = m->next;
+                break;
+            }
+        }
+    }
+    if (!mmu->exited && (group || mmu->nthreads == 0)) {
+        wbuf_flush_all();
+        uring_sync_all();
+        mmu->exit_code = code;
+        __atomic_store_n(&mmu->exited, true, __ATOMIC_RELEASE);
+        kick_locked(mmu);
+    }
+    pthread_cond_broadcast(&mmu->exit_cond);
+    pthread_mutex_unlock(&mmu->lock);
+}
+
+void machine_run(machine_t *m) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, install_fault_handler);
+    current = m;
+
+    mmu_t *mmu = m->mmu;
+    pthread_mutex_lock(&mmu->lock);
+    m->thread = pthread_self();
+    m->next = mmu->running;
+    mmu->running = m;
+    pthread_mutex_unlock(&mmu->lock);
+
+    /* a guest memory fault ends the guest like the signal would */
+    int sig = sigsetjmp(m->fault, 1);
+    if (sig != 0) {
+        if (sig != SIG_KICK) {
+            wbuf_flush_all(); /* what the guest wrote before comes first */
+            fprintf(stderr, "guest %s at %#lx, pc %#lx%s\n",
+                    sig == SIGSEGV ? "segmentation fault" : "bus error", m->fault_addr,
+                    m->fault_pc, m->fault_block ? " (block entry)" : "");
+        }
+        machine_exit(m, sig != SIG_KICK, 128 + sig);
+        return;
+    }
+
+    while (!m->exited) {
+        enum exit_reason_t reason = machine_step(m);
+        if (reason == none) {
+            machine_exit(m, false, 0);
+            break;
+        }
+        assert(reason == ecall);
+
+        u64 syscall = machine_get_gp_reg(m, a7);
+        u64 ret = do_syscall(m, syscall);
+        machine_set_gp_reg(m, a0, ret);
+
+        if (__atomic_load_n(&m->mmu->exited, __ATOMIC_ACQUIRE)) machine_exit(m, false, 0);
+    }
+}
+
+machine_t *rvemu_create(int argc, char *argv[]) {
+    assert(argc > 0);
+
+    machine_t *m = (machine_t *)calloc(1, sizeof(machine_t));
+    m->mmu = new_mmu();
+    m->cache = new_cache();
+    machine_load_program(m, argv[0]);
+    machine_setup(m, argc, argv);
+    return m;
+}
+
+/**
+ * returns once the guest has exited, even if this thread left it early.
+ * the guest's frm and fflags live in the host fenv while it runs, see
+ * interp.c, so the caller's is put aside meanwhile.
+ */
+int rvemu_run(machine_t *m) {
+    fenv_t host;
+    fegetenv(&host);
+    fenv_load(&m->state);
+    machine_run(m);
+    fenv_sync(&m->state);
+    fesetenv(&host);
+
+    mmu_t *mmu = m->mmu;
+    pthread_mutex_lock(&mmu->lock);
+    while (!mmu->exited) pthread_cond_wait(&mmu->exit_cond, &mmu->lock);
+    int code = mmu->exit_code;
+    pthread_mutex_unlock(&mmu->lock);
+    return code;
+}
+
+/**
+ * waits for the guest's other threads once it has exited. a kick can land
+ * just before a thread enters compiled code, so they are kicked again
+ * until all are gone.
+ */
+void machine_wait_threads(mmu_t *mmu) {
+    pthread_mutex_lock(&mmu->lock);
+    while (mmu->nthreads > 0) {
+        kick_locked(mmu);
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 10 * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&mmu->exit_cond, &mmu->lock, &ts);
+    }
+    pthread_mutex_unlock(&mmu->lock);
+}
+
+void rvemu_destroy(machine_t *m) {
+    mmu_t *mmu = m->mmu;
+    machine_wait_threads(mmu);
+
+    icache_free(m->state.icache);
+    cache_free(m->cache);
+    mmu_free(mmu);
+    free(m);
 }
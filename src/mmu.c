@@ -1,3 +1,7 @@
+/* for mremap and MAP_FIXED_NOREPLACE */
+#define _GNU_SOURCE
+#include <sys/sysmacros.h>
+
 #include "rvemu.h"
 
 static void load_phdr(elf64_phdr_t* phdr, elf64_ehdr_t *ehdr, i64 i, FILE *file) {
@@ -16,9 +20,14 @@ static int flags_to_mmap_prot(u32 flags) {
 }
 
 static void mmu_load_segment(mmu_t *mmu, elf64_phdr_t *phdr, int fd) {
+    /* below the mmap window, so a crafted elf cannot map over anything else */
+    u64 end = phdr->p_vaddr + phdr->p_memsz;
+    if (end < phdr->p_vaddr || end > GUEST_MMAP_BASE || phdr->p_filesz > phdr->p_memsz)
+        fatal("bad elf segment");
+
     int page_size = getpagesize();
     u64 offset = phdr->p_offset;
-    u64 vaddr = TO_HOST(phdr->p_vaddr);
+    u64 vaddr = TO_HOST(mmu->mem, phdr->p_vaddr);
     u64 aligned_vaddr = ROUNDDOWN(vaddr, page_size);
     u64 filesz = phdr->p_filesz + (vaddr - aligned_vaddr);
     u64 memsz = phdr->p_memsz + (vaddr - aligned_vaddr);
@@ -35,8 +44,44 @@ static void mmu_load_segment(mmu_t *mmu, elf64_phdr_t *phdr, int fd) {
         assert(addr == aligned_vaddr + ROUNDUP(filesz, page_size));
     }
     mmu->host_alloc = MAX(mmu->host_alloc, (aligned_vaddr + ROUNDUP(memsz, page_size)));
+    mmu->elf_start = MIN(mmu->elf_start, TO_GUEST(mmu->mem, aligned_vaddr));
+
+    mmu->base = mmu->alloc = TO_GUEST(mmu->mem, mmu->host_alloc);
+}
+
+/* guest memory stays reserved on the host, unmapped guest pages go back to it */
+static bool mmu_reserve(mmu_t *mmu, u64 addr, u64 len, int flags) {
+    return mmap((void *)TO_HOST(mmu->mem, addr), len, PROT_NONE,
+                MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | flags, -1, 0) != MAP_FAILED;
+}
+
+mmu_t *new_mmu() {
+    mmu_t *mmu = (mmu_t *)calloc(1, sizeof(mmu_t));
 
-    mmu->base = mmu->alloc = TO_GUEST(mmu->host_alloc);
+    /* the elf, heap and mmap window are all carved out of this */
+    void *mem = mmap(NULL, GUEST_MEMORY_SIZE, PROT_NONE,
+                     MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) fatal("cannot reserve guest memory");
+    mmu->mem = (u64)mem;
+    mmu->nthreads = 1;
+    mmu->decoded.lo = (u64)-1;
+
+    /* recursive, so syscalls can hold it across mmu_alloc. */
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mmu->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_cond_init(&mmu->exit_cond, NULL);
+    return mmu;
+}
+
+void mmu_free(mmu_t *mmu) {
+    munmap((void *)mmu->mem, GUEST_MEMORY_SIZE);
+    pthread_cond_destroy(&mmu->exit_cond);
+    pthread_mutex_destroy(&mmu->lock);
+    free(mmu->vmas);
+    free(mmu);
 }
 
 void mmu_load_elf(mmu_t *mmu, int fd) {
@@ -57,6 +102,7 @@ void mmu_load_elf(mmu_t *mmu, int fd) {
     }
 
     mmu->entry = (u64)ehdr->e_entry;
+    mmu->elf_start = (u64)-1;
 
     elf64_phdr_t phdr;
     for (int i = 0; i < ehdr->e_phnum; ++i) {
@@ -65,26 +111,449 @@ void mmu_load_elf(mmu_t *mmu, int fd) {
             mmu_load_segment(mmu, &phdr, fd);
         }
     }
+
+    if (mmu->base >= GUEST_MMAP_BASE) fatal("no room for the guest heap");
+    mmu->dirty = mmu->base;
 }
 
+/**
+ * the break moves inside the heap reservation without syscalls: memory is
+ * committed in chunks that grow with the heap, and only given back once
+ * HEAP_TRIM of it sits unused above the break. memory below the high-water
+ * mark is zeroed on reuse, as fresh brk memory would be.
+ */
 u64 mmu_alloc(mmu_t *mmu, i64 sz) {
     int page_size = getpagesize();
+    pthread_mutex_lock(&mmu->lock);
     u64 base = mmu->alloc;
     assert(base >= mmu->base);
 
     mmu->alloc += sz;
-    assert(mmu->alloc >= mmu->base);
-    if (sz > 0 && mmu->alloc > TO_GUEST(mmu->host_alloc)) {
-        if (mmap((void *)mmu->host_alloc, ROUNDUP(sz, page_size),
-                 PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0) == MAP_FAILED)
-            fatal("mmap failed");
-        mmu->host_alloc += ROUNDUP(sz, page_size);
-    } else if (sz < 0 && ROUNDUP(mmu->alloc, page_size) < TO_GUEST(mmu->host_alloc)) {
-        u64 len = TO_GUEST(mmu->host_alloc) - ROUNDUP(mmu->alloc, page_size);
-        if (munmap((void *)mmu->host_alloc, len) == -1)
-            fatal(strerror(errno));
-        mmu->host_alloc -= len;
+    assert(mmu->alloc >= mmu->base && mmu->alloc <= GUEST_MMAP_BASE);
+
+    u64 committed = TO_GUEST(mmu->mem, mmu->host_alloc);
+    u64 need = ROUNDUP(mmu->alloc, page_size);
+    if (sz > 0 && need > committed) {
+        u64 chunk = MIN(MAX(committed - mmu->base, HEAP_MIN_CHUNK), HEAP_MAX_CHUNK);
+        u64 end = MIN(MAX(need, committed + chunk), GUEST_MMAP_BASE);
+        if (mprotect((void *)TO_HOST(mmu->mem, committed), end - committed,
+                     PROT_READ | PROT_WRITE) == -1)
+            fatal("mprotect failed");
+        mmu->host_alloc = TO_HOST(mmu->mem, end);
+    } else if (sz < 0 && committed - need >= HEAP_TRIM) {
+        u64 end = need + HEAP_MIN_CHUNK;
+        if (!mmu_reserve(mmu, end, committed - end, MAP_FIXED)) fatal(strerror(errno));
+        mmu->host_alloc = TO_HOST(mmu->mem, end);
+        mmu->dirty = MIN(mmu->dirty, end);
+    }
+
+    /**
+     * large reused ranges are cheaper to drop than to clear. fresh pages
+     * rather than MADV_DONTNEED, which would bring back the contents of
+     * a snapshot image under the heap.
+     */
+    if (sz > 0 && base < mmu->dirty) {
+        u64 end = MIN(mmu->alloc, mmu->dirty);
+        if (end - base <= HEAP_ZERO_MAX) {
+            memset((void *)TO_HOST(mmu->mem, base), 0, end - base);
+        } else {
+            u64 page = ROUNDUP(base, page_size);
+            memset((void *)TO_HOST(mmu->mem, base), 0, page - base);
+            if (mmap((void *)TO_HOST(mmu->mem, page), ROUNDUP(end, page_size) - page,
+                     PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0) == MAP_FAILED)
+                fatal(strerror(errno));
+        }
     }
+    mmu->dirty = MAX(mmu->dirty, mmu->alloc);
 
+    pthread_mutex_unlock(&mmu->lock);
     return base;
 }
+
+static void vma_remove(mmu_t *mmu, u64 start, u64 end) {
+    /* one split, plus room for vma_insert */
+    u64 cap = mmu->num_vmas + 2;
+    vma_t *vmas = (vma_t *)calloc(cap, sizeof(vma_t));
+    u64 n = 0;
+    for (u64 i = 0; i < mmu->num_vmas; i++) {
+        vma_t *v = &mmu->vmas[i];
+        if (v->end <= start || v->start >= end) {
+            vmas[n++] = *v;
+            continue;
+        }
+        if (v->start < start) vmas[n++] = (vma_t){v->start, start};
+        if (v->end > end) vmas[n++] = (vma_t){end, v->end};
+    }
+    free(mmu->vmas);
+    mmu->vmas = vmas;
+    mmu->num_vmas = n;
+    mmu->cap_vmas = cap;
+}
+
+static void vma_insert(mmu_t *mmu, u64 start, u64 end) {
+    vma_remove(mmu, start, end);
+
+    u64 i = 0;
+    while (i < mmu->num_vmas && mmu->vmas[i].start < start) i++;
+
+    if (i > 0 && mmu->vmas[i - 1].end == start) {
+        mmu->vmas[i - 1].end = end;
+        if (i < mmu->num_vmas && mmu->vmas[i].start == end) {
+            mmu->vmas[i - 1].end = mmu->vmas[i].end;
+            memmove(&mmu->vmas[i], &mmu->vmas[i + 1], (mmu->num_vmas - i - 1) * sizeof(vma_t));
+            mmu->num_vmas--;
+        }
+        return;
+    }
+    if (i < mmu->num_vmas && mmu->vmas[i].start == end) {
+        mmu->vmas[i].start = start;
+        return;
+    }
+
+    assert(mmu->num_vmas < mmu->cap_vmas);
+    memmove(&mmu->vmas[i + 1], &mmu->vmas[i], (mmu->num_vmas - i) * sizeof(vma_t));
+    mmu->vmas[i] = (vma_t){start, end};
+    mmu->num_vmas++;
+}
+
+/* addr + len neither wraps nor leaves the guest window */
+static bool guest_range(u64 addr, u64 len) {
+    return addr + len >= addr && addr + len <= GUEST_MEMORY_SIZE;
+}
+
+/* only the reserved window is known to be ours to map over */
+static bool in_window(u64 start, u64 end) {
+    return start >= GUEST_MMAP_BASE && end <= GUEST_MMAP_TOP && end >= start;
+}
+
+static bool vma_free(mmu_t *mmu, u64 start, u64 end) {
+    if (!in_window(start, end)) return false;
+    for (u64 i = 0; i < mmu->num_vmas; i++) {
+        if (mmu->vmas[i].end > start && mmu->vmas[i].start < end) return false;
+    }
+    return true;
+}
+
+static bool vma_covers(mmu_t *mmu, u64 start, u64 end) {
+    for (u64 i = 0; i < mmu->num_vmas && start < end; i++) {
+        vma_t *v = &mmu->vmas[i];
+        if (v->end <= start) continue;
+        if (v->start > start) return false;
+        start = v->end;
+    }
+    return start >= end;
+}
+
+/* the elf and the heap up to the break count as mapped, as do the vmas */
+static bool guest_mapped(mmu_t *mmu, u64 start, u64 end) {
+    u64 brk = ROUNDUP(mmu->alloc, getpagesize());
+    if (start >= mmu->elf_start && start < brk) start = MIN(brk, end);
+    return vma_covers(mmu, start, end);
+}
+
+/* highest free gap in the window, like the kernel's top-down layout */
+static u64 vma_find_gap(mmu_t *mmu, u64 len) {
+    u64 top = GUEST_MMAP_TOP;
+    for (i64 i = mmu->num_vmas - 1; i >= 0; i--) {
+        vma_t *v = &mmu->vmas[i];
+        if (v->start >= top) continue;
+        u64 bottom = MAX(v->end, GUEST_MMAP_BASE);
+        if (top >= bottom + len) return top - len;
+        top = v->start;
+        if (top <= GUEST_MMAP_BASE) return 0;
+    }
+    return top >= GUEST_MMAP_BASE + len ? top - len : 0;
+}
+
+/* [start, end) was mapped over or away: any code decoded from it is stale */
+static void code_changed(mmu_t *mmu, u64 start, u64 end) {
+    decoded_t *d = &mmu->decoded;
+    if (start < __atomic_load_n(&d->hi, __ATOMIC_ACQUIRE) &&
+        end > __atomic_load_n(&d->lo, __ATOMIC_ACQUIRE))
+        __atomic_add_fetch(&d->gen, 1, __ATOMIC_RELEASE);
+}
+
+/* give the pages of any mappings in the range back to the reservation */
+static void vma_release(mmu_t *mmu, u64 start, u64 end) {
+    code_changed(mmu, start, end);
+    for (u64 i = 0; i < mmu->num_vmas; i++) {
+        u64 lo = MAX(mmu->vmas[i].start, start);
+        u64 hi = MIN(mmu->vmas[i].end, end);
+        if (lo < hi && !mmu_reserve(mmu, lo, hi - lo, MAP_FIXED)) fatal("mmap failed");
+    }
+    vma_remove(mmu, start, end);
+}
+
+/* guest code is fetched through ordinary host loads */
+static int guest_prot(int prot) {
+    return prot & PROT_EXEC ? prot | PROT_READ : prot;
+}
+
+#define GUEST_MAP_FLAGS (MAP_SHARED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_POPULATE)
+
+i64 mmu_map(mmu_t *mmu, u64 addr, u64 len, int prot, int flags, int fd, i64 off) {
+    int page_size = getpagesize();
+    if (len == 0 || (off & (page_size - 1)) || (addr & (page_size - 1))) return -EINVAL;
+    len = ROUNDUP(len, page_size);
+    if (len == 0 || len > GUEST_MEMORY_SIZE) return -ENOMEM;
+    if ((flags & (MAP_FIXED | MAP_FIXED_NOREPLACE)) && !in_window(addr, addr + len)) return -ENOMEM;
+
+    pthread_mutex_lock(&mmu->lock);
+    if (flags & MAP_FIXED_NOREPLACE) {
+        if (!vma_free(mmu, addr, addr + len)) {
+            pthread_mutex_unlock(&mmu->lock);
+            return -EEXIST;
+        }
+    } else if (!(flags & MAP_FIXED) && (addr == 0 || !vma_free(mmu, addr, addr + len))) {
+        addr = vma_find_gap(mmu, len);
+        if (addr == 0) {
+            pthread_mutex_unlock(&mmu->lock);
+            return -ENOMEM;
+        }
+    }
+
+    if (mmap((void *)TO_HOST(mmu->mem, addr), len, guest_prot(prot),
+             (flags & GUEST_MAP_FLAGS) | MAP_FIXED, flags & MAP_ANONYMOUS ? -1 : fd, off) == MAP_FAILED) {
+        pthread_mutex_unlock(&mmu->lock);
+        return -errno;
+    }
+    vma_insert(mmu, addr, addr + len);
+    code_changed(mmu, addr, addr + len);
+
+    pthread_mutex_unlock(&mmu->lock);
+    return addr;
+}
+
+i64 mmu_unmap(mmu_t *mmu, u64 addr, u64 len) {
+    int page_size = getpagesize();
+    if (len == 0 || (addr & (page_size - 1))) return -EINVAL;
+    len = ROUNDUP(len, page_size);
+    if (len == 0 || !guest_range(addr, len)) return -EINVAL;
+
+    pthread_mutex_lock(&mmu->lock);
+    vma_release(mmu, addr, addr + len);
+    pthread_mutex_unlock(&mmu->lock);
+    return 0;
+}
+
+/**
+ * the host mappings in the guest window, in guest addresses, read from
+ * /proc/self/maps. returns how many; the caller frees *out.
+ */
+u64 mmu_mappings(mmu_t *mmu, mapping_t **out) {
+    FILE *f = fopen("/proc/self/maps", "r");
+    if (f == NULL) fatal(strerror(errno));
+
+    mapping_t *maps = NULL;
+    u64 n = 0, cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    u64 top = mmu->mem + GUEST_MEMORY_SIZE;
+    while (getline(&line, &line_cap, f) != -1) {
+        u64 start, end, off, ino;
+        u32 major, minor;
+        char perms[5];
+        if (sscanf(line, "%lx-%lx %4s %lx %x:%x %lu",
+                   &start, &end, perms, &off, &major, &minor, &ino) != 7)
+            continue;
+        if (end <= mmu->mem || start >= top) continue;
+
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            maps = (mapping_t *)realloc(maps, cap * sizeof(mapping_t));
+        }
+        maps[n++] = (mapping_t){
+            .start = TO_GUEST(mmu->mem, MAX(start, mmu->mem)),
+            .end = TO_GUEST(mmu->mem, MIN(end, top)),
+            .prot = (perms[0] == 'r' ? PROT_READ : 0) |
+                    (perms[1] == 'w' ? PROT_WRITE : 0) |
+                    (perms[2] == 'x' ? PROT_EXEC : 0),
+            .shared = perms[3] == 's',
+            .dev = makedev(major, minor),
+            .ino = ino,
+        };
+    }
+    free(line);
+    fclose(f);
+    *out = maps;
+    return n;
+}
+
+/**
+ * pages restored from a snapshot are private mappings of the image, which
+ * MADV_DONTNEED or a grown mremap would fill from the image instead of
+ * with zeros. such parts of [start, end) get fresh anonymous pages.
+ */
+static void mmu_discard_image(mmu_t *mmu, u64 start, u64 end) {
+    if (mmu->image_ino == 0) return;
+
+    mapping_t *maps;
+    u64 n = mmu_mappings(mmu, &maps);
+    for (u64 i = 0; i < n; i++) {
+        u64 lo = MAX(maps[i].start, start);
+        u64 hi = MIN(maps[i].end, end);
+        if (lo >= hi || maps[i].dev != mmu->image_dev || maps[i].ino != mmu->image_ino) continue;
+        if (mmap((void *)TO_HOST(mmu->mem, lo), hi - lo, maps[i].prot,
+                 MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0) == MAP_FAILED)
+            fatal(strerror(errno));
+    }
+    free(maps);
+}
+
+/**
+ * mremap moves one host mapping at a time, and a guest range on a restored
+ * image may be several after mmu_discard_image. such a range is moved
+ * piece by piece, with any growth as fresh pages; false if not an image.
+ */
+static bool mmu_move_image(mmu_t *mmu, u64 old, u64 old_len, u64 new_addr, u64 new_len) {
+    if (mmu->image_ino == 0) return false;
+
+    mapping_t *maps;
+    u64 n = mmu_mappings(mmu, &maps);
+    int prot = PROT_NONE;
+    for (u64 i = 0; i < n; i++) {
+        u64 lo = MAX(maps[i].start, old);
+        u64 hi = MIN(maps[i].end, old + MIN(old_len, new_len));
+        if (lo >= hi) continue;
+        if (mremap((void *)TO_HOST(mmu->mem, lo), hi - lo, hi - lo, MREMAP_MAYMOVE | MREMAP_FIXED,
+                   (void *)TO_HOST(mmu->mem, new_addr + (lo - old))) == MAP_FAILED)
+            fatal(strerror(errno));
+        prot = maps[i].prot;
+    }
+    if (new_len > old_len &&
+        mmap((void *)TO_HOST(mmu->mem, new_addr + old_len), new_len - old_len, prot,
+             MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0) == MAP_FAILED)
+        fatal(strerror(errno));
+    free(maps);
+    return true;
+}
+
+i64 mmu_advise(mmu_t *mmu, u64 addr, u64 len, int advice) {
+    int page_size = getpagesize();
+    if ((addr & (page_size - 1)) || len > GUEST_MEMORY_SIZE) return -EINVAL;
+    len = ROUNDUP(len, page_size);
+    if (!guest_range(addr, len)) return -ENOMEM;
+    u64 end = addr + len;
+
+    pthread_mutex_lock(&mmu->lock);
+    i64 ret = 0;
+    if (!guest_mapped(mmu, addr, end)) {
+        ret = -ENOMEM;
+    } else if (madvise((void *)TO_HOST(mmu->mem, addr), len, advice) == -1) {
+        ret = -errno;
+    } else if (advice == MADV_DONTNEED || advice == MADV_FREE) {
+        mmu_discard_image(mmu, addr, end);
+    }
+    pthread_mutex_unlock(&mmu->lock);
+    return ret;
+}
+
+/**
+ * grows a private anonymous mapping, or one of the snapshot image, whose
+ * growth would be fresh pages anyway, in place: the tail is mapped with
+ * MAP_FIXED over the reservation, so the window never has a hole another
+ * host thread could map into. false for any other mapping.
+ */
+static bool mmu_grow_anon(mmu_t *mmu, u64 old, u64 old_len, u64 new_len) {
+    mapping_t *maps;
+    u64 n = mmu_mappings(mmu, &maps);
+    bool ok = false;
+    for (u64 i = 0; i < n; i++) {
+        mapping_t *map = &maps[i];
+        if (map->start >= old + old_len || map->end < old + old_len) continue;
+        ok = !map->shared &&
+             (map->ino == 0 || (map->dev == mmu->image_dev && map->ino == mmu->image_ino));
+        if (ok && mmap((void *)TO_HOST(mmu->mem, old + old_len), new_len - old_len, map->prot,
+                       MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0) == MAP_FAILED)
+            fatal(strerror(errno));
+        break;
+    }
+    free(maps);
+    return ok;
+}
+
+/**
+ * the host kernel moves the pages itself, so mremap never copies: growing
+ * in place maps fresh pages over the reservation, moving lands on a fresh
+ * gap with MREMAP_FIXED, which replaces the reservation there at once.
+ */
+i64 mmu_remap(mmu_t *mmu, u64 old, u64 old_len, u64 new_len, int flags, u64 new_addr) {
+    int page_size = getpagesize();
+    if ((old & (page_size - 1)) || new_len == 0 || old_len == 0) return -EINVAL;
+    if ((flags & MREMAP_FIXED) && !(flags & MREMAP_MAYMOVE)) return -EINVAL;
+    old_len = ROUNDUP(old_len, page_size);
+    new_len = ROUNDUP(new_len, page_size);
+    if (old_len == 0 || new_len == 0 || !guest_range(old, old_len) || new_len > GUEST_MEMORY_SIZE)
+        return -EINVAL;
+    if ((flags & MREMAP_FIXED) &&
+        ((new_addr & (page_size - 1)) || !in_window(new_addr, new_addr + new_len) ||
+         (new_addr < old + old_len && old < new_addr + new_len)))
+        return -EINVAL;
+
+    pthread_mutex_lock(&mmu->lock);
+    i64 ret = old;
+    if (!vma_covers(mmu, old, old + old_len)) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    if (!(flags & MREMAP_FIXED)) {
+        if (new_len <= old_len) {
+            vma_release(mmu, old + new_len, old + old_len);
+            goto out;
+        }
+
+        if (vma_free(mmu, old + old_len, old + new_len) && mmu_grow_anon(mmu, old, old_len, new_len)) {
+            vma_insert(mmu, old, old + new_len);
+            goto out;
+        }
+
+        if (!(flags & MREMAP_MAYMOVE)) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        new_addr = vma_find_gap(mmu, new_len);
+        if (new_addr == 0) {
+            ret = -ENOMEM;
+            goto out;
+        }
+    } else {
+        vma_release(mmu, new_addr, new_addr + new_len);
+    }
+
+    if (mremap((void *)TO_HOST(mmu->mem, old), old_len, new_len, MREMAP_MAYMOVE | MREMAP_FIXED,
+               (void *)TO_HOST(mmu->mem, new_addr)) == MAP_FAILED &&
+        !(errno == EFAULT && mmu_move_image(mmu, old, old_len, new_addr, new_len))) {
+        ret = -errno;
+        goto out;
+    }
+    if (!mmu_reserve(mmu, old, old_len, MAP_FIXED)) fatal("mmap failed");
+    code_changed(mmu, old, old + old_len);
+    vma_remove(mmu, old, old + old_len);
+    vma_insert(mmu, new_addr, new_addr + new_len);
+    if (new_len > old_len) mmu_discard_image(mmu, new_addr + old_len, new_addr + new_len);
+    ret = new_addr;
+
+out:
+    pthread_mutex_unlock(&mmu->lock);
+    return ret;
+}
+
+i64 mmu_protect(mmu_t *mmu, u64 addr, u64 len, int prot) {
+    int page_size = getpagesize();
+    if (addr & (page_size - 1)) return -EINVAL;
+    if (len > GUEST_MEMORY_SIZE) return -ENOMEM;
+    len = ROUNDUP(len, page_size);
+    if (!guest_range(addr, len)) return -ENOMEM;
+    u64 end = addr + len;
+
+    pthread_mutex_lock(&mmu->lock);
+    i64 ret = 0;
+    if (!guest_mapped(mmu, addr, end)) {
+        ret = -ENOMEM;
+    } else if (mprotect((void *)TO_HOST(mmu->mem, addr), len, guest_prot(prot)) == -1) {
+        ret = -errno;
+    }
+    pthread_mutex_unlock(&mmu->lock);
+    return ret;
+}
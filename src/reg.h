@@ -17,9 +17,18 @@ enum fp_reg_type_t {
     num_fp_regs,
 };
 
+enum v_reg_type_t {
+    v0, v1, v2, v3, v4, v5, v6, v7,
+    v8, v9, v10, v11, v12, v13, v14, v15,
+    v16, v17, v18, v19, v20, v21, v22, v23,
+    v24, v25, v26, v27, v28, v29, v30, v31,
+    num_v_regs,
+};
+
 typedef union {
     u64 v;
     u32 w;
     f64 d;
     f32 f;
+    u16 h;
 } fp_reg_t;
@@ -3,19 +3,33 @@
 int main(int argc, char *argv[]) {
     assert(argc > 1);
 
-    machine_t machine = {0};
-    machine.cache = new_cache();
-    machine_load_program(&machine, argv[1]);
-    machine_setup(&machine, argc, argv);
+    /* options go before any of the modes below */
+    for (; argc > 2; argc--, argv++) {
+        if (strcmp(argv[1], "--coalesce") == 0)      wbuf_enable();  /* see wbuf.c */
+        else if (strcmp(argv[1], "--io-uring") == 0) uring_enable(); /* see uring.c */
+        else break;
+    }
+
+    /* rvemu --server SOCKET prog [warm-up args...] */
+    if (argc > 3 && strcmp(argv[1], "--server") == 0)
+        return server_main(argv[2], argc - 3, argv + 3);
 
-    while(true) {
-        enum exit_reason_t reason = machine_step(&machine);
-        assert(reason == ecall);
+    /* rvemu --connect SOCKET [args...] */
+    if (argc > 2 && strcmp(argv[1], "--connect") == 0)
+        return server_connect(argv[2], argc - 3, argv + 3);
 
-        u64 syscall = machine_get_gp_reg(&machine, a7);
-        u64 ret = do_syscall(&machine, syscall);
-        machine_set_gp_reg(&machine, a0, ret);
+    machine_t *m;
+    if (argc > 3 && strcmp(argv[1], "--snapshot") == 0) {
+        /* rvemu --snapshot IMAGE prog [args...] */
+        m = rvemu_create(argc - 3, argv + 3);
+        m->snapshot = argv[2];
+    } else if (argc > 2 && strcmp(argv[1], "--restore") == 0) {
+        /* rvemu --restore IMAGE */
+        m = snapshot_restore(argv[2]);
+    } else {
+        m = rvemu_create(argc - 1, argv + 1);
     }
 
-    return 0;
+    /* guest threads still blocked somewhere go down with the process */
+    exit(rvemu_run(m));
 }
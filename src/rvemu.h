@@ -1,8 +1,11 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fenv.h>
 #include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -30,10 +33,22 @@
 #define ARRAY_SIZE(x)   (sizeof(x)/sizeof((x)[0]))
 
 
-#define GUEST_MEMORY_OFFSET 0x088800000000ULL
+/* each machine's guest window, reserved PROT_NONE so stray guest accesses fault in it (sv39) */
+#define GUEST_MEMORY_SIZE   (1ULL << 39)
 
-#define TO_HOST(addr)  (addr + GUEST_MEMORY_OFFSET)
-#define TO_GUEST(addr) (addr - GUEST_MEMORY_OFFSET)
+/* mem is the host address of guest address 0, see mmu_t. wild guest addresses wrap within the window */
+#define TO_HOST(mem, addr)  (((u64)(addr) & (GUEST_MEMORY_SIZE - 1)) + (mem))
+#define TO_GUEST(mem, addr) ((u64)(addr) - (mem))
+
+/* guest mmap() places mappings top-down in this window, brk grows below it */
+#define GUEST_MMAP_BASE 0x001000000000ULL
+#define GUEST_MMAP_TOP  0x003f00000000ULL
+
+/* the heap is reserved up to the mmap window and committed in chunks */
+#define HEAP_MIN_CHUNK  (1ULL << 20)
+#define HEAP_MAX_CHUNK  (64ULL << 20)
+#define HEAP_TRIM       (64ULL << 20)
+#define HEAP_ZERO_MAX   (256ULL << 10)
 
 enum insn_type_t {
     insn_lb, insn_lh, insn_lw, insn_ld, insn_lbu, insn_lhu, insn_lwu,
@@ -65,6 +80,64 @@ enum insn_type_t {
     insn_fcvt_w_d, insn_fcvt_wu_d, insn_fcvt_d_w, insn_fcvt_d_wu,
     insn_fcvt_l_d, insn_fcvt_lu_d,
     insn_fmv_x_d, insn_fcvt_d_l, insn_fcvt_d_lu, insn_fmv_d_x,
+    insn_vsetvli, insn_vsetivli, insn_vsetvl,
+    insn_vle8_v, insn_vle16_v, insn_vle32_v, insn_vle64_v,
+    insn_vse8_v, insn_vse16_v, insn_vse32_v, insn_vse64_v,
+    insn_vlse8_v, insn_vlse16_v, insn_vlse32_v, insn_vlse64_v,
+    insn_vsse8_v, insn_vsse16_v, insn_vsse32_v, insn_vsse64_v,
+    insn_vlm_v, insn_vsm_v, insn_vlr_v, insn_vsr_v,
+    insn_vadd_vv, insn_vadd_vx, insn_vadd_vi,
+    insn_vsub_vv, insn_vsub_vx, insn_vrsub_vx, insn_vrsub_vi,
+    insn_vminu_vv, insn_vminu_vx, insn_vmin_vv, insn_vmin_vx,
+    insn_vmaxu_vv, insn_vmaxu_vx, insn_vmax_vv, insn_vmax_vx,
+    insn_vand_vv, insn_vand_vx, insn_vand_vi,
+    insn_vor_vv, insn_vor_vx, insn_vor_vi,
+    insn_vxor_vv, insn_vxor_vx, insn_vxor_vi,
+    insn_vsll_vv, insn_vsll_vx, insn_vsll_vi,
+    insn_vsrl_vv, insn_vsrl_vx, insn_vsrl_vi,
+    insn_vsra_vv, insn_vsra_vx, insn_vsra_vi,
+    insn_vmerge_vv, insn_vmerge_vx, insn_vmerge_vi,
+    insn_vmseq_vv, insn_vmseq_vx, insn_vmseq_vi,
+    insn_vmsne_vv, insn_vmsne_vx, insn_vmsne_vi,
+    insn_vmsltu_vv, insn_vmsltu_vx, insn_vmslt_vv, insn_vmslt_vx,
+    insn_vmsleu_vv, insn_vmsleu_vx, insn_vmsleu_vi,
+    insn_vmsle_vv, insn_vmsle_vx, insn_vmsle_vi,
+    insn_vmsgtu_vx, insn_vmsgtu_vi, insn_vmsgt_vx, insn_vmsgt_vi,
+    insn_vmul_vv, insn_vmul_vx,
+    insn_vredsum_vs, insn_vmv_x_s, insn_vmv_s_x, insn_vid_v,
+    insn_vfadd_vv, insn_vfadd_vf, insn_vfsub_vv, insn_vfsub_vf,
+    insn_vfmul_vv, insn_vfmul_vf, insn_vfdiv_vv, insn_vfdiv_vf,
+    insn_vfmacc_vv, insn_vfmacc_vf,
+    insn_vfmerge_vf, insn_vfmv_f_s, insn_vfmv_s_f,
+    insn_add_uw, insn_sh1add, insn_sh2add, insn_sh3add,
+    insn_sh1add_uw, insn_sh2add_uw, insn_sh3add_uw, insn_slli_uw,
+    insn_andn, insn_orn, insn_xnor,
+    insn_clz, insn_clzw, insn_ctz, insn_ctzw, insn_cpop, insn_cpopw,
+    insn_max, insn_maxu, insn_min, insn_minu,
+    insn_sext_b, insn_sext_h, insn_zext_h,
+    insn_rol, insn_rolw, insn_ror, insn_rori, insn_roriw, insn_rorw,
+    insn_orc_b, insn_rev8,
+    insn_bclr, insn_bclri, insn_bext, insn_bexti,
+    insn_binv, insn_binvi, insn_bset, insn_bseti,
+    insn_pack, insn_packh, insn_packw, insn_brev8, insn_clmul, insn_clmulh,
+    insn_aes64es, insn_aes64esm, insn_aes64ds, insn_aes64dsm,
+    insn_aes64im, insn_aes64ks1i, insn_aes64ks2,
+    insn_sha256sig0, insn_sha256sig1, insn_sha256sum0, insn_sha256sum1,
+    insn_sha512sig0, insn_sha512sig1, insn_sha512sum0, insn_sha512sum1,
+    insn_flh, insn_fsh,
+    insn_fmadd_h, insn_fmsub_h, insn_fnmsub_h, insn_fnmadd_h,
+    insn_fadd_h, insn_fsub_h, insn_fmul_h, insn_fdiv_h, insn_fsqrt_h,
+    insn_fsgnj_h, insn_fsgnjn_h, insn_fsgnjx_h,
+    insn_fmin_h, insn_fmax_h,
+    insn_fcvt_s_h, insn_fcvt_h_s, insn_fcvt_d_h, insn_fcvt_h_d,
+    insn_feq_h, insn_flt_h, insn_fle_h, insn_fclass_h,
+    insn_fmv_x_h, insn_fmv_h_x,
+    insn_fcvt_w_h, insn_fcvt_wu_h, insn_fcvt_l_h, insn_fcvt_lu_h,
+    insn_fcvt_h_w, insn_fcvt_h_wu, insn_fcvt_h_l, insn_fcvt_h_lu,
+    insn_lr_w, insn_sc_w, insn_amoswap_w, insn_amoadd_w, insn_amoxor_w, insn_amoand_w,
+    insn_amoor_w, insn_amomin_w, insn_amomax_w, insn_amominu_w, insn_amomaxu_w,
+    insn_lr_d, insn_sc_d, insn_amoswap_d, insn_amoadd_d, insn_amoxor_d, insn_amoand_d,
+    insn_amoor_d, insn_amomin_d, insn_amomax_d, insn_amominu_d, insn_amomaxu_d,
     num_insns,
 };
 
@@ -75,11 +148,18 @@ typedef struct {
     i8 rs3;
     i32 imm;
     i16 csr;
+    u8 rm; /* static rounding mode of fp ops, RM_DYN to follow frm */
     enum insn_type_t type;
     bool rvc;
     bool cont;
+    bool vm;
+    bool aq;
+    bool rl;
 } insn_t;
 
+#define RM_RTZ 1
+#define RM_DYN 7
+
 /**
  * stack.c
  */
@@ -100,11 +180,6 @@ void stack_print(stack_t *);
 #define STR_MAX_PREALLOC (1024 * 1024)
 #define STRHDR(s) ((strhdr_t *)((s)-(sizeof(strhdr_t))))
 
-#define DECLEAR_STATIC_STR(name)   \
-    static str_t name = NULL;  \
-    if (name) str_clear(name); \
-    else name = str_new();     \
-
 typedef char * str_t;
 
 typedef struct {
@@ -122,6 +197,10 @@ inline size_t str_len(const str_t str) {
     return STRHDR(str)->len;
 }
 
+inline void str_free(str_t str) {
+    free(STRHDR(str));
+}
+
 void str_clear(str_t);
 
 str_t str_append(str_t, const char *);
@@ -130,17 +209,63 @@ str_t str_append(str_t, const char *);
  * mmu.c
 */
 typedef struct {
+    u64 start;
+    u64 end;
+} vma_t;
+
+/* a host mapping in the guest window, see mmu_mappings */
+typedef struct {
+    u64 start;
+    u64 end;
+    int prot;
+    bool shared;
+    u64 dev;
+    u64 ino;
+} mapping_t;
+
+/* the guest code interpreters have decoded, see icache_t in interp.c */
+typedef struct {
+    u64 gen; /* bumped whenever decoded code may have changed */
+    u64 lo;  /* all of it lies in [lo, hi) */
+    u64 hi;
+} decoded_t;
+
+typedef struct {
+    u64 mem;        /* host address of the guest window */
     u64 entry;
-    u64 host_alloc;
-    u64 alloc;
+    u64 host_alloc; /* end of the committed heap */
+    u64 alloc;      /* the guest break */
     u64 base;
+    u64 elf_start;  /* the lowest elf segment, with base the mapped range below the heap */
+    u64 dirty;      /* the heap above the break may be dirty up to here */
+    vma_t *vmas; /* sorted, disjoint guest mmap() ranges */
+    u64 num_vmas;
+    u64 cap_vmas;
+    pthread_mutex_t lock;
+    /* the guest threads sharing this address space, like the kernel's mm_users */
+    u64 nthreads;
+    struct machine_t *running; /* those in machine_run, linked by machine_t.next */
+    bool exited;    /* the whole guest is done, exit_code is final */
+    i32 exit_code;
+    pthread_cond_t exit_cond;
+    u64 image_dev;  /* the snapshot image restored pages map, see snapshot.c */
+    u64 image_ino;
+    decoded_t decoded;
 } mmu_t;
 
+mmu_t *new_mmu();
+void mmu_free(mmu_t *);
 void mmu_load_elf(mmu_t *, int);
 u64 mmu_alloc(mmu_t *, i64);
-
-inline void mmu_write(u64 addr, u8 *data, size_t len) {
-    memcpy((void *)TO_HOST(addr), (void *)data, len);
+i64 mmu_map(mmu_t *, u64, u64, int, int, int, i64);
+i64 mmu_unmap(mmu_t *, u64, u64);
+i64 mmu_remap(mmu_t *, u64, u64, u64, int, u64);
+i64 mmu_protect(mmu_t *, u64, u64, int);
+i64 mmu_advise(mmu_t *, u64, u64, int);
+u64 mmu_mappings(mmu_t *, mapping_t **);
+
+inline void mmu_write(mmu_t *mmu, u64 addr, u8 *data, size_t len) {
+    memcpy((void *)TO_HOST(mmu->mem, addr), (void *)data, len);
 }
 
 /**
@@ -149,22 +274,47 @@ inline void mmu_write(u64 addr, u8 *data, size_t len) {
 #define CACHE_ENTRY_SIZE (64 * 1024)
 #define CACHE_SIZE       (64 * 1024 * 1024)
 
+/* register values seen on entry while a block was still cold */
+typedef struct {
+    u64 samples;
+    u32 varying; /* one bit per register that did not keep its first value */
+    u64 value[num_gp_regs];
+} vprof_t;
+
 typedef struct {
     u64 pc;
     u64 hot;
     u64 offset;
+    bool compiled;
+    bool generic; /* specialization given up, see cache_deopt */
+    u32 deopts;
+    vprof_t *prof;
 } cache_item_t;
 
+/* where each translation starts in jitcode, in code order */
+typedef struct {
+    u64 offset;
+    u64 pc;
+} cache_block_t;
+
 typedef struct {
     u8 *jitcode;
     u64 offset;
+    pthread_mutex_t lock;
     cache_item_t table[CACHE_ENTRY_SIZE];
+    cache_block_t blocks[CACHE_ENTRY_SIZE];
+    u64 num_blocks;
 } cache_t;
 
 cache_t *new_cache();
+void cache_free(cache_t *);
 u8 *cache_lookup(cache_t *, u64);
-u8 *cache_add(cache_t *, u64, u8 *, size_t, u64);
-bool cache_hot(cache_t *, u64);
+u8 *cache_alloc(cache_t *, u64, u8 *, size_t, u64);
+void cache_add(cache_t *, u64, u8 *, size_t);
+bool cache_hot(cache_t *, u64, u64 *);
+vprof_t *cache_profile(cache_t *, u64);
+bool cache_deopt(cache_t *, u64);
+u64 cache_block_pc(cache_t *, u8 *);
 
 /**
  * state.c
@@ -175,20 +325,52 @@ enum exit_reason_t {
     indirect_branch,
     interp,
     ecall,
+    deopt,
 };
 
 enum csr_t {
     fflags = 0x001,
     frm    = 0x002,
     fcsr   = 0x003,
+    vstart = 0x008,
+    vxsat  = 0x009,
+    vxrm   = 0x00a,
+    vcsr   = 0x00f,
+    vl     = 0xc20,
+    vtype  = 0xc21,
+    vlenb  = 0xc22,
 };
 
-typedef struct {
-    enum exit_reason_t exit_reason;
+#define RESERVE_NONE ((u64)-1)
+
+#define VLEN  128
+#define VLENB (VLEN / 8)
+
+/* the interpreter redirects writes to x0 here, so x0 stays zero. */
+#define GP_SCRATCH num_gp_regs
+
+typedef struct icache_t icache_t;
+
+typedef struct state_t {
+    enum exit_reason_t exit_reason; /* interp handlers only, blocks return block_exit_t */
     u64 reenter_pc;
-    u64 gp_regs[num_gp_regs];
+    u64 gp_regs[num_gp_regs + 1];
     fp_reg_t fp_regs[num_fp_regs];
     u64 pc;
+    u64 vl;
+    u64 vtype;
+    u64 vstart;
+    u8 v_regs[num_v_regs * VLENB];
+    u64 reserve_addr; /* LR/SC reservation, RESERVE_NONE if unset */
+    u64 reserve_val;
+    icache_t *icache; /* per-thread decoded blocks, see interp.c */
+    cache_t *cache;   /* compiled blocks look up their successors here */
+    u8 *(*lookup)(cache_t *, u64);
+    u32 fcsr;         /* fflags accrue in the host fenv until read, see interp.c */
+    bool fenv_used;   /* frm was set to something other than rne */
+    u64 mem;          /* mmu_t.mem, the base register of every guest access */
+    decoded_t *decoded; /* &mmu_t.decoded */
+    void (*round)(struct state_t *, u32); /* fenv_round, for compiled blocks */
 } state_t;
 
 void state_print_regs(state_t *);
@@ -196,13 +378,39 @@ void state_print_regs(state_t *);
 /**
  * machine.c
 */
-typedef struct {
+typedef struct machine_t {
     state_t state;
-    mmu_t mmu;
+    mmu_t *mmu;
     cache_t *cache;
+    u64 clear_child_tid;
+    bool exited;      /* this thread has called exit */
+    sigjmp_buf fault; /* where a guest memory fault, or a kick, unwinds to */
+    u64 fault_addr;   /* the guest address and pc of that fault, see guest_fault */
+    u64 fault_pc;
+    bool fault_block; /* fault_pc is the entry of the compiled block that faulted */
+    pthread_t thread; /* the host thread running it, while on mmu_t.running */
+    struct machine_t *next;
+    char *snapshot;   /* image to save at the first read from stdin, see snapshot.c */
 } machine_t;
 
-typedef void (*exec_block_func_t)(state_t *);
+/* returned in registers by every block: where to go next, and why. */
+typedef struct {
+    u64 pc;
+    enum exit_reason_t reason;
+} block_exit_t;
+
+typedef block_exit_t (*exec_block_func_t)(state_t *);
+
+/**
+ * compiled blocks also take these guest registers as arguments and pass
+ * them on when they tail-call the next block, so the values stay in host
+ * registers across blocks. state plus five fills the integer argument
+ * registers of the x86-64 SysV ABI.
+*/
+#define NUM_HOT_REGS 5
+extern const i32 hot_regs[NUM_HOT_REGS];
+
+typedef block_exit_t (*jit_block_func_t)(state_t *, u64, u64, u64, u64, u64);
 
 inline u64 machine_get_gp_reg(machine_t *m, i32 reg) {
     assert(reg >= 0 && reg < num_gp_regs);
@@ -218,12 +426,78 @@ void machine_setup(machine_t *, int, char **);
 str_t machine_genblock(machine_t *);
 u8 *machine_compile(machine_t *, str_t);
 enum exit_reason_t machine_step(machine_t *);
+void machine_run(machine_t *);
+void machine_exit(machine_t *, bool, i32);
+void machine_wait_threads(mmu_t *);
 void machine_load_program(machine_t *, char*);
 
+/**
+ * embedding: each machine owns its guest memory and code cache, so any
+ * number of them can run in one process, one host thread per running guest.
+ * argv[0] is the guest program. rvemu_run returns the guest's exit status.
+ */
+machine_t *rvemu_create(int argc, char *argv[]);
+int rvemu_run(machine_t *);
+void rvemu_destroy(machine_t *);
+
+/**
+ * snapshot.c
+*/
+void snapshot_save(machine_t *, const char *);
+machine_t *snapshot_restore(const char *);
+
+/**
+ * lock.c
+ *
+ * a mutex that a guest fault may unwind out of: the code that runs after
+ * the fault calls lock_drop, which releases the lock if this thread holds it.
+*/
+typedef struct {
+    pthread_mutex_t mutex;
+    void *owner;
+} lock_t;
+
+#define LOCK_INITIALIZER { .mutex = PTHREAD_MUTEX_INITIALIZER }
+
+void lock_acquire(lock_t *);
+void lock_release(lock_t *);
+void lock_drop(lock_t *);
+void lock_reset(lock_t *);
+
+/**
+ * wbuf.c
+*/
+void wbuf_enable(void);
+bool wbuf_write(int, const void *, u64, i64 *);
+void wbuf_sync(int);
+void wbuf_before_read(int);
+void wbuf_forget(int);
+void wbuf_flush_all(void);
+
+/**
+ * uring.c
+*/
+void uring_enable(void);
+bool uring_read(int, void *, u64, i64 *);
+void uring_sync(int);
+void uring_forget(int);
+void uring_sync_all(void);
+
+/**
+ * server.c
+*/
+int server_main(const char *, int, char **);
+int server_connect(const char *, int, char **);
+
 /**
  * interp.c
 */
-void exec_block_interp(state_t *);
+block_exit_t exec_block_interp(state_t *);
+void icache_free(icache_t *);
+void fenv_sync(state_t *);
+void fenv_load(state_t *);
+void fenv_round(state_t *, u32);
+bool rd_is_gp(enum insn_type_t);
 
 /**
  * set.c
@@ -0,0 +1,170 @@
+/* signal.h has a stack_t of its own, keep it out of the way of ours */
+#define stack_t host_stack_t
+#include <signal.h>
+#undef stack_t
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "rvemu.h"
+
+/**
+ * fork-server: the program is loaded once and warmed up with one run, then
+ * every request on a unix socket is served by a fork of the loaded (but not
+ * yet started) machine, which inherits the compiled code copy-on-write.
+ *
+ * a request is a single SOCK_SEQPACKET message carrying the guest's
+ * arguments after argv[0] as NUL-terminated strings, with the client's
+ * stdin, stdout and stderr attached as SCM_RIGHTS. the reply is the guest's
+ * exit status, an int.
+ */
+
+#define REQUEST_MAX (64 * 1024)
+#define REQUEST_FDS 3
+
+static int unix_socket(const char *path, struct sockaddr_un *addr) {
+    if (strlen(path) >= sizeof(addr->sun_path)) fatal("socket path too long");
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd == -1) fatal(strerror(errno));
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return fd;
+}
+
+/* a machine with the program loaded, sharing cache; setup is left to the caller */
+static machine_t *server_load(cache_t *cache, char *prog) {
+    machine_t *m = (machine_t *)calloc(1, sizeof(machine_t));
+    m->mmu = new_mmu();
+    m->cache = cache;
+    machine_load_program(m, prog);
+    return m;
+}
+
+static void server_serve(machine_t *m, char *prog, int conn) {
+    static char buf[REQUEST_MAX];
+    static char *argv[REQUEST_MAX / 2 + 1];
+    char control[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) - 1 };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+
+    ssize_t len = recvmsg(conn, &msg, 0);
+    if (len < 0) _exit(1);
+    buf[len] = '\0';
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(REQUEST_FDS * sizeof(int)))
+        _exit(1);
+
+    int fds[REQUEST_FDS];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    for (int i = 0; i < REQUEST_FDS; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+        wbuf_forget(i);
+        uring_forget(i);
+    }
+
+    int argc = 0;
+    argv[argc++] = prog;
+    for (char *p = buf; p < buf + len; p += strlen(p) + 1) argv[argc++] = p;
+
+    machine_setup(m, argc, argv);
+    int status = rvemu_run(m);
+
+    fflush(stdout);
+    (void) send(conn, &status, sizeof(status), 0);
+    _exit(status);
+}
+
+/* argv[0] is the guest program, argv the warm-up run */
+int server_main(const char *path, int argc, char *argv[]) {
+    cache_t *cache = new_cache();
+
+    machine_t *warm = server_load(cache, argv[0]);
+    machine_setup(warm, argc, argv);
+    rvemu_run(warm);
+    fflush(stdout);
+
+    /* none of its threads may be left to use its memory, or hold a lock across fork */
+    machine_wait_threads(warm->mmu);
+
+    /* the warm-up guest's memory goes, its code stays in the cache */
+    icache_free(warm->state.icache);
+    mmu_free(warm->mmu);
+    free(warm);
+
+    machine_t *m = server_load(cache, argv[0]);
+
+    struct sockaddr_un addr;
+    int sock = unix_socket(path, &addr);
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(sock, 64) == -1)
+        fatal(strerror(errno));
+
+    /* children are never waited for, the client gets the status */
+    signal(SIGCHLD, SIG_IGN);
+
+    while (true) {
+        int conn = accept(sock, NULL, NULL);
+        if (conn == -1) {
+            if (errno == EINTR) continue;
+            fatal(strerror(errno));
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(sock);
+            server_serve(m, argv[0], conn);
+        }
+        if (pid == -1) fprintf(stderr, "rvemu: fork failed: %s\n", strerror(errno));
+        close(conn);
+    }
+}
+
+/* sends the guest arguments and our stdio to the server, returns the guest's exit status */
+int server_connect(const char *path, int argc, char *argv[]) {
+    struct sockaddr_un addr;
+    int sock = unix_socket(path, &addr);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) fatal(strerror(errno));
+
+    static char buf[REQUEST_MAX];
+    size_t len = 0;
+    for (int i = 0; i < argc; i++) {
+        size_t n = strlen(argv[i]) + 1;
+        if (len + n > sizeof(buf)) fatal("arguments too long");
+        memcpy(buf + len, argv[i], n);
+        len += n;
+    }
+
+    int fds[REQUEST_FDS] = { 0, 1, 2 };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(sock, &msg, 0) == -1) fatal(strerror(errno));
+
+    int status;
+    if (recv(sock, &status, sizeof(status), 0) != sizeof(status)) fatal("server went away");
+    close(sock);
+    return status;
+}
@@ -0,0 +1,266 @@
+#include "rvemu.h"
+
+/**
+ * a snapshot image is the machine at its first read from stdin, when an
+ * interpreter has loaded its libraries and waits for input:
+ *
+ *   header (state, mmu, counts) | vmas | segments | cache_t | profiles
+ *   | jitcode, page aligned | guest pages, page aligned per segment
+ *
+ * the ecall of that read is saved unexecuted, so a restored machine starts
+ * by doing the read itself. guest pages go in at their place in the
+ * segment. pages that are all zeros, and anonymous pages never touched
+ * (neither present nor swapped out, per /proc/self/pagemap), are not
+ * written at all, and stay a hole in the file. mappings the guest cannot
+ * read are saved too, and restored with their protection. restoring maps the
+ * jitcode and every segment MAP_PRIVATE from the image, so pages are only
+ * read in when the guest touches them. jitcode only addresses itself
+ * relative to rip and guest memory through state->mem, so neither cares
+ * where it lands. only the standard fds carry over.
+ */
+
+#define SNAPSHOT_MAGIC 0x474d49554d455652ULL /* "RVEMUIMG" */
+
+typedef struct {
+    u64 magic;
+    state_t state;
+    mmu_t mmu;
+    u64 clear_child_tid;
+    u64 num_segs;
+    u64 num_profs;
+    u64 jit_offset;
+} snapshot_hdr_t;
+
+typedef struct {
+    u64 addr;
+    u64 len;
+    int prot;
+    u64 offset;
+} snapshot_seg_t;
+
+typedef struct {
+    u64 index;
+    vprof_t prof;
+} snapshot_prof_t;
+
+static u64 put(int fd, u64 off, const void *buf, u64 len) {
+    for (u64 done = 0; done < len; ) {
+        ssize_t n = pwrite(fd, (const u8 *)buf + done, len - done, off + done);
+        if (n == -1) fatal(strerror(errno));
+        done += n;
+    }
+    return off + len;
+}
+
+static bool page_zero(const u64 *page, u64 page_size) {
+    for (u64 i = 0; i < page_size / sizeof(u64); i++) {
+        if (page[i] != 0) return false;
+    }
+    return true;
+}
+
+#define PAGEMAP_SWAPPED (1ULL << 62)
+#define PAGEMAP_PRESENT (1ULL << 63)
+
+/* anonymous pages never touched read as zero anyway, file pages do not */
+static u64 put_segment(int fd, int pagemap, mmu_t *mmu, mapping_t *map, u64 off) {
+    u64 page_size = getpagesize();
+    u64 pages = (map->end - map->start) / page_size;
+    u8 *host = (u8 *)TO_HOST(mmu->mem, map->start);
+
+    u64 *entries = NULL;
+    if (map->ino == 0) {
+        entries = (u64 *)calloc(pages, sizeof(u64));
+        if (pread(pagemap, entries, pages * sizeof(u64), (u64)host / page_size * sizeof(u64)) !=
+            (ssize_t)(pages * sizeof(u64)))
+            fatal("cannot read /proc/self/pagemap");
+    }
+
+    bool readable = map->prot & PROT_READ;
+    if (!readable && mprotect(host, pages * page_size, PROT_READ) == -1) fatal(strerror(errno));
+    for (u64 i = 0; i < pages; i++) {
+        u8 *page = host + i * page_size;
+        if (entries != NULL && !(entries[i] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED))) continue;
+        if (page_zero((u64 *)page, page_size)) continue;
+        put(fd, off + i * page_size, page, page_size);
+    }
+    if (!readable && mprotect(host, pages * page_size, map->prot) == -1) fatal(strerror(errno));
+
+    free(entries);
+    return off + pages * page_size;
+}
+
+/**
+ * the guest's mappings among the host's. the window is a PROT_NONE
+ * reservation, so what the guest cannot read is only its own inside the
+ * elf and heap, or a vma.
+ */
+static u64 guest_segments(mmu_t *mmu, mapping_t *maps, u64 num_maps, mapping_t **out) {
+    mapping_t *segs = (mapping_t *)calloc(num_maps * (mmu->num_vmas + 1), sizeof(mapping_t));
+    vma_t heap = { mmu->elf_start, TO_GUEST(mmu->mem, mmu->host_alloc) };
+    u64 n = 0;
+    for (u64 i = 0; i < num_maps; i++) {
+        if (maps[i].prot & PROT_READ) {
+            segs[n++] = maps[i];
+            continue;
+        }
+        for (u64 j = 0; j <= mmu->num_vmas; j++) {
+            vma_t *v = j == 0 ? &heap : &mmu->vmas[j - 1];
+            u64 lo = MAX(maps[i].start, v->start);
+            u64 hi = MIN(maps[i].end, v->end);
+            if (lo >= hi) continue;
+            segs[n] = maps[i];
+            segs[n].start = lo;
+            segs[n++].end = hi;
+        }
+    }
+    *out = segs;
+    return n;
+}
+
+void snapshot_save(machine_t *m, const char *path) {
+    if (__atomic_load_n(&m->mmu->nthreads, __ATOMIC_ACQUIRE) > 1)
+        fatal("cannot snapshot a guest with more than one thread");
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) fatal(strerror(errno));
+
+    u64 page_size = getpagesize();
+    cache_t *cache = m->cache;
+    fenv_sync(&m->state);
+
+    mapping_t *all, *maps;
+    u64 num_maps = mmu_mappings(m->mmu, &all);
+    u64 num_segs = guest_segments(m->mmu, all, num_maps, &maps);
+    free(all);
+
+    int pagemap = open("/proc/self/pagemap", O_RDONLY);
+    if (pagemap == -1) fatal(strerror(errno));
+
+    u64 num_profs = 0;
+    for (u64 i = 0; i < CACHE_ENTRY_SIZE; i++) {
+        if (cache->table[i].prof != NULL) num_profs++;
+    }
+
+    snapshot_hdr_t hdr = {
+        .magic = SNAPSHOT_MAGIC,
+        .state = m->state,
+        .mmu = *m->mmu,
+        .clear_child_tid = m->clear_child_tid,
+        .num_segs = num_segs,
+        .num_profs = num_profs,
+    };
+    /* back on the ecall, which is 4 bytes as there is no c.ecall */
+    hdr.state.pc -= 4;
+
+    u64 off = sizeof(hdr);
+    off = put(fd, off, m->mmu->vmas, m->mmu->num_vmas * sizeof(vma_t));
+
+    u64 segs_off = off;
+    off += num_segs * sizeof(snapshot_seg_t);
+
+    off = put(fd, off, cache, sizeof(cache_t));
+    for (u64 i = 0; i < CACHE_ENTRY_SIZE; i++) {
+        if (cache->table[i].prof == NULL) continue;
+        snapshot_prof_t prof = { .index = i, .prof = *cache->table[i].prof };
+        off = put(fd, off, &prof, sizeof(prof));
+    }
+
+    hdr.jit_offset = ROUNDUP(off, page_size);
+    off = ROUNDUP(put(fd, hdr.jit_offset, cache->jitcode, cache->offset), page_size);
+
+    for (u64 i = 0; i < num_segs; i++) {
+        snapshot_seg_t seg = {
+            .addr = maps[i].start,
+            .len = maps[i].end - maps[i].start,
+            .prot = maps[i].prot,
+            .offset = off,
+        };
+        put(fd, segs_off + i * sizeof(seg), &seg, sizeof(seg));
+        off = put_segment(fd, pagemap, m->mmu, &maps[i], off);
+    }
+    close(pagemap);
+
+    put(fd, 0, &hdr, sizeof(hdr));
+    if (ftruncate(fd, off) == -1) fatal(strerror(errno));
+    close(fd);
+    free(maps);
+}
+
+machine_t *snapshot_restore(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) fatal(strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) fatal(strerror(errno));
+    if ((u64)st.st_size < sizeof(snapshot_hdr_t)) fatal("not a snapshot image");
+
+    u8 *img = (u8 *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (img == MAP_FAILED) fatal(strerror(errno));
+    snapshot_hdr_t *hdr = (snapshot_hdr_t *)img;
+    if (hdr->magic != SNAPSHOT_MAGIC) fatal("not a snapshot image");
+
+    u64 page_size = getpagesize();
+    machine_t *m = (machine_t *)calloc(1, sizeof(machine_t));
+    m->mmu = new_mmu();
+    m->cache = new_cache();
+    m->clear_child_tid = hdr->clear_child_tid;
+
+    mmu_t *mmu = m->mmu;
+    mmu->entry = hdr->mmu.entry;
+    mmu->host_alloc = TO_HOST(mmu->mem, TO_GUEST(hdr->mmu.mem, hdr->mmu.host_alloc));
+    mmu->alloc = hdr->mmu.alloc;
+    mmu->base = hdr->mmu.base;
+    mmu->elf_start = hdr->mmu.elf_start;
+    mmu->dirty = hdr->mmu.dirty;
+    mmu->num_vmas = hdr->mmu.num_vmas;
+    mmu->cap_vmas = hdr->mmu.num_vmas;
+    mmu->vmas = (vma_t *)calloc(mmu->cap_vmas, sizeof(vma_t));
+    mmu->image_dev = st.st_dev;
+    mmu->image_ino = st.st_ino;
+
+    u8 *p = img + sizeof(snapshot_hdr_t);
+    memcpy(mmu->vmas, p, mmu->num_vmas * sizeof(vma_t));
+    p += mmu->num_vmas * sizeof(vma_t);
+
+    snapshot_seg_t *segs = (snapshot_seg_t *)p;
+    p += hdr->num_segs * sizeof(snapshot_seg_t);
+
+    cache_t *cache = m->cache, *saved = (cache_t *)p;
+    cache->offset = saved->offset;
+    memcpy(cache->table, saved->table, sizeof(cache->table));
+    memcpy(cache->blocks, saved->blocks, sizeof(cache->blocks));
+    cache->num_blocks = saved->num_blocks;
+    p += sizeof(cache_t);
+
+    for (u64 i = 0; i < CACHE_ENTRY_SIZE; i++) cache->table[i].prof = NULL;
+    for (u64 i = 0; i < hdr->num_profs; i++, p += sizeof(snapshot_prof_t)) {
+        snapshot_prof_t *prof = (snapshot_prof_t *)p;
+        cache->table[prof->index].prof = (vprof_t *)malloc(sizeof(vprof_t));
+        *cache->table[prof->index].prof = prof->prof;
+    }
+
+    if (cache->offset > 0 &&
+        mmap(cache->jitcode, ROUNDUP(cache->offset, page_size), PROT_READ | PROT_WRITE | PROT_EXEC,
+             MAP_PRIVATE | MAP_FIXED, fd, hdr->jit_offset) == MAP_FAILED)
+        fatal(strerror(errno));
+
+    for (u64 i = 0; i < hdr->num_segs; i++) {
+        if (mmap((void *)TO_HOST(mmu->mem, segs[i].addr), segs[i].len, segs[i].prot,
+                 MAP_PRIVATE | MAP_FIXED, fd, segs[i].offset) == MAP_FAILED)
+            fatal(strerror(errno));
+    }
+
+    m->state = hdr->state;
+    m->state.icache = NULL;
+    m->state.cache = m->cache;
+    m->state.lookup = cache_lookup;
+    m->state.round = fenv_round;
+    m->state.mem = mmu->mem;
+    m->state.decoded = &mmu->decoded;
+    fenv_load(&m->state);
+
+    munmap(img, st.st_size);
+    close(fd);
+    return m;
+}
@@ -1,3 +1,8 @@
+#include <asm/unistd.h>
+#include <linux/futex.h>
+#include <semaphore.h>
+#include <sys/uio.h>
+
 #include "rvemu.h"
 
 // Copied from https://github.com/riscv-software-src/riscv-pk
@@ -21,6 +26,7 @@
 #define SYS_fstat 80
 #define SYS_fstatat 79
 #define SYS_faccessat 48
+#define SYS_fsync 82
 #define SYS_pread 67
 #define SYS_pwrite 68
 #define SYS_uname 160
@@ -37,6 +43,7 @@
 #define SYS_prlimit64 261
 #define SYS_getmainvars 2011
 #define SYS_rt_sigaction 134
+#define SYS_readv 65
 #define SYS_writev 66
 #define SYS_gettimeofday 169
 #define SYS_times 153
@@ -56,6 +63,9 @@
 #define SYS_set_robust_list 99
 #define SYS_madvise 233
 #define SYS_statx 291
+#define SYS_futex 98
+#define SYS_sched_yield 124
+#define SYS_clone 220
 
 #define OLD_SYSCALL_THRESHOLD 1024
 #define SYS_open 1024
@@ -77,42 +87,278 @@ static u64 sys_unimplemented(machine_t *m) {
 
 static u64 sys_exit(machine_t *m) {
     GET(a0, code);
-    exit(code);
+
+    if (m->clear_child_tid != 0) {
+        // guest libcs wait on the tid with either a shared or a private
+        // futex, and the host keys those differently, so wake both.
+        u32 *tid = (u32 *)TO_HOST(m->mmu->mem, m->clear_child_tid);
+        __atomic_store_n(tid, 0, __ATOMIC_RELEASE);
+        syscall(__NR_futex, tid, FUTEX_WAKE, 1, NULL, NULL, 0);
+        syscall(__NR_futex, tid, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+    machine_exit(m, false, code);
+    return 0;
+}
+
+static u64 sys_exit_group(machine_t *m) {
+    GET(a0, code);
+    machine_exit(m, true, code);
+    return 0;
+}
+
+static u64 sys_gettid(machine_t *m) {
+    return syscall(__NR_gettid);
+}
+
+static u64 sys_getpid(machine_t *m) {
+    return getpid();
+}
+
+static u64 sys_set_tid_address(machine_t *m) {
+    GET(a0, tidptr);
+    m->clear_child_tid = tidptr;
+    return syscall(__NR_gettid);
+}
+
+static u64 sys_set_robust_list(machine_t *m) {
+    // robust futexes are not cleaned up on thread death, accept and ignore.
+    return 0;
+}
+
+static u64 sys_sched_yield(machine_t *m) {
+    return sched_yield();
+}
+
+static u64 sys_futex(machine_t *m) {
+    GET(a0, uaddr); GET(a1, op); GET(a2, val); GET(a3, timeout); GET(a4, uaddr2); GET(a5, val3);
+
+    // the guest address space is host memory at an offset, so futex words
+    // can be handed to the host kernel directly; a timeout is a timespec
+    // for WAIT ops and a plain count (val2) for the requeue ops.
+    long ret;
+    switch (op & FUTEX_CMD_MASK) {
+    case FUTEX_WAIT:
+    case FUTEX_WAIT_BITSET:
+        ret = syscall(__NR_futex, TO_HOST(m->mmu->mem, uaddr), op, val,
+                      timeout ? (void *)TO_HOST(m->mmu->mem, timeout) : NULL, NULL, val3);
+        break;
+    case FUTEX_WAKE:
+    case FUTEX_WAKE_BITSET:
+        ret = syscall(__NR_futex, TO_HOST(m->mmu->mem, uaddr), op, val, NULL, NULL, val3);
+        break;
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE:
+        ret = syscall(__NR_futex, TO_HOST(m->mmu->mem, uaddr), op, val, timeout,
+                      TO_HOST(m->mmu->mem, uaddr2), val3);
+        break;
+    default:
+        fatalf("unsupported futex op: %lu", op);
+    }
+    return ret == -1 ? -errno : ret;
+}
+
+// linux clone flags, the guest ABI matches the generic kernel values.
+#define GUEST_CLONE_VM             0x00000100
+#define GUEST_CLONE_THREAD         0x00010000
+#define GUEST_CLONE_SETTLS         0x00080000
+#define GUEST_CLONE_PARENT_SETTID  0x00100000
+#define GUEST_CLONE_CHILD_CLEARTID 0x00200000
+#define GUEST_CLONE_CHILD_SETTID   0x01000000
+
+typedef struct {
+    machine_t *m;
+    u64 flags;
+    u64 ptid;
+    u64 ctid;
+    u64 tid;
+    sem_t ready;
+} clone_args_t;
+
+static void *clone_start(void *arg) {
+    clone_args_t *args = (clone_args_t *)arg;
+    machine_t *m = args->m;
+    u64 tid = syscall(__NR_gettid);
+
+    if (args->flags & GUEST_CLONE_PARENT_SETTID)
+        *(u32 *)TO_HOST(m->mmu->mem, args->ptid) = tid;
+    if (args->flags & GUEST_CLONE_CHILD_SETTID)
+        *(u32 *)TO_HOST(m->mmu->mem, args->ctid) = tid;
+    if (args->flags & GUEST_CLONE_CHILD_CLEARTID)
+        m->clear_child_tid = args->ctid;
+
+    args->tid = tid;
+    sem_post(&args->ready);
+
+    fenv_load(&m->state);
+    machine_run(m);
+    icache_free(m->state.icache);
+    free(m);
+    return NULL;
+}
+
+/**
+ * each guest thread runs on its own host thread with a private state_t;
+ * guest memory and the code cache are shared with the parent.
+ */
+static u64 sys_clone(machine_t *m) {
+    GET(a0, flags); GET(a1, stack); GET(a2, ptid); GET(a3, tls); GET(a4, ctid);
+
+    if (!(flags & GUEST_CLONE_VM) || !(flags & GUEST_CLONE_THREAD))
+        fatalf("unsupported clone flags: %lx", flags);
+
+    /* the child starts with the flags accrued so far, and its own host fenv */
+    fenv_sync(&m->state);
+    machine_t *child = (machine_t *)calloc(1, sizeof(machine_t));
+    child->state = m->state;
+    child->mmu = m->mmu;
+    child->cache = m->cache;
+    child->state.reserve_addr = RESERVE_NONE;
+    child->state.icache = NULL;
+    child->state.gp_regs[a0] = 0;
+    if (stack != 0) child->state.gp_regs[sp] = stack;
+    if (flags & GUEST_CLONE_SETTLS) child->state.gp_regs[tp] = tls;
+
+    clone_args_t args = {
+        .m = child,
+        .flags = flags,
+        .ptid = ptid,
+        .ctid = ctid,
+    };
+    sem_init(&args.ready, 0, 0);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    __atomic_add_fetch(&m->mmu->nthreads, 1, __ATOMIC_ACQ_REL);
+    if (pthread_create(&thread, &attr, clone_start, &args) != 0) {
+        __atomic_sub_fetch(&m->mmu->nthreads, 1, __ATOMIC_ACQ_REL);
+        free(child);
+        return -EAGAIN;
+    }
+    pthread_attr_destroy(&attr);
+
+    sem_wait(&args.ready);
+    sem_destroy(&args.ready);
+    return args.tid;
 }
 
 static u64 sys_close(machine_t *m) {
     GET(a0, fd);
+    wbuf_forget(fd);
+    uring_forget(fd);
     if (fd > 2) return close(fd);
     return 0;
 }
 
 static u64 sys_write(machine_t *m) {
     GET(a0, fd); GET(a1, ptr); GET(a2, len);
-    return write(fd, (void *)TO_HOST(ptr), (size_t)len);
+    i64 ret;
+    uring_sync(fd);
+    if (wbuf_write(fd, (void *)TO_HOST(m->mmu->mem, ptr), len, &ret)) return ret;
+    ret = write(fd, (void *)TO_HOST(m->mmu->mem, ptr), (size_t)len);
+    return ret == -1 ? -errno : ret;
+}
+
+/**
+ * a guest iovec has the host's layout, so only the bases need moving into
+ * guest memory; the data itself is never copied. returns the host iovecs,
+ * for the caller to free, or NULL past UIO_MAXIOV, where the kernel
+ * returns -EINVAL.
+ */
+static struct iovec *iov_to_host(machine_t *m, u64 iovptr, u64 iovcnt) {
+    if (iovcnt > UIO_MAXIOV) return NULL;
+
+    struct iovec *iov = (struct iovec *)malloc(MAX(iovcnt, 1) * sizeof(struct iovec));
+    struct iovec *guest = (struct iovec *)TO_HOST(m->mmu->mem, iovptr);
+    for (u64 i = 0; i < iovcnt; i++) {
+        iov[i].iov_base = (void *)TO_HOST(m->mmu->mem, (u64)guest[i].iov_base);
+        iov[i].iov_len = guest[i].iov_len;
+    }
+    return iov;
+}
+
+static u64 sys_writev(machine_t *m) {
+    GET(a0, fd); GET(a1, iovptr); GET(a2, iovcnt);
+    struct iovec *iov = iov_to_host(m, iovptr, iovcnt);
+    if (iov == NULL) return -EINVAL;
+    wbuf_sync(fd);
+    uring_sync(fd);
+    ssize_t ret = writev(fd, iov, iovcnt);
+    free(iov);
+    return ret == -1 ? -errno : ret;
+}
+
+static u64 sys_pwrite(machine_t *m) {
+    GET(a0, fd); GET(a1, ptr); GET(a2, len); GET(a3, offset);
+    wbuf_sync(fd);
+    uring_sync(fd);
+    ssize_t ret = pwrite(fd, (void *)TO_HOST(m->mmu->mem, ptr), (size_t)len, (off_t)offset);
+    return ret == -1 ? -errno : ret;
+}
+
+static u64 sys_fsync(machine_t *m) {
+    GET(a0, fd);
+    wbuf_sync(fd);
+    return fsync(fd) == -1 ? -errno : 0;
 }
 
 static u64 sys_fstat(machine_t *m) {
     GET(a0, fd); GET(a1, addr);
-    return fstat(fd, (struct stat *)TO_HOST(addr));
+    wbuf_sync(fd);
+    int ret = fstat(fd, (struct stat *)TO_HOST(m->mmu->mem, addr));
+    return ret == -1 ? -errno : ret;
 }
 
 static u64 sys_gettimeofday(machine_t *m) {
     GET(a0, tv_addr); GET(a1, tz_addr);
-    struct timeval *tv = (struct timeval *)TO_HOST(tv_addr);
+    struct timeval *tv = (struct timeval *)TO_HOST(m->mmu->mem, tv_addr);
     struct timezone *tz = NULL;
-    if (tz_addr != 0) tz = (struct timezone *)TO_HOST(tz_addr);
+    if (tz_addr != 0) tz = (struct timezone *)TO_HOST(m->mmu->mem, tz_addr);
     return gettimeofday(tv, tz);
 }
 
 static u64 sys_brk(machine_t *m) {
     GET(a0, addr);
-    if (addr == 0) addr = m->mmu.alloc;
-    assert(addr >= m->mmu.base);
-    i64 incr = (i64)addr - m->mmu.alloc;
-    mmu_alloc(&m->mmu, incr);
+    pthread_mutex_lock(&m->mmu->lock);
+    /* like the kernel, a break that does not fit leaves it where it is */
+    if (addr < m->mmu->base || addr > GUEST_MMAP_BASE) addr = m->mmu->alloc;
+    i64 incr = (i64)addr - m->mmu->alloc;
+    mmu_alloc(m->mmu, incr);
+    pthread_mutex_unlock(&m->mmu->lock);
     return addr;
 }
 
+/* riscv64 linux shares the generic prot/map/mremap flag values with the host */
+static u64 sys_mmap(machine_t *m) {
+    GET(a0, addr); GET(a1, len); GET(a2, prot); GET(a3, flags); GET(a4, fd); GET(a5, off);
+    if (!(flags & MAP_ANONYMOUS)) {
+        wbuf_sync(fd);
+        uring_sync(fd);
+    }
+    return mmu_map(m->mmu, addr, len, prot, flags, (int)fd, off);
+}
+
+static u64 sys_munmap(machine_t *m) {
+    GET(a0, addr); GET(a1, len);
+    return mmu_unmap(m->mmu, addr, len);
+}
+
+static u64 sys_mremap(machine_t *m) {
+    GET(a0, old); GET(a1, old_len); GET(a2, new_len); GET(a3, flags); GET(a4, new_addr);
+    return mmu_remap(m->mmu, old, old_len, new_len, flags, new_addr);
+}
+
+static u64 sys_mprotect(machine_t *m) {
+    GET(a0, addr); GET(a1, len); GET(a2, prot);
+    return mmu_protect(m->mmu, addr, len, prot);
+}
+
+static u64 sys_madvise(machine_t *m) {
+    GET(a0, addr); GET(a1, len); GET(a2, advice);
+    return mmu_advise(m->mmu, addr, len, advice);
+}
+
 // the O_* macros is OS dependent.
 // here is a workaround to convert newlib flags to the host.
 #define NEWLIB_O_RDONLY   0x0
@@ -138,34 +384,77 @@ static int convert_flags(int flags) {
 
 static u64 sys_openat(machine_t *m) {
     GET(a0, dirfd); GET(a1, nameptr); GET(a2, flags); GET(a3, mode);
-    return openat(dirfd, (char *)TO_HOST(nameptr), convert_flags(flags), mode);
+    int fd = openat(dirfd, (char *)TO_HOST(m->mmu->mem, nameptr), convert_flags(flags), mode);
+    wbuf_forget(fd);
+    uring_forget(fd);
+    return fd;
 }
 
 static u64 sys_open(machine_t *m) {
     GET(a0, nameptr); GET(a1, flags); GET(a2, mode);
-    u64 ret = open((char *)TO_HOST(nameptr), convert_flags(flags), (mode_t)mode);
+    u64 ret = open((char *)TO_HOST(m->mmu->mem, nameptr), convert_flags(flags), (mode_t)mode);
+    wbuf_forget(ret);
+    uring_forget(ret);
     return ret;
 }
 
 static u64 sys_lseek(machine_t *m) {
     GET(a0, fd); GET(a1, offset); GET(a2, whence);
-    return lseek(fd, offset, whence);
+    wbuf_sync(fd);
+    uring_sync(fd);
+    off_t ret = lseek(fd, offset, whence);
+    return ret == -1 ? -errno : ret;
+}
+
+/* a --snapshot is taken at the first read from stdin */
+static void before_read(machine_t *m, u64 fd) {
+    wbuf_before_read(fd);
+    if (m->snapshot != NULL && fd == 0) {
+        snapshot_save(m, m->snapshot);
+        m->snapshot = NULL;
+    }
 }
 
 static u64 sys_read(machine_t *m) {
     GET(a0, fd); GET(a1, bufptr); GET(a2, count);
-    return read(fd, (char *)TO_HOST(bufptr), (size_t)count);
+    before_read(m, fd);
+    i64 ret;
+    if (uring_read(fd, (void *)TO_HOST(m->mmu->mem, bufptr), count, &ret)) return ret;
+    ret = read(fd, (char *)TO_HOST(m->mmu->mem, bufptr), (size_t)count);
+    return ret == -1 ? -errno : ret;
+}
+
+static u64 sys_readv(machine_t *m) {
+    GET(a0, fd); GET(a1, iovptr); GET(a2, iovcnt);
+    struct iovec *iov = iov_to_host(m, iovptr, iovcnt);
+    if (iov == NULL) return -EINVAL;
+    before_read(m, fd);
+    uring_sync(fd);
+    ssize_t ret = readv(fd, iov, iovcnt);
+    free(iov);
+    return ret == -1 ? -errno : ret;
+}
+
+static u64 sys_pread(machine_t *m) {
+    GET(a0, fd); GET(a1, bufptr); GET(a2, count); GET(a3, offset);
+    wbuf_before_read(fd);
+    ssize_t ret = pread(fd, (void *)TO_HOST(m->mmu->mem, bufptr), (size_t)count, (off_t)offset);
+    return ret == -1 ? -errno : ret;
 }
 
 static syscall_t syscall_table[] = {
     [SYS_exit] =           sys_exit,
-    [SYS_exit_group] =     sys_exit,
+    [SYS_exit_group] =     sys_exit_group,
     [SYS_read] =           sys_read,
-    [SYS_pread] =          sys_unimplemented,
+    [SYS_readv] =          sys_readv,
+    [SYS_pread] =          sys_pread,
     [SYS_write] =          sys_write,
+    [SYS_writev] =         sys_writev,
+    [SYS_pwrite] =         sys_pwrite,
     [SYS_openat] =         sys_openat,
     [SYS_close] =          sys_close,
     [SYS_fstat] =          sys_fstat,
+    [SYS_fsync] =          sys_fsync,
     [SYS_statx] =          sys_unimplemented,
     [SYS_lseek] =          sys_lseek,
     [SYS_fstatat] =        sys_unimplemented,
@@ -176,21 +465,21 @@ static syscall_t syscall_table[] = {
     [SYS_getcwd] =         sys_unimplemented,
     [SYS_brk] =            sys_brk,
     [SYS_uname] =          sys_unimplemented,
-    [SYS_getpid] =         sys_unimplemented,
+    [SYS_getpid] =         sys_getpid,
     [SYS_getuid] =         sys_unimplemented,
     [SYS_geteuid] =        sys_unimplemented,
     [SYS_getgid] =         sys_unimplemented,
     [SYS_getegid] =        sys_unimplemented,
-    [SYS_gettid] =         sys_unimplemented,
+    [SYS_gettid] =         sys_gettid,
     [SYS_tgkill] =         sys_unimplemented,
-    [SYS_mmap] =           sys_unimplemented,
-    [SYS_munmap] =         sys_unimplemented,
-    [SYS_mremap] =         sys_unimplemented,
-    [SYS_mprotect] =       sys_unimplemented,
+    [SYS_mmap] =           sys_mmap,
+    [SYS_munmap] =         sys_munmap,
+    [SYS_mremap] =         sys_mremap,
+    [SYS_mprotect] =       sys_mprotect,
+    [SYS_madvise] =        sys_madvise,
     [SYS_rt_sigaction] =   sys_unimplemented,
     [SYS_gettimeofday] =   sys_gettimeofday,
     [SYS_times] =          sys_unimplemented,
-    [SYS_writev] =         sys_unimplemented,
     [SYS_faccessat] =      sys_unimplemented,
     [SYS_fcntl] =          sys_unimplemented,
     [SYS_ftruncate] =      sys_unimplemented,
@@ -200,6 +489,11 @@ static syscall_t syscall_table[] = {
     [SYS_rt_sigprocmask] = sys_unimplemented,
     [SYS_clock_gettime] =  sys_unimplemented,
     [SYS_chdir] =          sys_unimplemented,
+    [SYS_clone] =          sys_clone,
+    [SYS_futex] =          sys_futex,
+    [SYS_set_tid_address] = sys_set_tid_address,
+    [SYS_set_robust_list] = sys_set_robust_list,
+    [SYS_sched_yield] =    sys_sched_yield,
 };
 
 static syscall_t old_syscall_table[] = {
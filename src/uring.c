@@ -0,0 +1,335 @@
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+#include "rvemu.h"
+
+/**
+ * sequential readahead through io_uring, off unless uring_enable is called.
+ * once a guest reads a regular file RA_AFTER times in a row, RA_DEPTH
+ * chunks ahead of its position are kept in flight, submitted in a batch,
+ * and its reads are served from them: the disk works while the guest
+ * computes, and most reads need no syscall at all. the file position then
+ * lives here, and goes back to the host before anything else that uses
+ * the fd or writes to the file (uring_sync), and at the end of the file,
+ * so plain reads see it grow. without io_uring on the host, reads stay
+ * plain.
+ *
+ * each fd has its own ring and lock, so a guest waiting on the disk holds
+ * up only readers of the same fd; as a guest blocked in a syscall holds up
+ * only its own host thread (see machine.c), other guests run on regardless.
+ */
+
+#define RA_FDS   64
+#define RA_DEPTH 4
+#define RA_CHUNK (128 * 1024)
+#define RA_AFTER 2
+
+typedef struct {
+    u64 off;
+    u8 *data;
+    i32 res;
+    bool pending;
+} ra_chunk_t;
+
+typedef struct {
+    bool up;
+    int fd;
+    u32 *sq_tail;
+    u32 *sq_mask;
+    u32 *sq_array;
+    u32 *cq_head;
+    u32 *cq_tail;
+    u32 *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    u32 queued;
+} ring_t;
+
+typedef struct {
+    lock_t lock;   /* held across waits for the disk, so per fd */
+    bool known;    /* looked at since the fd was last opened or closed */
+    bool regular;
+    u64 dev;
+    u64 ino;
+    u32 streak;    /* reads since the position last moved otherwise */
+    bool active;   /* written under lock, read without it by uring_sync */
+    u64 pos;       /* the guest's file position while active */
+    u64 next;      /* where the next chunk to submit starts */
+    u32 head;      /* the chunk holding pos */
+    ra_chunk_t chunks[RA_DEPTH];
+    ring_t ring;
+} ra_t;
+
+static ra_t ras[RA_FDS];
+static lock_t enable_lock = LOCK_INITIALIZER;
+static bool enabled;
+static bool ring_failed;
+static u32 num_active;
+
+static bool ring_setup(ring_t *ring) {
+    if (ring->up) return true;
+    if (__atomic_load_n(&ring_failed, __ATOMIC_RELAXED)) return false;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, RA_DEPTH, &p);
+    if (fd == -1) {
+        __atomic_store_n(&ring_failed, true, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    u64 sq_size = p.sq_off.array + p.sq_entries * sizeof(u32);
+    u64 cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_size = cq_size = MAX(sq_size, cq_size);
+
+    u8 *sq = (u8 *)mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+    u8 *cq = single ? sq : (u8 *)mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd);
+        __atomic_store_n(&ring_failed, true, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    ring->sq_tail = (u32 *)(sq + p.sq_off.tail);
+    ring->sq_mask = (u32 *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (u32 *)(sq + p.sq_off.array);
+    ring->cq_head = (u32 *)(cq + p.cq_off.head);
+    ring->cq_tail = (u32 *)(cq + p.cq_off.tail);
+    ring->cq_mask = (u32 *)(cq + p.cq_off.ring_mask);
+    ring->sqes = (struct io_uring_sqe *)sqes;
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    ring->fd = fd;
+    ring->up = true;
+    return true;
+}
+
+/* there is room: at most RA_DEPTH chunks are ever in flight */
+static void ring_queue(ring_t *ring, int fd, ra_chunk_t *c) {
+    u32 tail = *ring->sq_tail;
+    u32 idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (u64)c->data;
+    sqe->len = RA_CHUNK;
+    sqe->off = c->off;
+    sqe->user_data = (u64)c;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    c->pending = true;
+    ring->queued++;
+}
+
+static void ring_enter(ring_t *ring, u32 wait) {
+    while (syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait,
+                   wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0) == -1) {
+        if (errno != EINTR) fatal(strerror(errno));
+    }
+    ring->queued = 0;
+}
+
+static void ring_reap(ring_t *ring) {
+    u32 head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        ra_chunk_t *c = (ra_chunk_t *)cqe->user_data;
+        c->res = cqe->res;
+        c->pending = false;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void ring_wait(ring_t *ring, ra_chunk_t *c) {
+    ring_reap(ring);
+    while (c->pending) {
+        ring_enter(ring, 1);
+        ring_reap(ring);
+    }
+}
+
+static ra_t *lookup_locked(int fd) {
+    ra_t *r = &ras[fd];
+    if (!r->known) {
+        struct stat st;
+        r->regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+        r->dev = r->regular ? st.st_dev : 0;
+        r->ino = r->regular ? st.st_ino : 0;
+        r->streak = 0;
+        /* last, uring_sync reads the rest once it sees this */
+        __atomic_store_n(&r->known, true, __ATOMIC_RELEASE);
+    }
+    return r;
+}
+
+static bool ra_start(ra_t *r, int fd) {
+    if (!ring_setup(&r->ring)) return false;
+
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos == -1) return false;
+
+    r->pos = r->next = pos;
+    r->head = 0;
+    for (int i = 0; i < RA_DEPTH; i++) {
+        ra_chunk_t *c = &r->chunks[i];
+        if (c->data == NULL) c->data = (u8 *)malloc(RA_CHUNK);
+        c->off = r->next;
+        r->next += RA_CHUNK;
+        ring_queue(&r->ring, fd, c);
+    }
+    ring_enter(&r->ring, 0);
+
+    __atomic_store_n(&r->active, true, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&num_active, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* hands the position back to the host once nothing is in flight */
+static void ra_stop(ra_t *r, int fd) {
+    for (int i = 0; i < RA_DEPTH; i++) ring_wait(&r->ring, &r->chunks[i]);
+    lseek(fd, r->pos, SEEK_SET);
+    __atomic_store_n(&r->active, false, __ATOMIC_RELEASE);
+    r->streak = 0;
+    __atomic_sub_fetch(&num_active, 1, __ATOMIC_RELAXED);
+}
+
+static void after_fork(void) {
+    lock_reset(&enable_lock);
+    for (int i = 0; i < RA_FDS; i++) {
+        ra_t *r = &ras[i];
+        lock_reset(&r->lock);
+        /* the rings are shared with the parent; leave them to the parent */
+        if (r->ring.up) close(r->ring.fd);
+        r->ring.up = false;
+        r->known = r->active = false;
+    }
+    num_active = 0;
+}
+
+void uring_enable(void) {
+    lock_acquire(&enable_lock);
+    if (!enabled) {
+        for (int i = 0; i < RA_FDS; i++) ras[i].lock = (lock_t)LOCK_INITIALIZER;
+        pthread_atfork(NULL, NULL, after_fork);
+    }
+    __atomic_store_n(&enabled, true, __ATOMIC_RELEASE);
+    lock_release(&enable_lock);
+}
+
+/**
+ * returns false if the read is not served from readahead, and the caller
+ * should do it itself; true with *ret set otherwise.
+ */
+bool uring_read(int fd, void *buf, u64 count, i64 *ret) {
+    if (!enabled || fd < 0 || fd >= RA_FDS) return false;
+
+    ra_t *r = &ras[fd];
+    lock_acquire(&r->lock);
+    lookup_locked(fd);
+    if (!r->regular || (!r->active && (++r->streak < RA_AFTER || !ra_start(r, fd)))) {
+        lock_release(&r->lock);
+        return false;
+    }
+
+    u64 done = 0;
+    bool eof = false;
+    while (done < count) {
+        ra_chunk_t *c = &r->chunks[r->head];
+        ring_wait(&r->ring, c);
+        /* errors are left to a plain read to report */
+        if (c->res < 0 || r->pos >= c->off + c->res) {
+            eof = true;
+            break;
+        }
+
+        u64 n = MIN(count - done, c->off + c->res - r->pos);
+        memcpy((u8 *)buf + done, c->data + (r->pos - c->off), n);
+        done += n;
+        r->pos += n;
+
+        if (r->pos == c->off + RA_CHUNK) {
+            c->off = r->next;
+            r->next += RA_CHUNK;
+            ring_queue(&r->ring, fd, c);
+            r->head = (r->head + 1) % RA_DEPTH;
+        }
+    }
+    if (r->ring.queued > 0) ring_enter(&r->ring, 0);
+    if (eof) ra_stop(r, fd);
+    lock_release(&r->lock);
+
+    if (done == 0 && eof) return false;
+    *ret = done;
+    return true;
+}
+
+static void stop(int fd) {
+    ra_t *r = &ras[fd];
+    lock_acquire(&r->lock);
+    if (r->active) ra_stop(r, fd);
+    lock_release(&r->lock);
+}
+
+/**
+ * before anything else that uses fd's position or writes to its file.
+ * fd's file is looked at once, then known until fd is forgotten, so with
+ * nothing active on that file this takes no lock and no syscall.
+ */
+void uring_sync(int fd) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_ACQUIRE)) return;
+    if (__atomic_load_n(&num_active, __ATOMIC_RELAXED) == 0) return;
+
+    u64 dev = 0, ino = 0;
+    bool regular = true;
+    if (fd >= 0 && fd < RA_FDS) {
+        ra_t *w = &ras[fd];
+        __atomic_store_n(&w->streak, 0, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&w->active, __ATOMIC_ACQUIRE)) stop(fd);
+        if (!__atomic_load_n(&w->known, __ATOMIC_ACQUIRE)) {
+            lock_acquire(&w->lock);
+            lookup_locked(fd);
+            lock_release(&w->lock);
+        }
+        regular = w->regular;
+        dev = w->dev;
+        ino = w->ino;
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) == -1) return;
+        regular = S_ISREG(st.st_mode);
+        dev = st.st_dev;
+        ino = st.st_ino;
+    }
+    if (!regular) return;
+
+    /* dev and ino stay put while a readahead is active */
+    for (int i = 0; i < RA_FDS; i++) {
+        ra_t *r = &ras[i];
+        if (i == fd || !__atomic_load_n(&r->active, __ATOMIC_ACQUIRE)) continue;
+        if (r->dev == dev && r->ino == ino) stop(i);
+    }
+}
+
+/* fd was closed or opened: nothing may be in flight on it, look at it afresh */
+void uring_forget(int fd) {
+    if (!enabled || fd < 0 || fd >= RA_FDS) return;
+    ra_t *r = &ras[fd];
+    lock_acquire(&r->lock);
+    if (r->active) ra_stop(r, fd);
+    __atomic_store_n(&r->known, false, __ATOMIC_RELEASE);
+    lock_release(&r->lock);
+}
+
+void uring_sync_all(void) {
+    if (!enabled) return;
+    for (int i = 0; i < RA_FDS; i++) {
+        lock_drop(&ras[i].lock); /* a guest fault while copying unwinds with it held */
+        stop(i);
+    }
+}
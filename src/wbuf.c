@@ -0,0 +1,201 @@
+#include "rvemu.h"
+
+/**
+ * write coalescing, off unless wbuf_enable is called: small guest writes
+ * to terminals, pipes and regular files collect in a buffer per host fd
+ * and go out as one write when the buffer fills, once the oldest byte in
+ * it is WBUF_DELAY_MS old, before a read that may depend on it, and when
+ * the guest exits. buffers belong to the host fd, not to a machine, as
+ * embedded guests share the process's fds.
+ *
+ * writes to the same file through different fds (stdout and stderr on one
+ * terminal) keep their order: buffering for one fd first flushes the
+ * others. an error from a deferred write is returned by the next write.
+ */
+
+#define WBUF_FDS      64
+#define WBUF_SIZE     (64 * 1024)
+#define WBUF_DELAY_MS 20
+
+typedef struct {
+    bool known;    /* looked at since the fd was last opened or closed */
+    bool coalesce;
+    bool regular;
+    u64 dev;
+    u64 ino;
+    u8 *buf;
+    u64 len;
+    u64 since;     /* when buf got its first byte, in ms */
+    int err;
+} wbuf_t;
+
+static wbuf_t wbufs[WBUF_FDS];
+static lock_t wbuf_lock = LOCK_INITIALIZER;
+static bool enabled;
+static bool flusher_running;
+
+static u64 now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void flush_locked(int fd) {
+    wbuf_t *w = &wbufs[fd];
+    for (u64 done = 0; done < w->len; ) {
+        ssize_t n = write(fd, w->buf + done, w->len - done);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            w->err = errno;
+            break;
+        }
+        done += n;
+    }
+    w->len = 0;
+}
+
+static wbuf_t *lookup_locked(int fd) {
+    if (fd < 0 || fd >= WBUF_FDS) return NULL;
+
+    wbuf_t *w = &wbufs[fd];
+    if (!w->known) {
+        struct stat st;
+        w->known = true;
+        w->coalesce = w->regular = false;
+        if (fstat(fd, &st) == -1) return w;
+        w->regular = S_ISREG(st.st_mode);
+        w->coalesce = w->regular || S_ISFIFO(st.st_mode) || isatty(fd);
+        w->dev = st.st_dev;
+        w->ino = st.st_ino;
+        if (w->coalesce && w->buf == NULL) w->buf = (u8 *)malloc(WBUF_SIZE);
+    }
+    return w;
+}
+
+/* flushes every buffer going to the same file as fd, fd's included */
+static void sync_locked(int fd) {
+    wbuf_t *w = lookup_locked(fd);
+    for (int i = 0; i < WBUF_FDS; i++) {
+        if (wbufs[i].len == 0) continue;
+        if (w == NULL || (wbufs[i].dev == w->dev && wbufs[i].ino == w->ino)) flush_locked(i);
+    }
+}
+
+static void *flusher(void *arg) {
+    struct timespec delay = { .tv_sec = 0, .tv_nsec = WBUF_DELAY_MS * 1000000L };
+    while (true) {
+        nanosleep(&delay, NULL);
+
+        lock_acquire(&wbuf_lock);
+        u64 now = now_ms();
+        for (int i = 0; i < WBUF_FDS; i++) {
+            if (wbufs[i].len > 0 && now - wbufs[i].since >= WBUF_DELAY_MS) flush_locked(i);
+        }
+        lock_release(&wbuf_lock);
+    }
+    return NULL;
+}
+
+/* a forked child (see server.c) has the buffers but not the thread */
+static void after_fork(void) {
+    lock_reset(&wbuf_lock);
+    flusher_running = false;
+}
+
+void wbuf_enable(void) {
+    lock_acquire(&wbuf_lock);
+    if (!enabled) pthread_atfork(NULL, NULL, after_fork);
+    enabled = true;
+    lock_release(&wbuf_lock);
+}
+
+/**
+ * returns false if the write is not for coalescing, and the caller should
+ * do it itself; true with *ret set otherwise.
+ */
+bool wbuf_write(int fd, const void *data, u64 len, i64 *ret) {
+    if (!enabled) return false;
+
+    lock_acquire(&wbuf_lock);
+    wbuf_t *w = lookup_locked(fd);
+    if (w == NULL || !w->coalesce || len >= WBUF_SIZE / 2) {
+        sync_locked(fd);
+        lock_release(&wbuf_lock);
+        return false;
+    }
+
+    if (w->err != 0) {
+        *ret = -w->err;
+        w->err = 0;
+        lock_release(&wbuf_lock);
+        return true;
+    }
+
+    for (int i = 0; i < WBUF_FDS; i++) {
+        if (i != fd && wbufs[i].len > 0 && wbufs[i].dev == w->dev && wbufs[i].ino == w->ino)
+            flush_locked(i);
+    }
+    if (w->len + len > WBUF_SIZE) flush_locked(fd);
+    if (w->len == 0) w->since = now_ms();
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+
+    if (!flusher_running) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, flusher, NULL) != 0) fatal("cannot start the write flusher");
+        pthread_detach(tid);
+        flusher_running = true;
+    }
+
+    *ret = len;
+    lock_release(&wbuf_lock);
+    return true;
+}
+
+/* before anything that must see fd's file as written so far */
+void wbuf_sync(int fd) {
+    if (!enabled) return;
+    lock_acquire(&wbuf_lock);
+    sync_locked(fd);
+    lock_release(&wbuf_lock);
+}
+
+/**
+ * a read from a regular file only has to see that file's pending writes;
+ * anything else (a terminal, a pipe, stdin) may be answering a prompt, so
+ * everything goes out.
+ */
+void wbuf_before_read(int fd) {
+    if (!enabled) return;
+    lock_acquire(&wbuf_lock);
+    wbuf_t *w = lookup_locked(fd);
+    if (w != NULL && w->regular) {
+        sync_locked(fd);
+    } else {
+        for (int i = 0; i < WBUF_FDS; i++) {
+            if (wbufs[i].len > 0) flush_locked(i);
+        }
+    }
+    lock_release(&wbuf_lock);
+}
+
+/* fd was closed or opened: flush what it had and look at it afresh */
+void wbuf_forget(int fd) {
+    if (!enabled || fd < 0 || fd >= WBUF_FDS) return;
+    lock_acquire(&wbuf_lock);
+    if (wbufs[fd].len > 0) flush_locked(fd);
+    wbufs[fd].known = false;
+    wbufs[fd].err = 0;
+    lock_release(&wbuf_lock);
+}
+
+void wbuf_flush_all(void) {
+    if (!enabled) return;
+    lock_drop(&wbuf_lock); /* a guest fault while copying unwinds with it held */
+
+    lock_acquire(&wbuf_lock);
+    for (int i = 0; i < WBUF_FDS; i++) {
+        if (wbufs[i].len > 0) flush_locked(i);
+    }
+    lock_release(&wbuf_lock);
+}